@@ -12,24 +12,44 @@
 #include "Engine.h"
 
 #include "TestScene.h"
+#include "Shaders.h"
+#include "Texture.h"
+#include "TextureStreamer.h"
+#include "GPUMemory.h"
+#include "RenderTarget.h"
+#include "GLState.h"
+#include "ThreadPool.h"
+#include "tgalib.h"
 
 #include "CVar.h"
 #include "glstuff.h"
 #include "glv.h"
 #include "glm.hpp"
+#include "main.h"
 #include "../assimp/include/assimp/cimport.h"
 #include <time.h>
 
 static CVar cvQuit("quit");
 static CVar cvExtensios("r_printExtensions");
+static CVar cvScreenshot("screenshot"); // saves screenshotN.tga without stalling the frame
 
 static CVar cvWireframe("r_wireframe", false, CVar::FLAG_GUI_TWEAKABLE);
 static CVar cvFov("r_fov", 1, CVar::FLAG_GUI_TWEAKABLE|CVar::FLAG_GUI_PRINT, 0.2, 1.5);
 static CVar cvMouseSens("r_mouseSensitivity", 9.0);
 static CVar cvKeySens("r_keyboardSensitivity", 6.0);
+static CVar cvShaderWarmUp("r_shaderWarmUp", true);
+static CVar cvRenderScale("r_renderScale", 1.0f, CVar::FLAG_GUI_TWEAKABLE|CVar::FLAG_GUI_PRINT, 0.25f, 1.0f); // internal resolution relative to the window
+static CVar cvDynamicRes("r_dynamicRes", false, CVar::FLAG_GUI_TWEAKABLE); // scale the internal resolution to hit r_dynamicResTargetMs
+static CVar cvDynamicResTargetMs("r_dynamicResTargetMs", 16.6f);
+static CVar cvDynamicResMinScale("r_dynamicResMinScale", 0.5f);
+
+#define DYNRES_INTERVAL 30 // frames between render scale changes (resizing render targets isn't free)
+#define DYNRES_STEP 0.05f
 
 static glv::TextView* s_console = NULL;
 
+#define SHADER_MANIFEST_FILE "shader_manifest.txt"
+
 #ifdef WIN32
 # define strncasecmp strnicmp
 # define strcasecmp stricmp
@@ -400,6 +420,19 @@ bool CEngine::InInit()
     _rcaps.MRT = CheckExtension("GL_ARB_draw_buffers");
     _rcaps.floatTextures = CheckExtension("GL_ARB_texture_float");
     _rcaps.packedDepthStencil = CheckExtension("GL_EXT_packed_depth_stencil");
+    _rcaps.textureCompressionS3TC = CheckExtension("GL_EXT_texture_compression_s3tc");
+    _rcaps.textureCompressionRGTC = CheckExtension("GL_ARB_texture_compression_rgtc") || CheckExtension("GL_EXT_texture_compression_rgtc");
+    _rcaps.textureCompressionBPTC = CheckExtension("GL_ARB_texture_compression_bptc");
+    _rcaps.textureArray = CheckExtension("GL_EXT_texture_array");
+    _rcaps.samplerObjects = CheckExtension("GL_ARB_sampler_objects");
+    _rcaps.instancing = CheckExtension("GL_ARB_draw_instanced") && CheckExtension("GL_ARB_instanced_arrays");
+    _rcaps.depthBoundsTest = CheckExtension("GL_EXT_depth_bounds_test");
+    _rcaps.timerQuery = CheckExtension("GL_ARB_timer_query") || CheckExtension("GL_EXT_timer_query");
+    _rcaps.pixelBufferObject = CheckExtension("GL_ARB_pixel_buffer_object");
+    _rcaps.fenceSync = CheckExtension("GL_ARB_sync");
+    _rcaps.invalidateSubdata = CheckExtension("GL_ARB_invalidate_subdata");
+    if (_rcaps.textureArray)
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &_rcaps.maxArrayTextureLayers);
     glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &_rcaps.maxColorAttachments);
     glGetIntegerv(GL_MAX_DRAW_BUFFERS, &_rcaps.maxDrawBuffers);
     if (CheckExtension("GL_EXT_texture_filter_anisotropic"))
@@ -415,6 +448,16 @@ bool CEngine::InInit()
     printf(" %18s : %d\n", "Max. Draw Buffers", _rcaps.maxColorAttachments);
     printf(" %18s : %s\n", "Float Textures", _rcaps.floatTextures?"yes":"no");
     printf(" %18s : %s\n", "PackedDepthStencil", _rcaps.packedDepthStencil?"yes":"no");
+    printf(" %18s : S3TC %s, RGTC %s, BPTC %s\n", "Tex. Compression", _rcaps.textureCompressionS3TC?"yes":"no",
+           _rcaps.textureCompressionRGTC?"yes":"no", _rcaps.textureCompressionBPTC?"yes":"no");
+    printf(" %18s : %s (%d layers)\n", "Texture Arrays", _rcaps.textureArray?"yes":"no", _rcaps.maxArrayTextureLayers);
+    printf(" %18s : %s\n", "Sampler Objects", _rcaps.samplerObjects?"yes":"no");
+    printf(" %18s : %s\n", "Instancing", _rcaps.instancing?"yes":"no");
+    printf(" %18s : %s\n", "DepthBoundsTest", _rcaps.depthBoundsTest?"yes":"no");
+    printf(" %18s : %s\n", "TimerQuery", _rcaps.timerQuery?"yes":"no");
+    printf(" %18s : %s\n", "PixelBufferObject", _rcaps.pixelBufferObject?"yes":"no");
+    printf(" %18s : %s\n", "FenceSync", _rcaps.fenceSync?"yes":"no");
+    printf(" %18s : %s\n", "InvalidateSubdata", _rcaps.invalidateSubdata?"yes":"no");
     printf(" %18s : %d\n", "Max. Anisotropy", _rcaps.maxTextureAnisotropy);
     printf(" %18s : %s\n", "Extensions", glGetString(GL_EXTENSIONS));
     printf("\n");
@@ -425,10 +468,23 @@ bool CEngine::InInit()
     // init GLV
     InitGLV();
     
+    // G-buffer layout is fixed for the session; every shader is compiled with it
+    CShaderDefines globalDefines;
+    IScene::DefineNormalEncoding(globalDefines, IScene::GetNormalEncoding());
+    CShaderManager::Inst()->SetGlobalDefines(globalDefines);
+    printf("G-buffer normal encoding: %s\n", IScene::GetNormalEncodingName(IScene::GetNormalEncoding()));
+    
+    // compile program permutations requested in previous sessions up front
+    if (cvShaderWarmUp)
+        CShaderManager::Inst()->WarmUpFromManifest(GetManifestPath());
+    
     // initialize the scene
     _scene = new CTestScene();
     _scene->Init();
     
+    // from now on, every newly compiled program permutation is a hitch
+    CShaderManager::Inst()->SetWarnOnCompile(true);
+    
     // setup camera
     _cam.SetPosition(glm::vec3(0,0,0));
     _cam.SetNearAndFarPlanes(1, 100);
@@ -502,7 +558,7 @@ void CEngine::InSizeChange(int wid, int hei)
     _screenSize.width = wid; _screenSize.height = hei;
     
     // use the whole window
-    glViewport(0, 0, _screenSize.width, _screenSize.height);
+    CGLState::SetViewport(0, 0, _screenSize.width, _screenSize.height);
     
     // update camera
     _cam.SetViewportAspectRatio(float(_screenSize.width)/_screenSize.height);
@@ -513,12 +569,62 @@ void CEngine::InSizeChange(int wid, int hei)
     // set glv size
     _glv.width(wid);
     _glv.height(hei);
+    
+    ApplyRenderSize();
+}
+
+void CEngine::ApplyRenderSize()
+{
+    if (!_screenSize.width || !_screenSize.height) return; // minimized
+    
+    SScreenSize size;
+    size.width = Max(1u, unsigned(_screenSize.width * _renderScale + 0.5f));
+    size.height = Max(1u, unsigned(_screenSize.height * _renderScale + 0.5f));
+    
+    if (size.width == _renderSize.width && size.height == _renderSize.height)
+        return;
+    
+    _renderSize = size;
+    if (_scene) _scene->Resize(size.width, size.height);
+}
+
+void CEngine::UpdateRenderScale(float deltaTime)
+{
+    float maxScale = cvRenderScale.GetFloat();
+    
+    if (!cvDynamicRes)
+    {
+        _renderScale = maxScale;
+        _frameTimeAvg = 0;
+        return;
+    }
+    
+    float ms = deltaTime * 1000.0f;
+    _frameTimeAvg = _frameTimeAvg ? _frameTimeAvg*0.9f + ms*0.1f : ms;
+    
+    if (++_dynResFrames < DYNRES_INTERVAL)
+        return;
+    _dynResFrames = 0;
+    
+    // leave some room around the target so the scale doesn't oscillate
+    float target = cvDynamicResTargetMs.GetFloat();
+    if (_frameTimeAvg < target*1.05f && _frameTimeAvg > target*0.85f)
+        return;
+    
+    // frame cost is roughly proportional to the pixel count, ie. scale^2
+    float scale = _renderScale * sqrtf(target / _frameTimeAvg);
+    scale = floorf(scale/DYNRES_STEP + 0.5f) * DYNRES_STEP;
+    scale = MinMax(scale, Min(cvDynamicResMinScale.GetFloat(), maxScale), maxScale);
+    
+    _renderScale = scale;
 }
 
 void CEngine::InUpdate(float deltaTime)
 {
     _deltaT = deltaTime;
     
+    UpdateRenderScale(deltaTime);
+    
     // update camera
     float fx = _glv.mouse().x(), fy = _glv.mouse().y();
     if (_glv.focusedView()->findTarget(fx, fy) == &_glv)
@@ -550,14 +656,21 @@ void CEngine::InUpdate(float deltaTime)
     
     // status line
     char status[512];
-    sprintf(status, "FPS: %.0f", 1.0f/deltaTime);
+    const CTexture::SBindStats& bs = CTexture::GetBindStats();
+    const CGLState::SStats& ss = CGLState::GetStats();
+    const CGPUMemory* gm = CGPUMemory::Inst();
+    sprintf(status, "FPS: %.0f (%.2f ms), Res: %ux%u (%.0f%%), Lights: %u of %u, Lit px: %.2fM, Tex. binds: %u (%u redundant skipped), Sampler binds: %u, GL state: %u calls (%u redundant skipped), GPU MB: %u tex, %u mesh, %u RT (budget %u)",
+            1.0f/deltaTime, deltaTime*1000, _renderSize.width, _renderSize.height, _renderScale*100,
+            _scene ? _scene->GetLightManager().GetNumVisible() : 0, _scene ? _scene->GetLightManager().GetNumLights() : 0, (_scene ? _scene->GetShadedLightPixels() : 0)/1e6f, bs.binds, bs.redundantBinds, bs.samplerBinds, ss.calls, ss.redundantCalls, (unsigned)(gm->GetUsed(GPUMEM_TEXTURE)>>20),
+            (unsigned)(gm->GetUsed(GPUMEM_MESH)>>20), (unsigned)(gm->GetUsed(GPUMEM_RENDERTARGET)>>20), (unsigned)(gm->GetBudget()>>20));
     _status->setValue(std::string(status));
 }
 
 void CEngine::InRender()
 {
-    // set MVP matrix each frame...
-    InSizeChange(_screenSize.width, _screenSize.height);
+    // projection (r_fov) and render size (dynamic resolution) may change every frame; the rest only in InSizeChange
+    _cam.SetFieldOfView( glm::degrees(cvFov.GetFloat()) );
+    ApplyRenderSize();
     
     glGetError();
     
@@ -567,22 +680,41 @@ void CEngine::InRender()
     // SCENE
     glClearColor(0.0, 1.0, 1.0, 0.0);
     
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    CGLState::Enable(GL_CULL_FACE);
+    CGLState::SetCullFace(GL_BACK);
     
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
+    CGLState::Enable(GL_DEPTH_TEST);
+    CGLState::SetDepthFunc(GL_LEQUAL);
     
     if (_scene) _scene->Draw();
+    _cam.EndFrame();
+    
+    // the scene without the GUI; saved frames later when the copy is done
+    if (_screenshotRequested && !_screenshotTicket)
+    {
+        _screenshotTicket = CRenderTarget::Screen().ReadColorPixelsAsync(0, 0, 0, _screenSize.width, _screenSize.height);
+        _screenshotSize = _screenSize;
+        _screenshotRequested = false;
+    }
+    else if (_screenshotTicket)
+        SaveScreenshot();
+    
+    // upload/drop mip levels requested while drawing
+    CTextureStreamer::Inst()->Update();
+    CGPUMemory::Inst()->Update();
+    CTexture::EndFrame();
     
     // GLV
     CShaderProgram::None().Use();
+    CGLState::BindFramebuffer(0);
+    CGLState::SetViewport(0, 0, _screenSize.width, _screenSize.height);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     glDisable(GL_TEXTURE_2D);
     glMatrixMode (GL_TEXTURE);
     glLoadIdentity();
     
     _glv.drawGLV(_screenSize.width, _screenSize.height, GLUT_ELAPSED_TIME);
+    CGLState::EndFrame(); // GLV doesn't go through CGLState
     
     // SWAP!
     glutSwapBuffers();
@@ -636,9 +768,50 @@ bool CEngine::ProcessConsoleLine(const char* line)
     return ret;
 }
 
-void CEngine::Shutdown()
+const char* CEngine::GetManifestPath()const
+{
+    static char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", GetExecutableDir(), SHADER_MANIFEST_FILE);
+    return path;
+}
+
+void CEngine::Shutdown(int exitCode)
+{
+    // remember program permutations of this session for warming up the next one
+    CShaderManager::Inst()->SaveManifest(GetManifestPath());
+    
+    // the screen target is a static destroyed after the context, so free its GL objects now
+    CRenderTarget::Screen().ReleaseReadbackBuffers();
+    _screenshotTicket = 0;
+    
+    CThreadPool::Inst()->Stop();
+    fflush(stdout);
+    
+    exit(exitCode);
+}
+
+void CEngine::SaveScreenshot()
 {
-    exit(0);
+    const CRenderTarget& screen = CRenderTarget::Screen();
+    if (!screen.IsReadbackReady(_screenshotTicket))
+        return;
+    
+    unsigned bytes = 0;
+    const void* pixels = screen.MapReadback(_screenshotTicket, &bytes);
+    if (pixels)
+    {
+        // tgaSave converts the pixels in place and frees them
+        unsigned char* data = (unsigned char*)malloc(bytes);
+        memcpy(data, pixels, bytes);
+        char name[] = "screenshot";
+        if (tgaSaveSeries(name, _screenshotSize.width, _screenshotSize.height, 32, data) == TGA_OK)
+            printf("Screenshot saved\n");
+        else
+            printf("Error saving the screenshot\n");
+    }
+    
+    screen.ReleaseReadback(_screenshotTicket);
+    _screenshotTicket = 0;
 }
 
 bool CEngine::CVarCalled(CVar *cv, unsigned int argc, const char **argv, bool& outResult)
@@ -653,6 +826,11 @@ bool CEngine::CVarCalled(CVar *cv, unsigned int argc, const char **argv, bool& o
         printf("OpenGL Extensions: %s\n", glGetString(GL_EXTENSIONS));
         return true;
     }
+    else if (cv == &cvScreenshot)
+    {
+        _screenshotRequested = true;
+        return true;
+    }
     
     return false;
 }
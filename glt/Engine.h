@@ -23,7 +23,8 @@ public:
     struct SRendererCaps
     {
         SRendererCaps():MRT(false),floatTextures(false),packedDepthStencil(false),
-        maxColorAttachments(1),maxDrawBuffers(1), maxTextureAnisotropy(0){ api[0]=0; renderer[0]=0; glsl[0]=0;};
+        textureCompressionS3TC(false),textureCompressionRGTC(false),textureCompressionBPTC(false),textureArray(false),
+        samplerObjects(false),instancing(false),depthBoundsTest(false),timerQuery(false),pixelBufferObject(false),fenceSync(false),invalidateSubdata(false),maxArrayTextureLayers(0),maxColorAttachments(1),maxDrawBuffers(1), maxTextureAnisotropy(0){ api[0]=0; renderer[0]=0; glsl[0]=0;};
         
         char api[64];
         char renderer[64];
@@ -31,6 +32,18 @@ public:
         bool MRT;
         bool floatTextures;
         bool packedDepthStencil;
+        bool textureCompressionS3TC; // BC1-BC3 (DXT1-DXT5)
+        bool textureCompressionRGTC; // BC4-BC5
+        bool textureCompressionBPTC; // BC7
+        bool textureArray; // GL_TEXTURE_2D_ARRAY
+        bool samplerObjects; // GL_ARB_sampler_objects
+        bool instancing; // GL_ARB_draw_instanced + GL_ARB_instanced_arrays (per-instance vertex attributes)
+        bool depthBoundsTest; // GL_EXT_depth_bounds_test
+        bool timerQuery; // GL_TIME_ELAPSED queries (GL_ARB_timer_query or GL_EXT_timer_query)
+        bool pixelBufferObject; // GL_ARB_pixel_buffer_object
+        bool fenceSync; // GL_ARB_sync
+        bool invalidateSubdata; // GL_ARB_invalidate_subdata (glInvalidateFramebuffer)
+        int maxArrayTextureLayers;
         int maxColorAttachments; // in a MRT
         int maxDrawBuffers; // mostly for MRT https://www.opengl.org/sdk/docs/man4/xhtml/glDrawBuffers.xml
         int maxTextureAnisotropy; // 0-anisotropic filtering unavailable, maximum amount of anisotropy otherwise
@@ -57,7 +70,12 @@ public:
         return inst;
     }
     
-    CEngine() : _scene(0), _deltaT(0.00001f), _status(NULL) {};
+    CEngine() : _scene(0), _deltaT(0.00001f), _status(NULL), _renderScale(1), _frameTimeAvg(0), _dynResFrames(0),
+    _screenshotRequested(false), _screenshotTicket(0)
+    {
+        _screenSize.width = _screenSize.height = 0;
+        _renderSize = _screenSize;
+    };
     
     void InKeyboard(unsigned char key, bool down, bool special);
     void InMouseClick(int btn, int ax, int ay, bool down);
@@ -68,13 +86,16 @@ public:
     void InRender();
     
     bool ProcessConsoleLine(const char* line);
-    void Shutdown();
+    /// Saves session data, frees what can't wait for static destruction and exits the process
+    void Shutdown(int exitCode = 0);
     const SRendererCaps& GetRendererCapabilities()const{ return _rcaps; };
     const SRendererConfig& GetRendererConfig()const{ return _config; };
     
     IScene* GetScene()const{ return _scene; };
     void SetScene(IScene* scene){ _scene = scene; };
     const SScreenSize& GetScreenSize()const{ return _screenSize; };
+    /// Size the scene is rendered at before being upscaled to the screen (r_renderScale, r_dynamicRes)
+    const SScreenSize& GetRenderSize()const{ return _renderSize; };
     const CFlyCamera& GetCamera()const{ return _cam; };
     
     float GetDeltaTime(){ return _deltaT; };
@@ -83,6 +104,13 @@ public:
 private:
     bool CVarCalled(CVar* cv, unsigned argc, const char* argv[], bool& outResult);
     void InitGLV();
+    const char* GetManifestPath()const;
+    /// Adjusts _renderScale towards the frame time target
+    void UpdateRenderScale(float deltaTime);
+    /// Resizes the scene render targets when the render size changed
+    void ApplyRenderSize();
+    /// Saves the screenshot once its asynchronous readback has finished
+    void SaveScreenshot();
     
     CFlyCamera _cam;
     IScene* _scene;
@@ -92,6 +120,13 @@ private:
     glv::Label* _status;
     float _downX, _downY;
     SScreenSize _screenSize;
+    SScreenSize _renderSize;
+    float _renderScale;
+    float _frameTimeAvg; // ms, smoothed
+    unsigned _dynResFrames; // since the last scale evaluation
+    bool _screenshotRequested; // by the screenshot command, read after the next frame
+    unsigned _screenshotTicket; // readback of the screen
+    SScreenSize _screenshotSize;
     
     SRendererCaps _rcaps;
     SRendererConfig _config;
@@ -0,0 +1,613 @@
+//
+//  FileSystem.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "FileSystem.h"
+#include "Shared.h"
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <dirent.h>
+#endif
+
+#include "../assimp/contrib/unzip/unzip.h"
+
+#define PAK_VERSION 1
+#define PAK_DATA_ALIGN 16
+
+unsigned long long CFileSystem::HashName(const char* name)
+{
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Base name of a path, without VFS_PREFIX
+static const char* entryName(const char* path)
+{
+    if (CFileSystem::IsVirtual(path))
+        path += sizeof(VFS_PREFIX)-1;
+    return basename(path);
+}
+
+static bool readDiskFile(const char* path, char*& outData, unsigned& outSize)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+    
+    fseek(fp, 0, SEEK_END);
+    unsigned size = (unsigned)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    // zero-terminated so that text files can be parsed in place
+    char* mem = (char*)malloc(size+1);
+    if (!mem || (size && fread(mem, size, 1, fp) != 1))
+    {
+        fclose(fp);
+        free(mem);
+        return false;
+    }
+    fclose(fp);
+    
+    mem[size] = 0;
+    outData = mem;
+    outSize = size;
+    return true;
+}
+
+CFileSystem::~CFileSystem()
+{
+    STD_FOREACH(std::vector<SArchive*>, _archives, it)
+    {
+        if ((*it)->zip) unzClose((*it)->zip);
+        delete *it;
+    }
+}
+
+bool CFileSystem::Mount(const char* archivePath)
+{
+    SArchive* ar = new SArchive();
+    ar->path = archivePath;
+    
+    struct stat st;
+    if (stat(archivePath, &st) == 0)
+        ar->mtime = (unsigned long long)st.st_mtime;
+    
+    size_t len = strlen(archivePath);
+    bool isZip = len > 4 && !strcmp(archivePath+len-4, ".zip");
+    
+    if (!(isZip ? MountZip(ar) : MountPak(ar)))
+    {
+        delete ar;
+        return false;
+    }
+    
+    _archives.push_back(ar);
+    return true;
+}
+
+bool CFileSystem::MountPak(SArchive* ar)
+{
+    if (!ar->pak.Open(ar->path.c_str()))
+        return false;
+    
+    const char* data = ar->pak.GetData();
+    unsigned size = ar->pak.GetSize();
+    const SPakHeader* hdr = (const SPakHeader*)data;
+    
+    if (size < sizeof(SPakHeader) || memcmp(hdr->magic, "GPK1", 4) || hdr->version != PAK_VERSION
+        || hdr->namesOffset > size || hdr->dirOffset > size || (size - hdr->dirOffset)/sizeof(SPakEntry) < hdr->numEntries)
+    {
+        printf("%s: Not a valid pak archive\n", ar->path.c_str());
+        return false;
+    }
+    
+    // a truncated or corrupted archive must not make lookups or reads go past the mapping
+    const SPakEntry* dir = (const SPakEntry*)(data + hdr->dirOffset);
+    for (unsigned i=0; i<hdr->numEntries; i++)
+    {
+        const SPakEntry& e = dir[i];
+        unsigned nameOffset = hdr->namesOffset + e.nameOffset;
+        
+        if (e.dataOffset > size || e.size > size - e.dataOffset
+            || nameOffset < hdr->namesOffset || nameOffset >= size || !memchr(data + nameOffset, 0, size - nameOffset))
+        {
+            printf("%s: Corrupted pak archive (entry %u is out of the file)\n", ar->path.c_str(), i);
+            return false;
+        }
+    }
+    
+    printf("Mounted %s (%u files)\n", ar->path.c_str(), hdr->numEntries);
+    return true;
+}
+
+bool CFileSystem::MountZip(SArchive* ar)
+{
+    unzFile zip = unzOpen(ar->path.c_str());
+    if (!zip) return false;
+    
+    int res = unzGoToFirstFile(zip);
+    while (res == UNZ_OK)
+    {
+        char name[1024];
+        unz_file_info info;
+        unz_file_pos pos;
+        
+        if (unzGetCurrentFileInfo(zip, &info, name, sizeof(name), NULL, 0, NULL, 0) == UNZ_OK
+            && info.size_filename && name[info.size_filename-1] != '/' && unzGetFilePos(zip, &pos) == UNZ_OK)
+        {
+            SZipEntry e;
+            e.name = basename(name);
+            e.hash = HashName(e.name.c_str());
+            e.posInDir = pos.pos_in_zip_directory;
+            e.numOfFile = pos.num_of_file;
+            e.size = (unsigned)info.uncompressed_size;
+            ar->zipEntries.push_back(e);
+        }
+        
+        res = unzGoToNextFile(zip);
+    }
+    
+    // stable so that the first file of the same base name wins
+    std::stable_sort(ar->zipEntries.begin(), ar->zipEntries.end());
+    
+    ar->zip = zip;
+    printf("Mounted %s (%u files)\n", ar->path.c_str(), (unsigned)ar->zipEntries.size());
+    return true;
+}
+
+void CFileSystem::MountDefaults()
+{
+    static const char* names[] = { "data.zip", "data.pak" };
+    
+    for (unsigned i=0; i<sizeof(names)/sizeof(names[0]); i++)
+    {
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", GetExecutableDir(), names[i]);
+        
+        struct stat st;
+        if (stat(path, &st) == 0)
+            Mount(path);
+    }
+}
+
+const CFileSystem::SArchive* CFileSystem::Find(const char* path, unsigned& outIndex)const
+{
+    if (_archives.empty()) return NULL;
+    
+    const char* name = entryName(path);
+    unsigned long long hash = HashName(name);
+    
+    // later archives override earlier ones
+    for (int a=(int)_archives.size()-1; a>=0; a--)
+    {
+        const SArchive* ar = _archives[a];
+        
+        if (ar->zip)
+        {
+            SZipEntry key;
+            key.hash = hash;
+            std::vector<SZipEntry>::const_iterator it = std::lower_bound(ar->zipEntries.begin(), ar->zipEntries.end(), key);
+            
+            for (; it != ar->zipEntries.end() && it->hash == hash; it++)
+            {
+                if (it->name == name)
+                {
+                    outIndex = (unsigned)(it - ar->zipEntries.begin());
+                    return ar;
+                }
+            }
+        }
+        else
+        {
+            const char* data = ar->pak.GetData();
+            const SPakHeader* hdr = (const SPakHeader*)data;
+            const SPakEntry* dir = (const SPakEntry*)(data + hdr->dirOffset);
+            
+            // lower bound
+            unsigned lo = 0, hi = hdr->numEntries;
+            while (lo < hi)
+            {
+                unsigned mid = (lo + hi)/2;
+                if (dir[mid].hash < hash)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            
+            for (; lo < hdr->numEntries && dir[lo].hash == hash; lo++)
+            {
+                if (!strcmp(data + hdr->namesOffset + dir[lo].nameOffset, name))
+                {
+                    outIndex = lo;
+                    return ar;
+                }
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+bool CFileSystem::Contains(const char* path)const
+{
+    unsigned index;
+    return Find(path, index) != NULL;
+}
+
+bool CFileSystem::MapFile(const char* path, const char*& outData, unsigned& outSize)const
+{
+    if (!IsVirtual(path)) return false;
+    
+    unsigned index;
+    const SArchive* ar = Find(path, index);
+    if (!ar || ar->zip) return false;
+    
+    const char* data = ar->pak.GetData();
+    const SPakEntry& e = ((const SPakEntry*)(data + ((const SPakHeader*)data)->dirOffset))[index];
+    
+    outData = data + e.dataOffset;
+    outSize = e.size;
+    return true;
+}
+
+bool CFileSystem::ReadZipEntry(const SArchive* ar, unsigned index, char*& outData, unsigned& outSize)const
+{
+    const SZipEntry& e = ar->zipEntries[index];
+    
+    char* mem = (char*)malloc(e.size+1);
+    if (!mem) return false;
+    
+    std::unique_lock<std::mutex> lock(_zipMutex);
+    
+    unz_file_pos pos;
+    pos.pos_in_zip_directory = e.posInDir;
+    pos.num_of_file = e.numOfFile;
+    
+    if (unzGoToFilePos(ar->zip, &pos) != UNZ_OK || unzOpenCurrentFile(ar->zip) != UNZ_OK)
+    {
+        free(mem);
+        return false;
+    }
+    
+    int read = unzReadCurrentFile(ar->zip, mem, e.size);
+    unzCloseCurrentFile(ar->zip);
+    
+    if (read != (int)e.size)
+    {
+        printf("%s: Failed to decompress %s\n", ar->path.c_str(), e.name.c_str());
+        free(mem);
+        return false;
+    }
+    
+    mem[e.size] = 0;
+    outData = mem;
+    outSize = e.size;
+    return true;
+}
+
+bool CFileSystem::ReadFile(const char* path, char*& outData, unsigned& outSize)const
+{
+    if (!path) return false;
+    
+    if (!IsVirtual(path))
+        return readDiskFile(path, outData, outSize);
+    
+    unsigned index;
+    const SArchive* ar = Find(path, index);
+    if (!ar) return false;
+    
+    if (ar->zip)
+        return ReadZipEntry(ar, index, outData, outSize);
+    
+    // loaders own (and sometimes modify) the buffer, so copy out of the mapping
+    const char* data;
+    unsigned size;
+    if (!MapFile(path, data, size))
+        return false;
+    
+    char* mem = (char*)malloc(size+1);
+    if (!mem) return false;
+    
+    memcpy(mem, data, size);
+    mem[size] = 0;
+    outData = mem;
+    outSize = size;
+    return true;
+}
+
+bool CFileSystem::ReadFileHeader(const char* path, char* outData, unsigned maxSize, unsigned& outSize)const
+{
+    if (!path) return false;
+    
+    if (!IsVirtual(path))
+    {
+        FILE* fp = fopen(path, "rb");
+        if (!fp) return false;
+        
+        outSize = (unsigned)fread(outData, 1, maxSize, fp);
+        fclose(fp);
+        return true;
+    }
+    
+    unsigned index;
+    const SArchive* ar = Find(path, index);
+    if (!ar) return false;
+    
+    if (ar->zip)
+    {
+        // only the first bytes get inflated
+        std::unique_lock<std::mutex> lock(_zipMutex);
+        
+        const SZipEntry& e = ar->zipEntries[index];
+        unz_file_pos pos;
+        pos.pos_in_zip_directory = e.posInDir;
+        pos.num_of_file = e.numOfFile;
+        
+        if (unzGoToFilePos(ar->zip, &pos) != UNZ_OK || unzOpenCurrentFile(ar->zip) != UNZ_OK)
+            return false;
+        
+        int read = unzReadCurrentFile(ar->zip, outData, Min(maxSize, e.size));
+        unzCloseCurrentFile(ar->zip);
+        if (read < 0) return false;
+        
+        outSize = (unsigned)read;
+        return true;
+    }
+    
+    const char* data;
+    unsigned size;
+    if (!MapFile(path, data, size))
+        return false;
+    
+    outSize = Min(maxSize, size);
+    memcpy(outData, data, outSize);
+    return true;
+}
+
+bool CFileSystem::Stat(const char* path, unsigned long long& outSize, unsigned long long& outMTime)const
+{
+    if (!IsVirtual(path))
+    {
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return false;
+        
+        outSize = (unsigned long long)st.st_size;
+        outMTime = (unsigned long long)st.st_mtime;
+        return true;
+    }
+    
+    unsigned index;
+    const SArchive* ar = Find(path, index);
+    if (!ar) return false;
+    
+    if (ar->zip)
+        outSize = ar->zipEntries[index].size;
+    else
+    {
+        const char* data = ar->pak.GetData();
+        outSize = ((const SPakEntry*)(data + ((const SPakHeader*)data)->dirOffset))[index].size;
+    }
+    outMTime = ar->mtime;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+/// PAK WRITER
+
+struct SPakSource
+{
+    std::string name;
+    std::string path;
+    
+    bool operator<(const SPakSource& other)const{ return name < other.name; };
+};
+
+static void collectFiles(const std::string& dir, std::vector<SPakSource>& outFiles)
+{
+#ifdef WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "/*").c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    
+    do
+    {
+        std::string name = fd.cFileName;
+        if (name == "." || name == "..") continue;
+        
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            collectFiles(dir + "/" + name, outFiles);
+        else
+        {
+            SPakSource src;
+            src.name = name;
+            src.path = dir + "/" + name;
+            outFiles.push_back(src);
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    
+    while (struct dirent* de = readdir(d))
+    {
+        std::string name = de->d_name;
+        if (name[0] == '.') continue; // also skips hidden files
+        
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) continue;
+        
+        if (S_ISDIR(st.st_mode))
+            collectFiles(path, outFiles);
+        else if (S_ISREG(st.st_mode))
+        {
+            SPakSource src;
+            src.name = name;
+            src.path = path;
+            outFiles.push_back(src);
+        }
+    }
+    closedir(d);
+#endif
+}
+
+/// Whether both paths lead to the same existing file (symbolic links and relative paths resolved)
+static bool isSameFile(const char* a, const char* b)
+{
+#ifdef WIN32
+    char fullA[MAX_PATH], fullB[MAX_PATH];
+    if (!GetFullPathNameA(a, MAX_PATH, fullA, NULL) || !GetFullPathNameA(b, MAX_PATH, fullB, NULL))
+        return false;
+    return _stricmp(fullA, fullB) == 0;
+#else
+    struct stat stA, stB;
+    if (stat(a, &stA) != 0 || stat(b, &stB) != 0)
+        return false;
+    return stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+#endif
+}
+
+static bool padFile(FILE* fp, unsigned& offset, unsigned align)
+{
+    static const char zeros[PAK_DATA_ALIGN] = {0};
+    unsigned pad = (align - offset % align) % align;
+    
+    offset += pad;
+    return !pad || fwrite(zeros, pad, 1, fp) == 1;
+}
+
+static bool entryHashLess(const CFileSystem::SPakEntry& a, const CFileSystem::SPakEntry& b)
+{
+    return a.hash < b.hash;
+}
+
+bool CFileSystem::WritePak(const char* outPath, const char* dir)
+{
+    std::vector<SPakSource> sources;
+    collectFiles(dir, sources);
+    
+    // a pak written into the packed directory would pack (and truncate) itself
+    for (size_t i=0; i<sources.size(); )
+    {
+        if (isSameFile(sources[i].path.c_str(), outPath))
+            sources.erase(sources.begin()+i);
+        else
+            i++;
+    }
+    
+    // files are addressed by base name; keep the first of duplicates (sorted to be deterministic)
+    std::stable_sort(sources.begin(), sources.end());
+    for (size_t i=1; i<sources.size(); )
+    {
+        if (sources[i].name == sources[i-1].name)
+        {
+            printf("WritePak: Skipping %s, %s has the same name\n", sources[i].path.c_str(), sources[i-1].path.c_str());
+            sources.erase(sources.begin()+i);
+        }
+        else
+            i++;
+    }
+    
+    if (sources.empty())
+    {
+        printf("WritePak: No files found in %s\n", dir);
+        return false;
+    }
+    
+    FILE* fp = fopen(outPath, "wb");
+    if (!fp)
+    {
+        printf("WritePak: Failed to create %s\n", outPath);
+        return false;
+    }
+    
+    SPakHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "GPK1", 4);
+    hdr.version = PAK_VERSION;
+    hdr.numEntries = (unsigned)sources.size();
+    
+    // header is rewritten at the end
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    unsigned offset = sizeof(hdr);
+    
+    std::vector<SPakEntry> entries;
+    std::string names;
+    
+    for (size_t i=0; ok && i<sources.size(); i++)
+    {
+        char* data;
+        unsigned size;
+        if (!readDiskFile(sources[i].path.c_str(), data, size))
+        {
+            printf("WritePak: Failed to read %s\n", sources[i].path.c_str());
+            ok = false;
+            break;
+        }
+        
+        ok = padFile(fp, offset, PAK_DATA_ALIGN) && (!size || fwrite(data, size, 1, fp) == 1);
+        free(data);
+        
+        SPakEntry e;
+        e.hash = HashName(sources[i].name.c_str());
+        e.nameOffset = (unsigned)names.size();
+        e.dataOffset = offset;
+        e.size = size;
+        e.reserved = 0;
+        entries.push_back(e);
+        
+        names.append(sources[i].name.c_str(), sources[i].name.size()+1);
+        offset += size;
+    }
+    
+    std::stable_sort(entries.begin(), entries.end(), entryHashLess);
+    
+    if (ok)
+    {
+        hdr.namesOffset = offset;
+        ok = fwrite(names.data(), names.size(), 1, fp) == 1;
+        offset += (unsigned)names.size();
+    }
+    if (ok)
+    {
+        ok = padFile(fp, offset, sizeof(unsigned long long));
+        hdr.dirOffset = offset;
+        ok = ok && fwrite(&entries[0], sizeof(SPakEntry)*entries.size(), 1, fp) == 1;
+    }
+    if (ok)
+    {
+        fseek(fp, 0, SEEK_SET);
+        ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    }
+    
+    fclose(fp);
+    
+    if (!ok)
+    {
+        printf("WritePak: Failed to write %s\n", outPath);
+        remove(outPath);
+        return false;
+    }
+    
+    printf("WritePak: %s written (%u files, %u bytes)\n", outPath, hdr.numEntries, offset);
+    return true;
+}
@@ -0,0 +1,121 @@
+//
+//  FileSystem.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__FileSystem__
+#define __glt__FileSystem__
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <string.h>
+
+#include "MappedFile.h"
+
+/// Prefix of paths which point into a mounted archive (as returned by LocateFile);
+/// ends with a slash so that basename() of a virtual path is the plain file name
+#define VFS_PREFIX "vfs:/"
+
+/// Virtual file system serving meshes, textures and shaders from mounted archives.
+/// Files are looked up by their base name in a hash-sorted directory, so locating a file
+/// costs a binary search instead of filesystem syscalls.
+/// Supported archives are .pak (GPK1, memory-mapped, files stored uncompressed) and .zip.
+/// Paths without VFS_PREFIX are read from disk.
+/// \note Mount archives before loading anything; reading is thread-safe, mounting is not.
+class CFileSystem
+{
+public:
+    /// GPK1 file header, followed by file data, names and the directory
+    struct SPakHeader
+    {
+        char magic[4]; // GPK1
+        unsigned version;
+        unsigned numEntries;
+        unsigned dirOffset; // SPakEntry[numEntries] sorted by hash
+        unsigned namesOffset; // zero-terminated base names
+        unsigned reserved;
+    };
+    struct SPakEntry
+    {
+        unsigned long long hash; // HashName() of the base name
+        unsigned nameOffset; // relative to namesOffset
+        unsigned dataOffset; // from the start of the file, 16-byte aligned
+        unsigned size;
+        unsigned reserved;
+    };
+    
+    static CFileSystem* Inst()
+    {
+        static CFileSystem* inst = 0;
+        if (!inst) inst = new CFileSystem();
+        return inst;
+    }
+    
+    ~CFileSystem();
+    
+    /// Mounts a .pak or .zip archive; archives mounted later take precedence
+    bool Mount(const char* archivePath);
+    /// Mounts data.pak and data.zip next to the executable (if they exist)
+    void MountDefaults();
+    
+    /// Builds a GPK1 archive from all files in dir (recursively, stored by base name)
+    static bool WritePak(const char* outPath, const char* dir);
+    
+    /// Whether a file with the same base name is in a mounted archive
+    bool Contains(const char* path)const;
+    static bool IsVirtual(const char* path){ return !strncmp(path, VFS_PREFIX, sizeof(VFS_PREFIX)-1); };
+    
+    /// Reads a whole file (from disk or a mounted archive) into a malloc'd buffer
+    /// \param outData Buffer to be freed by the caller with free()
+    bool ReadFile(const char* path, char*& outData, unsigned& outSize)const;
+    /// Reads at most maxSize bytes from the start of a file (to identify its format without reading it all)
+    /// \param outSize Number of bytes read, less than maxSize for shorter files
+    bool ReadFileHeader(const char* path, char* outData, unsigned maxSize, unsigned& outSize)const;
+    /// Pointer to the data of a file stored in a mounted .pak archive, valid until unmounted.
+    /// Returns false for disk files and zip entries (use ReadFile).
+    bool MapFile(const char* path, const char*& outData, unsigned& outSize)const;
+    /// Size and modification time of a file; archive entries report the time of their archive
+    bool Stat(const char* path, unsigned long long& outSize, unsigned long long& outMTime)const;
+    
+    static unsigned long long HashName(const char* name);
+
+private:
+    CFileSystem(){};
+    
+    struct SZipEntry
+    {
+        unsigned long long hash;
+        std::string name;
+        unsigned long posInDir;
+        unsigned long numOfFile;
+        unsigned size;
+        
+        bool operator<(const SZipEntry& other)const{ return hash < other.hash; };
+    };
+    struct SArchive
+    {
+        SArchive():zip(NULL), mtime(0){};
+        
+        std::string path;
+        CMappedFile pak;
+        void* zip; // unzFile
+        std::vector<SZipEntry> zipEntries; // sorted by hash
+        unsigned long long mtime;
+    };
+    
+    bool MountPak(SArchive* ar);
+    bool MountZip(SArchive* ar);
+    /// Finds the archive entry for a path; returns the archive or NULL
+    /// \param outIndex Index into the pak directory or zipEntries
+    const SArchive* Find(const char* path, unsigned& outIndex)const;
+    bool ReadZipEntry(const SArchive* ar, unsigned index, char*& outData, unsigned& outSize)const;
+    
+    std::vector<SArchive*> _archives;
+    mutable std::mutex _zipMutex; // unzip handles are stateful
+};
+
+#endif /* defined(__glt__FileSystem__) */
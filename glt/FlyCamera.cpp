@@ -30,7 +30,9 @@ _fieldOfView(50.0f),
 _nearPlane(0.01f),
 _farPlane(100.0f),
 _viewportAspectRatio(4.0f/3.0f)
-{}
+{
+    _previousMatrix = GetMatrix();
+}
 
 const glm::vec3& CFlyCamera::GetPosition() const
 {
@@ -144,6 +146,16 @@ glm::mat4 CFlyCamera::GetView() const
     return GetOrientation() * glm::translate(glm::mat4(), -_position);
 }
 
+const glm::mat4& CFlyCamera::GetPreviousMatrix() const
+{
+    return _previousMatrix;
+}
+
+void CFlyCamera::EndFrame()
+{
+    _previousMatrix = GetMatrix();
+}
+
 void CFlyCamera::NormalizeAngles()
 {
     _horizontalAngle = fmodf(_horizontalAngle, 360.0f);
@@ -133,6 +133,16 @@ public:
      */
     glm::mat4 GetView() const;
     
+    /**
+     The `matrix` of the previous frame, for reprojecting results of the previous frame.
+     */
+    const glm::mat4& GetPreviousMatrix() const;
+    
+    /**
+     Remembers the current `matrix` as the previous one; called once the frame is rendered.
+     */
+    void EndFrame();
+    
 private:
     glm::vec3 _position;
     float _horizontalAngle;
@@ -141,6 +151,7 @@ private:
     float _nearPlane;
     float _farPlane;
     float _viewportAspectRatio;
+    glm::mat4 _previousMatrix;
     
     void NormalizeAngles();
 };
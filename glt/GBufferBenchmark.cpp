@@ -0,0 +1,174 @@
+//
+//  GBufferBenchmark.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "GBufferBenchmark.h"
+#include "Scene.h"
+#include "Engine.h"
+#include "Shaders.h"
+#include "Mesh.h"
+#include "GLState.h"
+#include "Shared.h"
+
+#include "trigonometric.hpp"
+#include "glstuff.h"
+
+#include <math.h>
+#include <vector>
+
+bool CGBufferBenchmark::CreateTarget(STarget& target, ETextureFormat format, unsigned width, unsigned height)
+{
+    glGenTextures(1, &target.glTex);
+    CTexture::BindForEdit(GL_TEXTURE_2D, target.glTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    const SGLTextureFormatInfo& fi = CTexture::GLFormat(format);
+    glTexImage2D(GL_TEXTURE_2D, 0, fi.internalFormat, width, height, 0, fi.format, fi.type, 0);
+    PrintGLError("creating benchmark target");
+    
+    target.tex = new CTexture("benchmark target", target.glTex, width, height, true);
+    target.tex->SetSamplerState(SS_POINT_CLAMP);
+    
+    glGenFramebuffers(1, &target.fbo);
+    CGLState::BindFramebuffer(target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.glTex, 0);
+    
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        printf("G-buffer benchmark: format %d is not renderable\n", format);
+        return false;
+    }
+    return true;
+}
+
+void CGBufferBenchmark::ReleaseTarget(STarget& target)
+{
+    if (target.fbo)
+    {
+        CGLState::ForgetFramebuffer(target.fbo);
+        glDeleteFramebuffers(1, &target.fbo);
+    }
+    if (target.glTex)
+    {
+        CTexture::ForgetGLTexture(target.glTex);
+        glDeleteTextures(1, &target.glTex);
+    }
+    delete target.tex;
+    target = STarget();
+}
+
+float CGBufferBenchmark::TimePass(CShaderProgram* prog, unsigned iterations)
+{
+    prog->Use();
+    CMesh::FullscreenQuad().Draw(); // warm up (driver-side shader compilation, first touch of the target)
+    glFinish();
+    
+    if (CEngine::Inst()->GetRendererCapabilities().timerQuery)
+    {
+        GLuint query;
+        glGenQueries(1, &query);
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (unsigned i=0; i<iterations; i++)
+            CMesh::FullscreenQuad().Draw();
+        glEndQuery(GL_TIME_ELAPSED);
+        
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        glDeleteQueries(1, &query);
+        return ns / 1e6f / iterations;
+    }
+    
+    int start = glutGet(GLUT_ELAPSED_TIME);
+    for (unsigned i=0; i<iterations; i++)
+        CMesh::FullscreenQuad().Draw();
+    glFinish();
+    return (glutGet(GLUT_ELAPSED_TIME) - start) / (float)iterations;
+}
+
+bool CGBufferBenchmark::Run(unsigned width, unsigned height, unsigned iterations)
+{
+    if (!CTexture::IsSupported(TF_RGBA32F))
+    {
+        printf("G-buffer benchmark needs float textures\n");
+        return false;
+    }
+    
+    STarget result;
+    if (!CreateTarget(result, TF_RGBA32F, width, height))
+    {
+        ReleaseTarget(result);
+        return false;
+    }
+    
+    CGLState::Disable(GL_DEPTH_TEST);
+    CGLState::Disable(GL_BLEND);
+    CGLState::Disable(GL_CULL_FACE);
+    CGLState::SetViewport(0, 0, width, height);
+    
+    // camera of the lighting pass: 60 degree vertical fov
+    float tanHalfFov = tanf(glm::radians(30.0f));
+    glm::vec2 tanFovAspect(tanHalfFov * width / height, tanHalfFov);
+    
+    printf("G-buffer normal encoding benchmark: %ux%u, %u iterations, %s timing\n", width, height, iterations,
+           CEngine::Inst()->GetRendererCapabilities().timerQuery ? "GPU" : "CPU");
+    printf("  %-12s %-8s %10s %12s %14s %13s\n", "encoding", "format", "write ms", "lighting ms", "mean err deg", "max err deg");
+    
+    std::vector<float> pixels(width*height*4);
+    for (unsigned e=0; e<IScene::_NE_NUM; e++)
+    {
+        IScene::ENormalEncoding encoding = (IScene::ENormalEncoding)e;
+        ETextureFormat format = IScene::GetNormalFormat(encoding);
+        
+        STarget normals;
+        if (!CTexture::IsSupported(format) || !CreateTarget(normals, format, width, height))
+        {
+            printf("  %-12s not supported\n", IScene::GetNormalEncodingName(encoding));
+            ReleaseTarget(normals);
+            continue;
+        }
+        
+        CShaderDefines defines;
+        IScene::DefineNormalEncoding(defines, encoding);
+        CShaderProgram* encodeProg = CShaderManager::Inst()->GetProgram("gbuffer_benchmark.glsl", &CShaderDefines(defines).Define("ENCODE"));
+        CShaderProgram* lightingProg = CShaderManager::Inst()->GetProgram("gbuffer_benchmark.glsl", &defines);
+        
+        // write the normals
+        CGLState::BindFramebuffer(normals.fbo);
+        float writeMs = TimePass(encodeProg, iterations);
+        
+        // light from them
+        CGLState::BindFramebuffer(result.fbo);
+        lightingProg->Use();
+        lightingProg->SetUniform("uNormalTex", *normals.tex, 0);
+        lightingProg->SetUniform("uTanFovAspect", tanFovAspect);
+        float lightingMs = TimePass(lightingProg, iterations);
+        
+        // decoding error per pixel is in alpha
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+        double errorSum = 0;
+        float errorMax = 0;
+        for (unsigned p=0; p<width*height; p++)
+        {
+            errorSum += pixels[p*4+3];
+            errorMax = Max(errorMax, pixels[p*4+3]);
+        }
+        
+        printf("  %-12s %-8s %10.3f %12.3f %14.4f %13.4f\n", IScene::GetNormalEncodingName(encoding), format == TF_RGBA8 ? "RGBA8" : "RGB10A2",
+               writeMs, lightingMs, errorSum / (width*height), errorMax);
+        
+        ReleaseTarget(normals);
+    }
+    
+    CGLState::BindFramebuffer(0);
+    ReleaseTarget(result);
+    PrintGLError("running G-buffer benchmark");
+    
+    return true;
+}
@@ -0,0 +1,43 @@
+//
+//  GBufferBenchmark.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__GBufferBenchmark__
+#define __glt__GBufferBenchmark__
+
+#include "Texture.h"
+
+class CShaderProgram;
+
+/// Compares the G-buffer normal encodings (IScene::ENormalEncoding) on a synthetic full-screen G-buffer.
+/// For each encoding it prints the GPU time of writing the normals, of a lighting pass decoding them
+/// (gbuffer_benchmark.glsl) and the mean/max angular error of the decoded normals.
+/// Runs without a scene, e.g. glt -benchmark-gbuffer
+class CGBufferBenchmark
+{
+public:
+    /// \return false when it can't run (the error read-back needs float textures)
+    static bool Run(unsigned width, unsigned height, unsigned iterations);
+
+private:
+    struct STarget
+    {
+        STarget():glTex(0),fbo(0),tex(NULL){};
+        
+        unsigned glTex;
+        unsigned fbo;
+        CTexture* tex;
+    };
+    
+    static bool CreateTarget(STarget& target, ETextureFormat format, unsigned width, unsigned height);
+    static void ReleaseTarget(STarget& target);
+    /// Draws the full-screen quad iterations times with the program
+    /// \return Milliseconds per draw (GPU time with timer queries, otherwise CPU time around glFinish)
+    static float TimePass(CShaderProgram* prog, unsigned iterations);
+};
+
+#endif /* defined(__glt__GBufferBenchmark__) */
@@ -0,0 +1,275 @@
+//
+//  GLState.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "GLState.h"
+
+#include "glstuff.h"
+
+#define UNKNOWN_STATE 0xffffffff
+
+enum ETrackedCap
+{
+    CAP_BLEND=0,
+    CAP_DEPTH_TEST,
+    CAP_CULL_FACE,
+    CAP_STENCIL_TEST,
+    CAP_SCISSOR_TEST,
+    CAP_DEPTH_BOUNDS_TEST,
+    CAP_NUM
+};
+
+static const unsigned s_capEnums[CAP_NUM] = {GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_DEPTH_BOUNDS_TEST_EXT};
+
+/// Values as last set through CGLState; UNKNOWN_STATE forces the next setter to call GL
+struct STrackedState
+{
+    unsigned caps[CAP_NUM];
+    unsigned blendSrc, blendDst;
+    unsigned depthFunc;
+    unsigned depthMask;
+    unsigned cullFace;
+    unsigned colorMask; // bit per channel
+    unsigned stencilFunc, stencilRef, stencilValueMask;
+    unsigned stencilOp[2][3]; // front, back
+    unsigned stencilWriteMask;
+    unsigned framebuffer;
+    unsigned viewport[4];
+    unsigned program;
+};
+
+static STrackedState s_state;
+static bool s_stateValid = false; // false = GL state unknown, start from scratch
+static CGLState::SStats s_frameStats;
+static CGLState::SStats s_lastFrameStats;
+
+static void validateState()
+{
+    if (s_stateValid) return;
+    
+    unsigned* values = (unsigned*)&s_state;
+    for (unsigned i=0; i<sizeof(s_state)/sizeof(unsigned); i++)
+        values[i] = UNKNOWN_STATE;
+    s_stateValid = true;
+}
+
+/// Stores the value and returns true if it differs from the tracked one (the GL call is needed)
+static bool changed(unsigned& tracked, unsigned value)
+{
+    validateState();
+    
+    if (tracked == value)
+    {
+        s_frameStats.redundantCalls++;
+        return false;
+    }
+    
+    tracked = value;
+    s_frameStats.calls++;
+    return true;
+}
+
+static unsigned* trackedCap(unsigned cap)
+{
+    for (unsigned i=0; i<CAP_NUM; i++)
+        if (s_capEnums[i] == cap)
+            return &s_state.caps[i];
+    return NULL;
+}
+
+void CGLState::SetEnabled(unsigned cap, bool enable)
+{
+    validateState();
+    
+    unsigned* tracked = trackedCap(cap);
+    if (tracked && !changed(*tracked, enable))
+        return;
+    if (!tracked)
+        s_frameStats.calls++;
+    
+    if (enable)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+void CGLState::Enable(unsigned cap)
+{
+    SetEnabled(cap, true);
+}
+
+void CGLState::Disable(unsigned cap)
+{
+    SetEnabled(cap, false);
+}
+
+void CGLState::SetBlendFunc(unsigned src, unsigned dst)
+{
+    validateState();
+    
+    // both values have to be compared before either is stored
+    if (s_state.blendSrc == src && s_state.blendDst == dst)
+    {
+        s_frameStats.redundantCalls++;
+        return;
+    }
+    
+    s_state.blendSrc = src;
+    s_state.blendDst = dst;
+    s_frameStats.calls++;
+    glBlendFunc(src, dst);
+}
+
+void CGLState::SetDepthFunc(unsigned func)
+{
+    if (changed(s_state.depthFunc, func))
+        glDepthFunc(func);
+}
+
+void CGLState::SetDepthMask(bool enable)
+{
+    if (changed(s_state.depthMask, enable))
+        glDepthMask(enable?GL_TRUE:GL_FALSE);
+}
+
+void CGLState::SetCullFace(unsigned face)
+{
+    if (changed(s_state.cullFace, face))
+        glCullFace(face);
+}
+
+void CGLState::SetColorMask(bool red, bool green, bool blue, bool alpha)
+{
+    unsigned mask = (red?1:0) | (green?2:0) | (blue?4:0) | (alpha?8:0);
+    if (changed(s_state.colorMask, mask))
+        glColorMask(red?GL_TRUE:GL_FALSE, green?GL_TRUE:GL_FALSE, blue?GL_TRUE:GL_FALSE, alpha?GL_TRUE:GL_FALSE);
+}
+
+void CGLState::SetStencilFunc(unsigned func, int ref, unsigned mask)
+{
+    validateState();
+    
+    if (s_state.stencilFunc == func && s_state.stencilRef == (unsigned)ref && s_state.stencilValueMask == mask)
+    {
+        s_frameStats.redundantCalls++;
+        return;
+    }
+    
+    s_state.stencilFunc = func;
+    s_state.stencilRef = (unsigned)ref;
+    s_state.stencilValueMask = mask;
+    s_frameStats.calls++;
+    glStencilFunc(func, ref, mask);
+}
+
+void CGLState::SetStencilOp(unsigned sfail, unsigned dpfail, unsigned dppass)
+{
+    SetStencilOpSeparate(GL_FRONT_AND_BACK, sfail, dpfail, dppass);
+}
+
+void CGLState::SetStencilOpSeparate(unsigned face, unsigned sfail, unsigned dpfail, unsigned dppass)
+{
+    validateState();
+    
+    bool front = face == GL_FRONT || face == GL_FRONT_AND_BACK;
+    bool back = face == GL_BACK || face == GL_FRONT_AND_BACK;
+    bool same = true;
+    for (unsigned f=0; f<2; f++)
+    {
+        if (!(f ? back : front)) continue;
+        
+        const unsigned* ops = s_state.stencilOp[f];
+        same = same && ops[0] == sfail && ops[1] == dpfail && ops[2] == dppass;
+    }
+    if (same)
+    {
+        s_frameStats.redundantCalls++;
+        return;
+    }
+    
+    for (unsigned f=0; f<2; f++)
+    {
+        if (!(f ? back : front)) continue;
+        
+        s_state.stencilOp[f][0] = sfail;
+        s_state.stencilOp[f][1] = dpfail;
+        s_state.stencilOp[f][2] = dppass;
+    }
+    s_frameStats.calls++;
+    
+    if (face == GL_FRONT_AND_BACK)
+        glStencilOp(sfail, dpfail, dppass);
+    else
+        glStencilOpSeparate(face, sfail, dpfail, dppass);
+}
+
+void CGLState::SetStencilMask(unsigned mask)
+{
+    if (changed(s_state.stencilWriteMask, mask))
+        glStencilMask(mask);
+}
+
+void CGLState::BindFramebuffer(unsigned fbo)
+{
+    if (changed(s_state.framebuffer, fbo))
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void CGLState::SetViewport(int x, int y, int width, int height)
+{
+    validateState();
+    
+    unsigned* vp = s_state.viewport;
+    if (vp[0] == (unsigned)x && vp[1] == (unsigned)y && vp[2] == (unsigned)width && vp[3] == (unsigned)height)
+    {
+        s_frameStats.redundantCalls++;
+        return;
+    }
+    
+    vp[0] = (unsigned)x; vp[1] = (unsigned)y; vp[2] = (unsigned)width; vp[3] = (unsigned)height;
+    s_frameStats.calls++;
+    glViewport(x, y, width, height);
+}
+
+void CGLState::UseProgram(unsigned program)
+{
+    if (changed(s_state.program, program))
+        glUseProgram(program);
+}
+
+bool CGLState::IsProgramUsed(unsigned program)
+{
+    return s_stateValid && s_state.program == program;
+}
+
+void CGLState::ForgetFramebuffer(unsigned fbo)
+{
+    // GL binds 0 when the bound framebuffer is deleted
+    if (s_stateValid && s_state.framebuffer == fbo)
+        s_state.framebuffer = 0;
+}
+
+void CGLState::ForgetProgram(unsigned program)
+{
+    // a deleted program stays in use until another one is used - its name can't be recycled until then,
+    // but the next UseProgram of the recycled name must not be skipped
+    if (s_stateValid && s_state.program == program)
+        s_state.program = UNKNOWN_STATE;
+}
+
+void CGLState::EndFrame()
+{
+    s_stateValid = false;
+    
+    s_lastFrameStats = s_frameStats;
+    s_frameStats = SStats();
+}
+
+const CGLState::SStats& CGLState::GetStats()
+{
+    return s_lastFrameStats;
+}
@@ -0,0 +1,64 @@
+//
+//  GLState.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__GLState__
+#define __glt__GLState__
+
+/// Shadow copy of the fixed-function state, framebuffer, viewport and program binding.
+/// Setters skip GL calls which wouldn't change anything, so passes can set what they need without
+/// knowing what the previous pass left behind. All glt code has to change the tracked state through
+/// here (or Forget it); code outside glt (GLV) changes it behind our back, so EndFrame forgets everything.
+/// \note Textures and samplers are tracked by CTexture
+class CGLState
+{
+public:
+    /// State change statistics
+    struct SStats
+    {
+        SStats():calls(0),redundantCalls(0){};
+        
+        unsigned calls; // GL calls made by the setters
+        unsigned redundantCalls; // setter calls skipped because the state was already set
+    };
+    
+    // - capabilities (GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_STENCIL_TEST, GL_SCISSOR_TEST and GL_DEPTH_BOUNDS_TEST_EXT are tracked)
+    static void Enable(unsigned cap);
+    static void Disable(unsigned cap);
+    static void SetEnabled(unsigned cap, bool enable);
+    
+    // - fixed-function state
+    static void SetBlendFunc(unsigned src, unsigned dst);
+    static void SetDepthFunc(unsigned func);
+    static void SetDepthMask(bool enable);
+    static void SetCullFace(unsigned face);
+    static void SetColorMask(bool red, bool green, bool blue, bool alpha);
+    static void SetStencilFunc(unsigned func, int ref, unsigned mask);
+    /// Sets the operations of both faces
+    static void SetStencilOp(unsigned sfail, unsigned dpfail, unsigned dppass);
+    /// \param face GL_FRONT, GL_BACK or GL_FRONT_AND_BACK
+    static void SetStencilOpSeparate(unsigned face, unsigned sfail, unsigned dpfail, unsigned dppass);
+    static void SetStencilMask(unsigned mask);
+    
+    // - bindings
+    /// Binds the framebuffer as both draw and read framebuffer (0 = screen)
+    static void BindFramebuffer(unsigned fbo);
+    static void SetViewport(int x, int y, int width, int height);
+    static void UseProgram(unsigned program);
+    /// Tracked program, so that callers needing it bound don't issue (or count) a redundant UseProgram
+    static bool IsProgramUsed(unsigned program);
+    /// Must be called when a framebuffer or program is deleted, so that its recycled name isn't considered bound
+    static void ForgetFramebuffer(unsigned fbo);
+    static void ForgetProgram(unsigned program);
+    
+    /// Forgets all tracked state and closes the frame statistics; call after external code drew
+    static void EndFrame();
+    /// Statistics of the last finished frame
+    static const SStats& GetStats();
+};
+
+#endif /* defined(__glt__GLState__) */
@@ -0,0 +1,103 @@
+//
+//  GPUMemory.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "GPUMemory.h"
+#include "CVar.h"
+#include "Shared.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+static CVar cvGPUMemBudget("r_gpuMemBudget", 1024); // MB; least recently used textures and meshes are evicted above it
+
+void IGPUResource::MarkUsed()const
+{
+    _lastUsedFrame = CGPUMemory::Inst()->GetFrame();
+}
+
+CGPUMemory::CGPUMemory()
+:_frame(1)
+{
+    for (unsigned i=0; i<GPUMEM_NUM; i++)
+        _used[i] = 0;
+}
+
+void CGPUMemory::Allocated(EGPUMemoryType type, size_t bytes)
+{
+    _used[type] += bytes;
+}
+
+void CGPUMemory::Freed(EGPUMemoryType type, size_t bytes)
+{
+    _used[type] -= Min(bytes, _used[type]);
+}
+
+size_t CGPUMemory::GetTotalUsed()const
+{
+    size_t total = 0;
+    for (unsigned i=0; i<GPUMEM_NUM; i++)
+        total += _used[i];
+    return total;
+}
+
+size_t CGPUMemory::GetBudget()const
+{
+    return (size_t)Max(1, cvGPUMemBudget.GetInt()) * 1024 * 1024;
+}
+
+void CGPUMemory::Register(IGPUResource* res)
+{
+    if (std::find(_resources.begin(), _resources.end(), res) == _resources.end())
+        _resources.push_back(res);
+}
+
+void CGPUMemory::Unregister(IGPUResource* res)
+{
+    ResourceArray::iterator it = std::find(_resources.begin(), _resources.end(), res);
+    if (it != _resources.end()) _resources.erase(it);
+}
+
+static bool lruComparator(const IGPUResource* a, const IGPUResource* b)
+{
+    return a->GetLastUsedFrame() < b->GetLastUsedFrame();
+}
+
+void CGPUMemory::Update()
+{
+    size_t total = GetTotalUsed();
+    size_t budget = GetBudget();
+    
+    if (total > budget)
+    {
+        // never evict what was drawn in this or the previous frame, it would just be restored again
+        ResourceArray candidates;
+        STD_FOREACH(ResourceArray, _resources, it)
+        {
+            if ((*it)->GetLastUsedFrame()+1 < _frame && (*it)->GetEvictableBytes())
+                candidates.push_back(*it);
+        }
+        std::sort(candidates.begin(), candidates.end(), lruComparator);
+        
+        unsigned numEvicted = 0;
+        size_t evictedBytes = 0;
+        for (unsigned i=0; i<candidates.size() && total > budget; i++)
+        {
+            size_t freed = candidates[i]->Evict();
+            if (!freed) continue;
+            
+            total -= Min(freed, total);
+            evictedBytes += freed;
+            numEvicted++;
+        }
+        
+        if (numEvicted)
+            printf("GPU memory over budget (%u/%u MB): evicted %u resources (%u MB)\n", (unsigned)((total+evictedBytes)>>20), (unsigned)(budget>>20), numEvicted, (unsigned)(evictedBytes>>20));
+    }
+    
+    _frame++;
+}
@@ -0,0 +1,81 @@
+//
+//  GPUMemory.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__GPUMemory__
+#define __glt__GPUMemory__
+
+#include <vector>
+#include <stddef.h>
+
+enum EGPUMemoryType
+{
+    GPUMEM_TEXTURE=0,
+    GPUMEM_MESH,
+    GPUMEM_RENDERTARGET,
+    GPUMEM_NUM
+};
+
+/// GPU resource which can release its memory when not used and transparently restore it when needed again
+class IGPUResource
+{
+public:
+    IGPUResource():_lastUsedFrame(0){};
+    virtual ~IGPUResource(){};
+    
+    /// Bytes Evict() would free
+    virtual size_t GetEvictableBytes()const = 0;
+    /// Releases (or demotes to a smaller version) the GPU data
+    /// \return Number of bytes freed
+    virtual size_t Evict() = 0;
+    virtual const char* GetName()const = 0;
+    
+    /// Called when the resource is drawn with
+    void MarkUsed()const;
+    unsigned GetLastUsedFrame()const{ return _lastUsedFrame; };
+    
+private:
+    mutable unsigned _lastUsedFrame;
+};
+
+/// Accounting of GPU memory allocated by glt and LRU eviction of resources over the budget (r_gpuMemBudget)
+class CGPUMemory
+{
+    typedef std::vector<IGPUResource*> ResourceArray;
+    
+public:
+    static CGPUMemory* Inst()
+    {
+        static CGPUMemory* inst = 0;
+        if (!inst) inst = new CGPUMemory();
+        return inst;
+    }
+    
+    CGPUMemory();
+    
+    // - accounting (sizes are computed from formats and dimensions, the driver may need more)
+    void Allocated(EGPUMemoryType type, size_t bytes);
+    void Freed(EGPUMemoryType type, size_t bytes);
+    /// Bytes currently allocated for the type
+    size_t GetUsed(EGPUMemoryType type)const{ return _used[type]; };
+    size_t GetTotalUsed()const;
+    size_t GetBudget()const;
+    
+    // - eviction
+    void Register(IGPUResource* res);
+    void Unregister(IGPUResource* res);
+    unsigned GetFrame()const{ return _frame; };
+    /// Evicts least recently used resources while over the budget and starts a new frame (once per frame)
+    void Update();
+    
+private:
+    size_t _used[GPUMEM_NUM]; // can exceed 4 GB in large scenes
+    ResourceArray _resources;
+    unsigned _frame;
+};
+
+#endif /* defined(__glt__GPUMemory__) */
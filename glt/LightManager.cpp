@@ -0,0 +1,170 @@
+//
+//  LightManager.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "LightManager.h"
+#include "CVar.h"
+#include "Shared.h"
+
+#include "func_matrix.hpp"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define GLT_SSE2 1
+# include <emmintrin.h>
+#endif
+
+static CVar cvLightCulling("r_lightCulling", true, CVar::FLAG_GUI_TWEAKABLE); // frustum and screen-size culling of scene lights
+static CVar cvMinScreenSize("r_lightMinScreenSize", 2, CVar::FLAG_GUI_TWEAKABLE, 0, 32); // projected light radius in pixels below which lights are dropped
+
+CLightManager::CLightManager()
+:_numLights(0), _numVisible(0), _numFrustumCulled(0), _numSmallCulled(0)
+{
+}
+
+unsigned CLightManager::Add(const glm::vec3& posW, const glm::vec3& color, float range)
+{
+    unsigned idx = _numLights++;
+    
+    unsigned padded = (_numLights + 3) & ~3u;
+    if (_posX.size() < padded)
+    {
+        _posX.resize(padded, 0.0f); _posY.resize(padded, 0.0f); _posZ.resize(padded, 0.0f);
+        _range.resize(padded, 0.0f);
+        _colorR.resize(padded, 0.0f); _colorG.resize(padded, 0.0f); _colorB.resize(padded, 0.0f);
+    }
+    
+    _posX[idx] = posW.x; _posY[idx] = posW.y; _posZ[idx] = posW.z;
+    _range[idx] = range;
+    _colorR[idx] = color.r; _colorG[idx] = color.g; _colorB[idx] = color.b;
+    return idx;
+}
+
+void CLightManager::Clear()
+{
+    _posX.clear(); _posY.clear(); _posZ.clear();
+    _range.clear();
+    _colorR.clear(); _colorG.clear(); _colorB.clear();
+    _numLights = 0;
+}
+
+void CLightManager::Cull(const glm::mat4& view, const glm::mat4& proj, unsigned viewportHeight, std::vector<SPointLight>& outLights)
+{
+    _numVisible = _numFrustumCulled = _numSmallCulled = 0;
+    
+    if (!cvLightCulling)
+    {
+        for (unsigned i=0; i<_numLights; i++)
+        {
+            SPointLight light;
+            light.posW = glm::vec3(_posX[i], _posY[i], _posZ[i]);
+            light.color = glm::vec3(_colorR[i], _colorG[i], _colorB[i]);
+            light.range = _range[i];
+            outLights.push_back(light);
+        }
+        _numVisible = _numLights;
+        return;
+    }
+    
+    // world-space frustum planes (xyz pointing inside, normalized so that dot+w is the signed distance)
+    glm::mat4 viewProj = proj * view;
+    glm::vec4 planes[6];
+    for (unsigned p=0; p<6; p++)
+    {
+        unsigned row = p/2;
+        float sign = (p & 1) ? -1.0f : 1.0f;
+        glm::vec4 plane;
+        for (unsigned c=0; c<4; c++)
+            plane[c] = viewProj[c][3] + sign*viewProj[c][row];
+        planes[p] = plane / glm::length(glm::vec3(plane));
+    }
+    
+    // projected radius in pixels = range * pixelScale / distance; the fade goes from 1 at twice
+    // the minimum size to 0 at the minimum size
+    glm::vec3 camPos = glm::vec3(glm::inverse(view)[3]);
+    float pixelScale = proj[1][1] * 0.5f * viewportHeight;
+    float minPixels = cvMinScreenSize.GetFloat();
+    float fadeScale = minPixels > 0 ? 1.0f/minPixels : 0.0f;
+    float fadeBias = minPixels > 0 ? -1.0f : 1.0f;
+    
+    for (unsigned i=0; i<_numLights; i+=4)
+    {
+        unsigned inFrustum, bigEnough; // bit per light of the batch
+        float fade[4];
+
+#ifdef GLT_SSE2
+        __m128 x = _mm_loadu_ps(&_posX[i]);
+        __m128 y = _mm_loadu_ps(&_posY[i]);
+        __m128 z = _mm_loadu_ps(&_posZ[i]);
+        __m128 r = _mm_loadu_ps(&_range[i]);
+        
+        // sphere in front of all planes
+        __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 inside = _mm_cmpeq_ps(r, r); // all ones
+        for (unsigned p=0; p<6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+                                  _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, negR));
+        }
+        inFrustum = (unsigned)_mm_movemask_ps(inside);
+        
+        // screen size and fade
+        __m128 dx = _mm_sub_ps(x, _mm_set1_ps(camPos.x));
+        __m128 dy = _mm_sub_ps(y, _mm_set1_ps(camPos.y));
+        __m128 dz = _mm_sub_ps(z, _mm_set1_ps(camPos.z));
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        dist = _mm_max_ps(dist, _mm_set1_ps(1e-3f));
+        __m128 pixels = _mm_div_ps(_mm_mul_ps(r, _mm_set1_ps(pixelScale)), dist);
+        __m128 f = _mm_add_ps(_mm_mul_ps(pixels, _mm_set1_ps(fadeScale)), _mm_set1_ps(fadeBias));
+        f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        bigEnough = (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(f, _mm_setzero_ps()));
+        _mm_storeu_ps(fade, f);
+#else
+        inFrustum = bigEnough = 0;
+        for (unsigned l=0; l<4; l++)
+        {
+            unsigned li = i+l;
+            glm::vec3 pos(_posX[li], _posY[li], _posZ[li]);
+            float r = _range[li];
+            
+            bool inside = true;
+            for (unsigned p=0; p<6; p++)
+                inside = inside && glm::dot(glm::vec3(planes[p]), pos) + planes[p].w > -r;
+            if (inside) inFrustum |= 1u<<l;
+            
+            float pixels = r * pixelScale / Max(glm::length(pos - camPos), 1e-3f);
+            fade[l] = MinMax(pixels*fadeScale + fadeBias, 0.0f, 1.0f);
+            if (fade[l] > 0) bigEnough |= 1u<<l;
+        }
+#endif
+
+        unsigned numInBatch = Min(4u, _numLights-i);
+        for (unsigned l=0; l<numInBatch; l++)
+        {
+            if (!(inFrustum & (1u<<l)))
+            {
+                _numFrustumCulled++;
+                continue;
+            }
+            if (!(bigEnough & (1u<<l)))
+            {
+                _numSmallCulled++;
+                continue;
+            }
+            
+            unsigned li = i+l;
+            SPointLight light;
+            light.posW = glm::vec3(_posX[li], _posY[li], _posZ[li]);
+            light.color = glm::vec3(_colorR[li], _colorG[li], _colorB[li]) * fade[l];
+            light.range = _range[li];
+            outLights.push_back(light);
+            _numVisible++;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+//
+//  LightManager.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__LightManager__
+#define __glt__LightManager__
+
+#include <vector>
+
+#include "LightTiler.h"
+#include "vec3.hpp"
+#include "mat4x4.hpp"
+
+/// Point lights of a scene in structure-of-arrays form, culled on the CPU every frame before they are drawn.
+/// Cull tests four lights at a time (SSE2 when available) against the view frustum and drops lights whose
+/// projected radius is below r_lightMinScreenSize pixels. Lights fade out as they shrink towards the limit
+/// (from twice its size), so that they don't pop when the camera moves away.
+class CLightManager
+{
+public:
+    CLightManager();
+    
+    /// \return Index of the light
+    unsigned Add(const glm::vec3& posW, const glm::vec3& color, float range);
+    void Clear();
+    unsigned GetNumLights()const{ return _numLights; };
+    
+    /// Appends the visible lights (colors scaled by the fade) to outLights
+    /// \param viewportHeight Render height in pixels, for the projected light size
+    void Cull(const glm::mat4& view, const glm::mat4& proj, unsigned viewportHeight, std::vector<SPointLight>& outLights);
+    
+    /// Statistics of the last Cull
+    unsigned GetNumVisible()const{ return _numVisible; };
+    unsigned GetNumFrustumCulled()const{ return _numFrustumCulled; };
+    unsigned GetNumSmallCulled()const{ return _numSmallCulled; };
+
+private:
+    // padded with zeros to a multiple of 4 so that batches can always load 4 lights
+    std::vector<float> _posX, _posY, _posZ;
+    std::vector<float> _range;
+    std::vector<float> _colorR, _colorG, _colorB;
+    unsigned _numLights;
+    
+    unsigned _numVisible;
+    unsigned _numFrustumCulled;
+    unsigned _numSmallCulled;
+};
+
+#endif /* defined(__glt__LightManager__) */
@@ -0,0 +1,233 @@
+//
+//  LightTiler.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "LightTiler.h"
+#include "Shaders.h"
+#include "GPUMemory.h"
+#include "ThreadPool.h"
+#include "Shared.h"
+
+#include "glstuff.h"
+
+#include <math.h>
+
+// row widths of the data textures; powers of two so that the shader can compute rows exactly
+#define INDEX_TEX_WIDTH 1024 // texels, 4 light indices each
+#define LIGHT_TEX_WIDTH 256 // texels, 2 per light
+
+CLightTiler::CLightTiler(unsigned tileSize, unsigned numSlices)
+:_tileSize(tileSize), _numSlices(Max(1u, numSlices)), _tilesX(0), _tilesY(0), _sliceScale(0), _sliceBias(0), _numEntries(0)
+{
+}
+
+CLightTiler::~CLightTiler()
+{
+    Release(_tileTex);
+    Release(_indexTex);
+    Release(_lightTex);
+}
+
+void CLightTiler::Release(SDataTexture& dt)
+{
+    if (!dt.glTex) return;
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_TEXTURE, dt.width*dt.height*16);
+    CTexture::ForgetGLTexture(dt.glTex);
+    glDeleteTextures(1, &dt.glTex);
+    delete dt.tex;
+    dt = SDataTexture();
+}
+
+void CLightTiler::Upload(SDataTexture& dt, unsigned width, unsigned numTexels, std::vector<float>& data, const char* name)
+{
+    unsigned rows = Max(1u, (numTexels + width - 1) / width);
+    data.resize(width*rows*4, 0.0f); // whole rows
+    
+    if (dt.width != width || dt.height < rows)
+    {
+        // grow in steps to avoid reallocating every frame when the light count rises slowly
+        unsigned height = dt.width == width ? Max(rows, dt.height*2) : rows;
+        Release(dt);
+        
+        glGenTextures(1, &dt.glTex);
+        CTexture::BindForEdit(GL_TEXTURE_2D, dt.glTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        
+        const SGLTextureFormatInfo& fi = CTexture::GLFormat(TF_RGBA32F);
+        glTexImage2D(GL_TEXTURE_2D, 0, fi.internalFormat, width, height, 0, fi.format, fi.type, 0);
+        PrintGLError("creating light tiler texture");
+        
+        dt.width = width;
+        dt.height = height;
+        dt.tex = new CTexture(name, dt.glTex, width, height, true);
+        dt.tex->SetSamplerState(SS_POINT_CLAMP);
+        CGPUMemory::Inst()->Allocated(GPUMEM_TEXTURE, width*height*16);
+    }
+    
+    CTexture::BindForEdit(GL_TEXTURE_2D, dt.glTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, rows, GL_RGBA, GL_FLOAT, &data[0]);
+}
+
+bool CLightTiler::ProjectSphere(const glm::vec3& centerV, float radius, const glm::mat4& proj, float nearPlane, glm::vec4& outRectNDC)
+{
+    const glm::vec3& c = centerV;
+    float r = radius;
+    if (c.z + r >= -nearPlane) return false;
+    
+    // the extremes of x/w and y/w over the bounding box are in its corners
+    float minX=1e10f, maxX=-1e10f, minY=1e10f, maxY=-1e10f;
+    for (int zi=0; zi<2; zi++)
+    {
+        float z = c.z + (zi ? r : -r);
+        for (int si=0; si<2; si++)
+        {
+            float d = si ? r : -r;
+            float ndcX = (proj[0][0]*(c.x+d) + proj[2][0]*z) / -z;
+            float ndcY = (proj[1][1]*(c.y+d) + proj[2][1]*z) / -z;
+            minX = Min(minX, ndcX); maxX = Max(maxX, ndcX);
+            minY = Min(minY, ndcY); maxY = Max(maxY, ndcY);
+        }
+    }
+    
+    outRectNDC = glm::vec4(minX, minY, maxX, maxY);
+    return true;
+}
+
+unsigned CLightTiler::Slice(float depth)const
+{
+    return (unsigned)MinMax(logf(Max(depth, 1e-4f))*_sliceScale + _sliceBias, 0.0f, _numSlices-1.0f);
+}
+
+void CLightTiler::CountRowJob(unsigned row, void* userData)
+{
+    CLightTiler* self = (CLightTiler*)userData;
+    unsigned z = row / self->_tilesY, y = row % self->_tilesY;
+    unsigned* counts = &self->_cellCounts[row*self->_tilesX];
+    
+    for (unsigned l=0; l<self->_bounds.size(); l++)
+    {
+        const SLightBounds& b = self->_bounds[l];
+        if (z < b.z0 || z > b.z1 || y < b.y0 || y > b.y1) continue;
+        
+        for (unsigned x=b.x0; x<=b.x1; x++)
+            counts[x]++;
+    }
+}
+
+void CLightTiler::FillRowJob(unsigned row, void* userData)
+{
+    CLightTiler* self = (CLightTiler*)userData;
+    unsigned z = row / self->_tilesY, y = row % self->_tilesY;
+    unsigned* counts = &self->_cellCounts[row*self->_tilesX]; // fill cursors
+    const float* cells = &self->_tiles[row*self->_tilesX*4];
+    
+    for (unsigned l=0; l<self->_bounds.size(); l++)
+    {
+        const SLightBounds& b = self->_bounds[l];
+        if (z < b.z0 || z > b.z1 || y < b.y0 || y > b.y1) continue;
+        
+        for (unsigned x=b.x0; x<=b.x1; x++)
+        {
+            if (counts[x] >= cells[x*4+1]) continue; // over MAX_TILE_LIGHTS
+            
+            self->_indices[(unsigned)cells[x*4+0] + counts[x]++] = (float)l;
+        }
+    }
+}
+
+void CLightTiler::Update(const SPointLight* lights, unsigned numLights, const glm::mat4& view, const glm::mat4& proj,
+                         float nearPlane, float farPlane, unsigned width, unsigned height)
+{
+    _tilesX = (width + _tileSize - 1) / _tileSize;
+    _tilesY = (height + _tileSize - 1) / _tileSize;
+    unsigned numRows = _tilesY*_numSlices;
+    
+    // exponential slices: slice = log(depth/near) / log(far/near) * numSlices
+    _sliceScale = _numSlices > 1 ? _numSlices / logf(farPlane/nearPlane) : 0.0f;
+    _sliceBias = -logf(nearPlane) * _sliceScale;
+    
+    _lights.clear();
+    _bounds.clear();
+    
+    // project the bounding box of every light sphere to a cell range
+    for (unsigned l=0; l<numLights; l++)
+    {
+        const SPointLight& light = lights[l];
+        glm::vec3 c = glm::vec3(view * glm::vec4(light.posW, 1));
+        float r = light.range;
+        
+        if (c.z - r > -nearPlane || c.z + r < -farPlane)
+            continue; // behind the camera or beyond the far plane
+        
+        SLightBounds b;
+        b.x0 = b.y0 = 0; b.x1 = _tilesX-1; b.y1 = _tilesY-1; // camera inside or near plane crossing -> all tiles
+        b.z0 = Slice(-c.z - r);
+        b.z1 = Slice(-c.z + r);
+        
+        glm::vec4 rect;
+        if (ProjectSphere(c, r, proj, nearPlane, rect))
+        {
+            if (rect.z < -1 || rect.x > 1 || rect.w < -1 || rect.y > 1)
+                continue; // outside of the screen
+            
+            float tileScaleX = 0.5f * width / _tileSize;
+            float tileScaleY = 0.5f * height / _tileSize;
+            b.x0 = (unsigned)MinMax((rect.x+1)*tileScaleX, 0.0f, _tilesX-1.0f);
+            b.x1 = (unsigned)MinMax((rect.z+1)*tileScaleX, 0.0f, _tilesX-1.0f);
+            b.y0 = (unsigned)MinMax((rect.y+1)*tileScaleY, 0.0f, _tilesY-1.0f);
+            b.y1 = (unsigned)MinMax((rect.w+1)*tileScaleY, 0.0f, _tilesY-1.0f);
+        }
+        
+        _bounds.push_back(b);
+        
+        // view-space position + inverse range, color
+        _lights.push_back(c.x); _lights.push_back(c.y); _lights.push_back(c.z); _lights.push_back(1.0f/r);
+        _lights.push_back(light.color.r); _lights.push_back(light.color.g); _lights.push_back(light.color.b); _lights.push_back(0);
+    }
+    
+    // light counts of all cells, rows in parallel
+    _cellCounts.assign(_tilesX*numRows, 0);
+    CThreadPool::Inst()->ParallelFor(numRows, CountRowJob, this);
+    
+    // cell headers (first entry, count)
+    _tiles.assign(_tilesX*numRows*4, 0.0f);
+    _numEntries = 0;
+    for (unsigned t=0; t<_tilesX*numRows; t++)
+    {
+        unsigned count = Min(_cellCounts[t], (unsigned)MAX_TILE_LIGHTS);
+        _tiles[t*4+0] = (float)_numEntries;
+        _tiles[t*4+1] = (float)count;
+        _cellCounts[t] = 0; // reused as fill cursors
+        _numEntries += count;
+    }
+    
+    // light indices of each cell; lights over MAX_TILE_LIGHTS are dropped
+    _indices.assign(((_numEntries+3)/4)*4, 0.0f);
+    CThreadPool::Inst()->ParallelFor(numRows, FillRowJob, this);
+    
+    Upload(_tileTex, _tilesX, _tilesX*numRows, _tiles, "light grid");
+    Upload(_indexTex, INDEX_TEX_WIDTH, (unsigned)_indices.size()/4, _indices, "light indices");
+    Upload(_lightTex, LIGHT_TEX_WIDTH, (unsigned)_bounds.size()*2, _lights, "lights");
+}
+
+void CLightTiler::SetUniforms(CShaderProgram* prog, unsigned firstUnit)const
+{
+    if (!_tileTex.tex) return;
+    
+    prog->SetUniform("uTileTex", *_tileTex.tex, firstUnit);
+    prog->SetUniform("uTileTexSize", glm::vec2(_tileTex.width, _tileTex.height));
+    prog->SetUniform("uLightIndexTex", *_indexTex.tex, firstUnit+1);
+    prog->SetUniform("uLightIndexTexSize", glm::vec2(_indexTex.width, _indexTex.height));
+    prog->SetUniform("uLightTex", *_lightTex.tex, firstUnit+2);
+    prog->SetUniform("uLightTexSize", glm::vec2(_lightTex.width, _lightTex.height));
+    prog->SetUniform("uLightGrid", glm::vec4(_tileSize, _tilesY, _numSlices, 0));
+    prog->SetUniform("uLightGridSlices", glm::vec2(_sliceScale, _sliceBias));
+}
@@ -0,0 +1,105 @@
+//
+//  LightTiler.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__LightTiler__
+#define __glt__LightTiler__
+
+#include <vector>
+
+#include "Texture.h"
+#include "vec3.hpp"
+#include "mat4x4.hpp"
+
+/// Screen tile size in pixels of the tiled deferred lighting pass
+#define LIGHT_TILE_SIZE 16
+/// Maximum number of lights shading one tile/cluster (MAX_TILE_LIGHTS in light_grid.incl); further lights are dropped
+#define MAX_TILE_LIGHTS 128
+
+class CShaderProgram;
+
+/// Point light as submitted to IScene
+struct SPointLight
+{
+    glm::vec3 posW; // world-space position
+    glm::vec3 color;
+    float range;
+};
+
+/// Bins point lights into a grid of screen tiles, optionally split into depth slices (clusters/froxels),
+/// on the CPU and uploads the per-cell light lists as float textures for light_grid.incl:
+/// - uTileTex: one texel per cell (row = slice*tilesY + tileY), r = first entry in uLightIndexTex, g = number of lights
+/// - uLightIndexTex: light indices of all cells one after another (row-major)
+/// - uLightTex: two texels per light, view-space position + inverse range and color
+/// Grid rows are binned in parallel on CThreadPool.
+/// \note Requires SRendererCaps.floatTextures
+class CLightTiler
+{
+public:
+    /// \param tileSize Cell size on the screen in pixels
+    /// \param numSlices Depth slices, exponentially distributed between the near and far plane (1 = screen tiles only)
+    CLightTiler(unsigned tileSize = LIGHT_TILE_SIZE, unsigned numSlices = 1);
+    ~CLightTiler();
+    
+    /// Bins the lights into cells covering the render size and uploads the lists
+    /// \param view, proj Camera matrices used to project the light spheres
+    void Update(const SPointLight* lights, unsigned numLights, const glm::mat4& view, const glm::mat4& proj,
+                float nearPlane, float farPlane, unsigned width, unsigned height);
+    /// Binds the textures to three units starting at firstUnit and sets the grid uniforms
+    void SetUniforms(CShaderProgram* prog, unsigned firstUnit)const;
+    
+    /// Lights which touched at least one cell in the last Update
+    unsigned GetNumVisibleLights()const{ return (unsigned)_bounds.size(); };
+    /// Sum of light counts over all cells in the last Update
+    unsigned GetNumTileEntries()const{ return _numEntries; };
+    
+    /// Normalized device coordinates rectangle (minX, minY, maxX, maxY) containing the projected sphere
+    /// \return false if the sphere crosses the near plane (covers an unknown part of the screen, possibly all of it)
+    static bool ProjectSphere(const glm::vec3& centerV, float radius, const glm::mat4& proj, float nearPlane, glm::vec4& outRectNDC);
+
+private:
+    struct SDataTexture
+    {
+        SDataTexture():glTex(0),width(0),height(0),tex(NULL){};
+        
+        unsigned glTex;
+        unsigned width, height;
+        CTexture* tex;
+    };
+    /// Cells covered by a visible light (inclusive)
+    struct SLightBounds
+    {
+        unsigned x0, y0, z0;
+        unsigned x1, y1, z1;
+    };
+    
+    /// Makes the texture hold at least numTexels RGBA32F texels (rows of the given width) and uploads data
+    static void Upload(SDataTexture& dt, unsigned width, unsigned numTexels, std::vector<float>& data, const char* name);
+    static void Release(SDataTexture& dt);
+    /// CThreadPool jobs processing one grid row (slice*tilesY + tileY)
+    static void CountRowJob(unsigned row, void* userData);
+    static void FillRowJob(unsigned row, void* userData);
+    /// Depth slice containing the view-space distance
+    unsigned Slice(float depth)const;
+    
+    unsigned _tileSize;
+    unsigned _numSlices;
+    unsigned _tilesX, _tilesY;
+    float _sliceScale, _sliceBias; // slice = log(depth)*scale + bias
+    
+    SDataTexture _tileTex, _indexTex, _lightTex;
+    
+    // CPU side of the textures, kept to avoid allocations every frame
+    std::vector<float> _tiles;
+    std::vector<float> _indices;
+    std::vector<float> _lights;
+    std::vector<SLightBounds> _bounds; // of each visible light, in the order of _lights
+    std::vector<unsigned> _cellCounts;
+    unsigned _numEntries;
+};
+
+#endif /* defined(__glt__LightTiler__) */
@@ -0,0 +1,98 @@
+//
+//  MappedFile.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "MappedFile.h"
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile()
+:_data(0), _size(0)
+#ifdef WIN32
+,_file(INVALID_HANDLE_VALUE), _mapping(NULL)
+#endif
+{
+}
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(const char* path)
+{
+    Close();
+    
+#ifdef WIN32
+    _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_file == INVALID_HANDLE_VALUE) return false;
+    
+    DWORD size = GetFileSize(_file, NULL);
+    if (size == INVALID_FILE_SIZE || size == 0)
+    {
+        Close();
+        return false;
+    }
+    
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!_mapping)
+    {
+        Close();
+        return false;
+    }
+    
+    _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data)
+    {
+        Close();
+        return false;
+    }
+    _size = size;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    
+    void* mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file referenced
+    if (mem == MAP_FAILED) return false;
+    
+    _data = (const char*)mem;
+    _size = (unsigned)st.st_size;
+#endif
+    
+    return true;
+}
+
+void CMappedFile::Close()
+{
+#ifdef WIN32
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _mapping = NULL;
+    _file = INVALID_HANDLE_VALUE;
+#else
+    if (_data) munmap((void*)_data, _size);
+#endif
+    
+    _data = 0;
+    _size = 0;
+}
@@ -0,0 +1,38 @@
+//
+//  MappedFile.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__MappedFile__
+#define __glt__MappedFile__
+
+/// Read-only memory-mapped file; pages are loaded by the OS on first access
+class CMappedFile
+{
+public:
+    CMappedFile();
+    ~CMappedFile();
+    
+    bool Open(const char* path);
+    void Close();
+    
+    bool IsOpen()const{ return _data != 0; };
+    const char* GetData()const{ return _data; };
+    unsigned GetSize()const{ return _size; };
+    
+private:
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+    
+    const char* _data;
+    unsigned _size;
+#ifdef WIN32
+    void* _file;
+    void* _mapping;
+#endif
+};
+
+#endif /* defined(__glt__MappedFile__) */
@@ -15,9 +15,16 @@
 #include "Texture.h"
 #include "Shaders.h"
 #include "Engine.h"
+#include "CVar.h"
+#include "ThreadPool.h"
+#include "TextureStreamer.h"
+#include "GPUMemory.h"
 
 #include "glstuff.h"
-#include "../assimp/include/assimp/cimport.h"
+#include "FileSystem.h"
+#include "../assimp/include/assimp/Importer.hpp"
+#include "../assimp/include/assimp/IOSystem.hpp"
+#include "../assimp/include/assimp/IOStream.hpp"
 #include "../assimp/include/assimp/scene.h"
 #include "../assimp/include/assimp/postprocess.h"
 #include "func_matrix.hpp"
@@ -32,6 +39,93 @@
 # define glBindVertexArray glBindVertexArrayAPPLE
 #endif
 
+static CVar cvLoaderThreads("r_loaderThreads", 0); // threads decoding textures, 0 = all cores
+static CVar cvTextureArrays("r_textureArrays", true); // batch same-sized material textures into GL_TEXTURE_2D_ARRAYs
+
+/// Serves files to assimp importers from CFileSystem (mounted archives or disk)
+class CVFSIOStream : public Assimp::IOStream
+{
+public:
+    CVFSIOStream(const char* data, unsigned size, char* ownedData)
+    :_data(data), _ownedData(ownedData), _size(size), _pos(0){};
+    ~CVFSIOStream(){ free(_ownedData); };
+    
+    size_t Read(void* pvBuffer, size_t pSize, size_t pCount)
+    {
+        if (!pSize) return 0;
+        
+        size_t count = Min(pCount, (_size - _pos)/pSize);
+        memcpy(pvBuffer, _data + _pos, count*pSize);
+        _pos += count*pSize;
+        return count;
+    };
+    size_t Write(const void* pvBuffer, size_t pSize, size_t pCount){ return 0; };
+    aiReturn Seek(size_t pOffset, aiOrigin pOrigin)
+    {
+        size_t pos = pOffset;
+        if (pOrigin == aiOrigin_CUR)
+            pos += _pos;
+        else if (pOrigin == aiOrigin_END)
+            pos += _size;
+        
+        if (pos > _size) return aiReturn_FAILURE;
+        _pos = pos;
+        return aiReturn_SUCCESS;
+    };
+    size_t Tell()const{ return _pos; };
+    size_t FileSize()const{ return _size; };
+    void Flush(){};
+    
+private:
+    const char* _data;
+    char* _ownedData;
+    size_t _size;
+    size_t _pos;
+};
+
+class CVFSIOSystem : public Assimp::IOSystem
+{
+public:
+    bool Exists(const char* pFile)const
+    {
+        unsigned long long size, mtime;
+        return CFileSystem::Inst()->Stat(Resolve(pFile), size, mtime);
+    };
+    char getOsSeparator()const{ return '/'; };
+    
+    Assimp::IOStream* Open(const char* pFile, const char* pMode)
+    {
+        if (strchr(pMode, 'w') || strchr(pMode, 'a'))
+            return NULL; // read-only
+        
+        const char* path = Resolve(pFile);
+        
+        // pak files are used in place
+        const char* data;
+        unsigned size;
+        if (CFileSystem::Inst()->MapFile(path, data, size))
+            return new CVFSIOStream(data, size, NULL);
+        
+        char* owned;
+        if (!CFileSystem::Inst()->ReadFile(path, owned, size))
+            return NULL;
+        return new CVFSIOStream(owned, size, owned);
+    };
+    void Close(Assimp::IOStream* pFile){ delete pFile; };
+    
+private:
+    /// Files referenced by a model (.mtl...) are searched for in archives and next to the executable
+    static const char* Resolve(const char* pFile)
+    {
+        unsigned long long size, mtime;
+        if (CFileSystem::IsVirtual(pFile) || CFileSystem::Inst()->Stat(pFile, size, mtime))
+            return pFile;
+        
+        const char* located = LocateFile(pFile);
+        return located ? located : pFile;
+    };
+};
+
 // must be defined for each EPrimitiveType
 static GLenum s_primTypes[] = {
     0,//PRIM_NONE=0,
@@ -150,13 +244,16 @@ CMeshStreamData::~CMeshStreamData()
 //// MESH CLASS
 
 CMesh::CMesh(const char* name)
-: _scene(NULL), _attrs(NULL), _name(name), _scale(glm::vec3(1,1,1))
+: _scene(NULL), _attrs(NULL), _name(name), _scale(glm::vec3(1,1,1)), _gpuBytes(0), _evicted(false)
 {
     
 }
 
 CMesh::~CMesh()
 {
+    CGPUMemory::Inst()->Unregister(this);
+    CGPUMemory::Inst()->Freed(GPUMEM_MESH, _gpuBytes);
+    
     STD_CONST_FOREACH(GLBufferArray, _glbuff, it)
     {
         glDeleteBuffers(1, &it->vertBuffer);
@@ -167,6 +264,8 @@ CMesh::~CMesh()
         if (it->normalProg) it->normalProg->Release();
         if (it->zProg) it->zProg->Release();
         if (it->materialProg) it->materialProg->Release();
+        if (it->gbufferProg) it->gbufferProg->Release();
+        if (it->forwardProg) it->forwardProg->Release();
     }
 }
 
@@ -337,18 +436,23 @@ bool CMesh::LoadFromFile(const char* path, bool generateNormals, bool calcTangen
     if (generateNormals) optionalFlags |= aiProcess_GenNormals;
     if (calcTangentSpace) optionalFlags |= aiProcess_CalcTangentSpace;
     
-    _scene = aiImportFile(path, aiProcess_PreTransformVertices | aiProcess_Triangulate | aiProcess_SortByPType | optionalFlags );
-    if (!_scene)
+    // read through the VFS so that models and their materials can come from archives
+    Assimp::Importer importer;
+    importer.SetIOHandler(new CVFSIOSystem()); // owned by the importer
+    
+    if (!importer.ReadFile(path, aiProcess_PreTransformVertices | aiProcess_Triangulate | aiProcess_SortByPType | optionalFlags ))
     {
-        printf("Failed to load mesh file %s - unknown file type?\n", path);
+        printf("Failed to load mesh file %s: %s\n", path, importer.GetErrorString());
         return false;
     }
+    _scene = importer.GetOrphanedScene();
     
     bool success = _scene != 0;
     if (success)
     {
         // create GL objects
         CreateGLMeshesFromAssimp();
+        CGPUMemory::Inst()->Register(this);
         
         // print stats
         unsigned verts = 0, inds = 0;
@@ -360,14 +464,98 @@ bool CMesh::LoadFromFile(const char* path, bool generateNormals, bool calcTangen
     return success;
 }
 
+void CMesh::AccountGPUMemory(unsigned bytes)
+{
+    _gpuBytes += bytes;
+    CGPUMemory::Inst()->Allocated(GPUMEM_MESH, bytes);
+}
+
+size_t CMesh::GetEvictableBytes()const
+{
+    // only meshes which can be recreated from the imported scene
+    return (_scene && !_evicted) ? _gpuBytes : 0;
+}
+
+size_t CMesh::Evict()
+{
+    size_t freed = GetEvictableBytes();
+    if (!freed) return 0;
+    
+    STD_FOREACH(GLBufferArray, _glbuff, it)
+    {
+        glDeleteBuffers(1, &it->vertBuffer);
+        glDeleteBuffers(1, &it->indBuffer);
+        glDeleteVertexArrays(1, &it->vertArrayObj);
+        it->vertBuffer = it->indBuffer = it->vertArrayObj = 0;
+    }
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_MESH, _gpuBytes);
+    _gpuBytes = 0;
+    _evicted = true;
+    
+    return freed;
+}
+
+void CMesh::RestoreGLBuffers()
+{
+    for (unsigned m=0; m<_glbuff.size(); m++)
+        CreateGLBuffers(_scene->mMeshes[m], _glbuff[m]);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    _evicted = false;
+}
+
 void CMesh::Draw(EDrawPass pass)const
 {
+    MarkUsed();
+    if (_evicted) const_cast<CMesh*>(this)->RestoreGLBuffers();
+    
     if (_scene)
         DrawNode(pass, _scene->mRootNode);
     else
         DrawBufferArray(pass);
 }
 
+void CMesh::DrawInstanced(unsigned numInstances, unsigned instanceBuffer, unsigned byteOffset)const
+{
+    if (!numInstances) return;
+    
+    MarkUsed();
+    if (_evicted) const_cast<CMesh*>(this)->RestoreGLBuffers();
+    
+    const unsigned inst0 = Attrib2Index(ATTRIB_INSTANCE0);
+    const unsigned inst1 = Attrib2Index(ATTRIB_INSTANCE1);
+    const unsigned stride = 2*4*sizeof(float);
+    
+    STD_CONST_FOREACH(GLBufferArray, _glbuff, ib)
+    {
+        glBindVertexArrayAPPLE(ib->vertArrayObj);
+        PrintGLError("binding VAO");
+        
+        // instance attributes advance once per instance
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glEnableVertexAttribArray(inst0);
+        glVertexAttribPointer(inst0, 4, GL_FLOAT, 0, stride, (void*)(long)byteOffset);
+        glVertexAttribDivisorARB(inst0, 1);
+        glEnableVertexAttribArray(inst1);
+        glVertexAttribPointer(inst1, 4, GL_FLOAT, 0, stride, (void*)(long)(byteOffset + 4*sizeof(float)));
+        glVertexAttribDivisorARB(inst1, 1);
+        
+        if (ib->indBuffer)
+            glDrawElementsInstancedARB((GLenum)ib->primType, ib->numInds, ib->indBufferType, 0, numInstances);
+        else
+            glDrawArraysInstancedARB((GLenum)ib->primType, 0, ib->numInds, numInstances);
+        PrintGLError("drawing instances");
+        
+        // the VAO is used by Draw as well
+        glVertexAttribDivisorARB(inst0, 0);
+        glDisableVertexAttribArray(inst0);
+        glVertexAttribDivisorARB(inst1, 0);
+        glDisableVertexAttribArray(inst1);
+    }
+}
+
 std::string CMesh::LocateTexture(const char* path) const
 {
     if (!path || !*path)
@@ -410,252 +598,485 @@ std::string CMesh::LocateTexture(const char* path) const
         finalPath = LocateFile(tmpPath);
     }
     
+    // only a pre-compressed version exists
+    if (!finalPath)
+    {
+        strcpy(tmpPath, path);
+        if (pathLen>4 && tmpPath[pathLen-4] == '.')
+            strcpy(&tmpPath[pathLen-4], ".dds");
+        
+        finalPath = LocateFile(tmpPath);
+    }
+    if (!finalPath)
+    {
+        strcpy(tmpPath, path);
+        if (pathLen>4 && tmpPath[pathLen-4] == '.')
+            strcpy(&tmpPath[pathLen-4], ".ktx");
+        
+        finalPath = LocateFile(tmpPath);
+    }
+    
     if (!finalPath)
         return std::string();
     else
         return std::string(finalPath);
 }
 
-void CMesh::CreateGLMeshesFromAssimp()
+bool CMesh::LocateMaterialTextures(const struct aiMaterial* mat, std::string& outDiffuse, std::string& outNormal, bool& outInverseNormalY)const
 {
-    assert(_scene);
+    outDiffuse.clear();
+    outNormal.clear();
+    outInverseNormalY = false;
     
-    glGetError();
+    if (mat->GetTextureCount(aiTextureType_DIFFUSE)<1)
+        return false;
     
-    for (int m=0; m<_scene->mNumMeshes; m++)
+    // get path to diffuse texture
+    aiString path;
+    mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
+    
+    char tmpPath[1024];
+    
+    // diffuse
+    outDiffuse = LocateTexture(path.C_Str());
+    
+    // normal texture
+    if (mat->GetTextureCount(aiTextureType_NORMALS)>0)
     {
-        const struct aiMesh* mesh = _scene->mMeshes[m];
-        const struct aiMaterial* mat = _scene->mMaterials[mesh->mMaterialIndex];
-        
-        GLBuffer glbuff;
+        aiString normalPath;
+        mat->GetTexture(aiTextureType_NORMALS, 0, &normalPath);
+        outNormal = LocateTexture(normalPath.C_Str());
+    }
+    
+    // try to find normal based on diffusemap path
+    if (!outNormal.length())
+    {
+        strcpy(tmpPath, path.C_Str());
+        if (path.length>4 && tmpPath[path.length-4] == '.')
+        {
+            tmpPath[path.length-4] = 0;
+            strcat(tmpPath, "_ns.png");
+        }
+        outNormal = LocateTexture(tmpPath);
+    }
+    if (!outNormal.length())
+    {
+        strcpy(tmpPath, path.C_Str());
+        if (path.length>4 && tmpPath[path.length-4] == '.')
+        {
+            tmpPath[path.length-4] = 0;
+            strcat(tmpPath, "_ddn.tga");
+        }
+        outNormal = LocateTexture(tmpPath);
+        if (outNormal.length()) outInverseNormalY = true;
+    }
+    if (!outNormal.length())
+    {
+        strcpy(tmpPath, path.C_Str());
+        if (path.length>8 && tmpPath[path.length-4] == '.')
+        {
+            tmpPath[path.length-8] = 0;
+            strcat(tmpPath, "ddn.tga");
+        }
+        outNormal = LocateTexture(tmpPath);
+        if (outNormal.length()) outInverseNormalY = true;
+    }
+    
+    return true;
+}
+
+struct STextureDecodeJob
+{
+    STextureDecodeJob():texture(NULL), decoded(false){};
+    
+    std::string path;
+    CTexture* texture;
+    STextureImage image;
+    bool decoded;
+};
+
+static void decodeTextureJob(unsigned index, void* userData)
+{
+    STextureDecodeJob& job = ((STextureDecodeJob*)userData)[index];
+    job.decoded = job.texture->DecodeFile(job.path.c_str(), job.image);
+}
+
+void CMesh::LoadMaterialTextures(TextureMap& outTextures)const
+{
+    // unique texture paths of all materials
+    std::vector<std::string> paths;
+    for (unsigned m=0; m<_scene->mNumMaterials; m++)
+    {
+        std::string diffusePath, normalPath;
+        bool inverseNormalY;
+        LocateMaterialTextures(_scene->mMaterials[m], diffusePath, normalPath, inverseNormalY);
         
-        // material
-        if (mat->GetTextureCount(aiTextureType_DIFFUSE)>0)
+        if (diffusePath.length() && outTextures.find(diffusePath) == outTextures.end())
         {
-            bool inverseNormalY = false;
-            
-            // get path to diffuse texture
-            aiString path;
-            mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-            
-            char tmpPath[1024];
-            
-            // load diffuse
-            glbuff.diffuseTex = CTexture::FromFile(LocateTexture(path.C_Str()).c_str());
-            
-            // load normal texture
-            std::string normalPath;
-            if (mat->GetTextureCount(aiTextureType_NORMALS)>0)
-            {
-                mat->GetTexture(aiTextureType_NORMALS, 0, &path);
-                normalPath = LocateTexture(normalPath.c_str());
-            }
+            outTextures[diffusePath] = STextureRef();
+            paths.push_back(diffusePath);
+        }
+        if (normalPath.length() && outTextures.find(normalPath) == outTextures.end())
+        {
+            outTextures[normalPath] = STextureRef();
+            paths.push_back(normalPath);
+        }
+    }
+    
+    if (paths.empty()) return;
+    
+    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    
+    // read, decode and compress on all threads
+    unsigned numJobs = (unsigned)paths.size();
+    STextureDecodeJob* jobs = new STextureDecodeJob[numJobs];
+    for (unsigned i=0; i<numJobs; i++)
+    {
+        jobs[i].path = paths[i];
+        jobs[i].texture = new CTexture();
+    }
+    
+    unsigned maxThreads = cvLoaderThreads.GetInt() > 0 ? cvLoaderThreads.GetInt() : 0;
+    CThreadPool::Inst()->ParallelFor(numJobs, decodeTextureJob, jobs, maxThreads);
+    
+    int decodedTime = glutGet(GLUT_ELAPSED_TIME);
+    
+    // upload on the GL thread; first the groups of same-sized textures as arrays
+    unsigned numArrays = 0;
+    if (cvTextureArrays && CEngine::Inst()->GetRendererCapabilities().textureArray)
+    {
+        typedef std::map<unsigned long long, std::vector<unsigned> > GroupMap;
+        GroupMap groups;
+        for (unsigned i=0; i<numJobs; i++)
+        {
+            const STextureImage& img = jobs[i].image;
+            if (!jobs[i].decoded || img.width > 0xFFFF || img.height > 0xFFFF)
+                continue;
             
-            // try to find normal based on diffusemap path
-            if (!normalPath.length())
+            unsigned long long key = ((unsigned long long)img.format << 40) | ((unsigned long long)img.numMips << 32) | (img.width << 16) | img.height;
+            groups[key].push_back(i);
+        }
+        
+        unsigned maxLayers = (unsigned)CEngine::Inst()->GetRendererCapabilities().maxArrayTextureLayers;
+        STD_FOREACH(GroupMap, groups, g)
+        {
+            std::vector<unsigned>& members = g->second;
+            for (unsigned first=0; first+1<members.size(); first+=maxLayers)
             {
-                strcpy(tmpPath, path.C_Str());
-                if (path.length>4 && tmpPath[path.length-4] == '.')
+                unsigned numLayers = Min((unsigned)members.size()-first, maxLayers);
+                if (numLayers < 2) break;
+                
+                std::vector<const STextureImage*> layers;
+                std::vector<std::string> layerPaths;
+                for (unsigned l=0; l<numLayers; l++)
                 {
-                    tmpPath[path.length-4] = 0;
-                    strcat(tmpPath, "_ns.png");
+                    layers.push_back(&jobs[members[first+l]].image);
+                    layerPaths.push_back(jobs[members[first+l]].path);
                 }
-                normalPath = LocateTexture(tmpPath);
-            }
-            if (!normalPath.length())
-            {
-                strcpy(tmpPath, path.C_Str());
-                if (path.length>4 && tmpPath[path.length-4] == '.')
+                
+                CTexture* array = new CTexture();
+                if (!array->UploadArray(&layers[0], numLayers, &layerPaths[0]))
                 {
-                    tmpPath[path.length-4] = 0;
-                    strcat(tmpPath, "_ddn.tga");
+                    delete array;
+                    continue;
                 }
-                normalPath = LocateTexture(tmpPath);
-                if (normalPath.length()) inverseNormalY = true;
-            }
-            if (!normalPath.length())
-            {
-                strcpy(tmpPath, path.C_Str());
-                if (path.length>8 && tmpPath[path.length-4] == '.')
+                numArrays++;
+                
+                for (unsigned l=0; l<numLayers; l++)
                 {
-                    tmpPath[path.length-8] = 0;
-                    strcat(tmpPath, "ddn.tga");
+                    STextureDecodeJob& job = jobs[members[first+l]];
+                    outTextures[job.path].texture = array;
+                    outTextures[job.path].layer = l;
+                    
+                    delete job.texture;
+                    job.texture = NULL;
                 }
-                normalPath = LocateTexture(tmpPath);
-                if (normalPath.length()) inverseNormalY = true;
-            }
-            if (normalPath.length())
-                glbuff.normalSpecularTex = CTexture::FromFile(normalPath.c_str());
-            
-            CShaderDefines defines;
-            if (glbuff.diffuseTex)
-            {
-                defines.Define("TEXTURE0,ATTRIB_COORDS0");
-                if (glbuff.normalSpecularTex)
-                    defines.Define("NORMAL_SPECULAR_MAP");
             }
-            
-            // load shaders
-            CShaderDefines normalDefines(defines);
-            if (inverseNormalY) normalDefines.Define("NORMAL_SPECULAR_MAP_INVERSEY");
-            glbuff.normalProg = CShaderManager::Inst()->GetProgram("normal.glsl", &normalDefines);
-            glbuff.zProg = CShaderManager::Inst()->GetProgram("z.glsl", &defines);
-            glbuff.materialProg = CShaderManager::Inst()->GetProgram("material.glsl", &defines);
         }
+    }
+    
+    // the rest as individual textures
+    for (unsigned i=0; i<numJobs; i++)
+    {
+        if (!jobs[i].texture) continue; // in an array
         
-        // VAO
-        glGenVertexArrays(1, &glbuff.vertArrayObj);
-        PrintGLError("generating VAO");
-        glBindVertexArray(glbuff.vertArrayObj);
-        PrintGLError("binding VAO");
-        
-        
-        // VERTEX BUFFER
-        glGenBuffers(1, &glbuff.vertBuffer);
-        PrintGLError("generating vertex buffer");
-        glBindBuffer(GL_ARRAY_BUFFER, glbuff.vertBuffer);
-        PrintGLError("binding vertex buffer");
+        bool uploaded = false;
+        if (jobs[i].decoded)
+        {
+            if (CTextureStreamer::IsEnabled())
+                uploaded = jobs[i].texture->UploadStreamed(jobs[i].image);
+            else
+                uploaded = jobs[i].texture->Upload(jobs[i].image);
+        }
         
-        _attrs = ATTRIB_POSITION;
+        if (uploaded)
+            outTextures[jobs[i].path].texture = jobs[i].texture;
+        else
+            delete jobs[i].texture;
+    }
+    delete[] jobs;
+    
+    int endTime = glutGet(GLUT_ELAPSED_TIME);
+    printf("%s: %u textures decoded in %d ms on %u threads, uploaded in %d ms (%u array textures)\n", GetName(), numJobs, decodedTime-startTime,
+           maxThreads ? Min(maxThreads, CThreadPool::Inst()->GetNumThreads()) : CThreadPool::Inst()->GetNumThreads(), endTime-decodedTime, numArrays);
+}
+
+void CMesh::CreateGLBuffers(const struct aiMesh* mesh, GLBuffer& glbuff)
+{
+    // VAO
+    glGenVertexArrays(1, &glbuff.vertArrayObj);
+    PrintGLError("generating VAO");
+    glBindVertexArray(glbuff.vertArrayObj);
+    PrintGLError("binding VAO");
+    
+    
+    // VERTEX BUFFER
+    glGenBuffers(1, &glbuff.vertBuffer);
+    PrintGLError("generating vertex buffer");
+    glBindBuffer(GL_ARRAY_BUFFER, glbuff.vertBuffer);
+    PrintGLError("binding vertex buffer");
+    
+    _attrs = ATTRIB_POSITION;
+    
+    if (mesh->mVertices)
+        _attrs |= ATTRIB_POSITION;
+    if (mesh->mColors[0])
+        _attrs |= ATTRIB_COLOR0;
+    if (mesh->mTextureCoords[0])
+        _attrs |= ATTRIB_COORDS0;
+    if (mesh->mNormals)
+        _attrs |= ATTRIB_NORMAL;
+    if (mesh->mTangents)
+        _attrs |= ATTRIB_TANGENT;
+    if (mesh->mBitangents)
+        _attrs |= ATTRIB_BITANGENT;
+    
+    unsigned vertlen = ComputeVertDataLen(_attrs);
+    unsigned vbuflen = mesh->mNumVertices * vertlen;
+    char* vbufdata = (char*)malloc(vbuflen);
+    EVertexAttrib atr = ATTRIB_NONE;
+    
+    for (unsigned v=0; v<mesh->mNumVertices; v++)
+    {
+        char* const vertStart = vbufdata + v*vertlen;
         
+        atr = ATTRIB_POSITION;
         if (mesh->mVertices)
-            _attrs |= ATTRIB_POSITION;
+        {
+            if (v==0)
+            {
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)NULL);
+                PrintGLError("setting vertex attribute pointer");
+            }
+            memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mVertices[v].x, 3*sizeof(float));
+        }
+        
+        atr = ATTRIB_COLOR0;
         if (mesh->mColors[0])
-            _attrs |= ATTRIB_COLOR0;
-        if (mesh->mTextureCoords[0])
-            _attrs |= ATTRIB_COORDS0;
-        if (mesh->mNormals)
-            _attrs |= ATTRIB_NORMAL;
-        if (mesh->mTangents)
-            _attrs |= ATTRIB_TANGENT;
-        if (mesh->mBitangents)
-            _attrs |= ATTRIB_BITANGENT;
+        {
+            if (v==0)
+            {
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 4, GL_UNSIGNED_BYTE, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
+                PrintGLError("setting vertex attribute pointer");
+            }
+            unsigned char* col = (unsigned char*)(vertStart + ComputeAttribOffset(atr, _attrs));
+            col[0] = mesh->mColors[0][v].r*255.f; col[1] = mesh->mColors[1][v].g*255; col[0] = mesh->mColors[2][v].b*255; col[0] = mesh->mColors[3][v].a*255;
+        }
         
-        unsigned vertlen = ComputeVertDataLen(_attrs);
-        unsigned vbuflen = mesh->mNumVertices * vertlen;
-        char* vbufdata = (char*)malloc(vbuflen);
-        EVertexAttrib atr = ATTRIB_NONE;
+        atr = ATTRIB_COORDS0;
+        if (mesh->mTextureCoords[0])
+        {
+            if (v==0)
+            {
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 2, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
+                PrintGLError("setting vertex attribute pointer");
+            }
+            memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mTextureCoords[0][v].x, 2*sizeof(float));
+        }
         
-        for (unsigned v=0; v<mesh->mNumVertices; v++)
+        atr = ATTRIB_NORMAL;
+        if (mesh->mNormals)
         {
-            char* const vertStart = vbufdata + v*vertlen;
-            
-            atr = ATTRIB_POSITION;
-            if (mesh->mVertices)
+            if (v==0)
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)NULL);
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mVertices[v].x, 3*sizeof(float));
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
+                PrintGLError("setting vertex attribute pointer");
             }
-            
-            atr = ATTRIB_COLOR0;
-            if (mesh->mColors[0])
+            memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mNormals[v].x, 3*sizeof(float));
+        }
+        
+        atr = ATTRIB_TANGENT;
+        if (mesh->mTangents)
+        {
+            if (v==0)
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 4, GL_UNSIGNED_BYTE, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                unsigned char* col = (unsigned char*)(vertStart + ComputeAttribOffset(atr, _attrs));
-                col[0] = mesh->mColors[0][v].r*255.f; col[1] = mesh->mColors[1][v].g*255; col[0] = mesh->mColors[2][v].b*255; col[0] = mesh->mColors[3][v].a*255;
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
+                PrintGLError("setting vertex attribute pointer");
             }
-            
-            atr = ATTRIB_COORDS0;
-            if (mesh->mTextureCoords[0])
+            memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mTangents[v].x, 3*sizeof(float));
+        }
+        
+        atr = ATTRIB_BITANGENT;
+        if (mesh->mBitangents)
+        {
+            if (v==0)
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 2, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mTextureCoords[0][v].x, 2*sizeof(float));
+                glEnableVertexAttribArray(Attrib2Index(atr));
+                glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
+                PrintGLError("setting vertex attribute pointer");
             }
-            
-            atr = ATTRIB_NORMAL;
-            if (mesh->mNormals)
+            memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mBitangents[v].x, 3*sizeof(float));
+        }
+    }
+    
+    // VERTEX BUFFER DATA
+    glBufferData(GL_ARRAY_BUFFER, vbuflen, vbufdata, GL_STATIC_DRAW);
+    PrintGLError("uploading vertex buffer data");
+    free(vbufdata);
+    AccountGPUMemory(vbuflen);
+    
+    // INDEX BUFFER
+    glGenBuffers(1, &glbuff.indBuffer);
+    PrintGLError("generating index buffer");
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glbuff.indBuffer);
+    PrintGLError("binding index buffer");
+    
+    glbuff.numInds = 0;
+    for (unsigned f=0; f<mesh->mNumFaces; f++)
+        glbuff.numInds += mesh->mFaces[f].mNumIndices;
+    
+    glbuff.primType = 0;
+    if (mesh->mNumFaces>0)
+    {
+        switch(mesh->mFaces[0].mNumIndices)
+        {
+            case 1: glbuff.primType = GL_POINTS; break;
+            case 2: glbuff.primType = GL_LINES; break;
+            case 3: glbuff.primType = GL_TRIANGLES; break;
+            default: glbuff.primType = GL_POLYGON; break;
+        }
+    }
+    
+    unsigned short* ibufdata = (unsigned short*)malloc(glbuff.numInds*sizeof(unsigned short));
+    unsigned short* iptr = ibufdata;
+    for (unsigned f=0; f<mesh->mNumFaces; f++)
+    {
+        for (unsigned i=0; i<mesh->mFaces[f].mNumIndices; i++)
+            *(iptr++) = mesh->mFaces[f].mIndices[i];
+    }
+    
+    // INDEX BUFFER DATA
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*glbuff.numInds, ibufdata, GL_STATIC_DRAW);
+    PrintGLError("sending index buffer data");
+    AccountGPUMemory(sizeof(unsigned short)*glbuff.numInds);
+    
+    glbuff.indBufferType = GL_UNSIGNED_SHORT;
+    
+    free(ibufdata);
+    
+    glBindVertexArray(0);
+}
+
+void CMesh::CreateGLMeshesFromAssimp()
+{
+    assert(_scene);
+    
+    glGetError();
+    
+    // textures of all materials are loaded in parallel up front
+    TextureMap textures;
+    LoadMaterialTextures(textures);
+    
+    for (int m=0; m<_scene->mNumMeshes; m++)
+    {
+        const struct aiMesh* mesh = _scene->mMeshes[m];
+        const struct aiMaterial* mat = _scene->mMaterials[mesh->mMaterialIndex];
+        
+        GLBuffer glbuff;
+        
+        // material
+        std::string diffusePath, normalPath;
+        bool inverseNormalY = false;
+        if (LocateMaterialTextures(mat, diffusePath, normalPath, inverseNormalY))
+        {
+            if (diffusePath.length())
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mNormals[v].x, 3*sizeof(float));
+                glbuff.diffuseTex = textures[diffusePath].texture;
+                glbuff.diffuseLayer = textures[diffusePath].layer;
             }
-            
-            atr = ATTRIB_TANGENT;
-            if (mesh->mTangents)
+            if (normalPath.length())
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mTangents[v].x, 3*sizeof(float));
+                glbuff.normalSpecularTex = textures[normalPath].texture;
+                glbuff.normalSpecularLayer = textures[normalPath].layer;
             }
             
-            atr = ATTRIB_BITANGENT;
-            if (mesh->mBitangents)
+            CShaderDefines defines;
+            if (glbuff.diffuseTex)
             {
-                if (v==0)
-                {
-                    glEnableVertexAttribArray(Attrib2Index(atr));
-                    glVertexAttribPointer(Attrib2Index(atr), 3, GL_FLOAT, 0, vertlen, (void*)(long)ComputeAttribOffset(atr, _attrs));
-                    PrintGLError("setting vertex attribute pointer");
-                }
-                memcpy(vertStart + ComputeAttribOffset(atr, _attrs), &mesh->mBitangents[v].x, 3*sizeof(float));
+                defines.Define("TEXTURE0,ATTRIB_COORDS0");
+                if (glbuff.normalSpecularTex)
+                    defines.Define("NORMAL_SPECULAR_MAP");
             }
+            
+            // load shaders
+            CShaderDefines normalDefines(defines);
+            if (inverseNormalY) normalDefines.Define("NORMAL_SPECULAR_MAP_INVERSEY");
+            if (glbuff.normalSpecularTex && glbuff.normalSpecularTex->GetFormat() == TF_BC5)
+                normalDefines.Define("NORMAL_SPECULAR_MAP_RG"); // only X and Y stored
+            if (glbuff.normalSpecularTex && glbuff.normalSpecularTex->IsArray())
+                normalDefines.Define("NORMAL_SPECULAR_MAP_ARRAY");
+            CShaderDefines materialDefines(defines);
+            if (glbuff.diffuseTex && glbuff.diffuseTex->IsArray())
+                materialDefines.Define("TEXTURE0_ARRAY");
+            glbuff.normalProg = CShaderManager::Inst()->GetProgram("normal.glsl", &normalDefines);
+            glbuff.zProg = CShaderManager::Inst()->GetProgram("z.glsl", &defines);
+            glbuff.materialProg = CShaderManager::Inst()->GetProgram("material.glsl", &materialDefines);
+            if (SupportsGBufferPass())
+                glbuff.gbufferProg = CShaderManager::Inst()->GetProgram("normal.glsl", &CShaderDefines(normalDefines).Define("GBUFFER"));
+            if (CEngine::Inst()->GetRendererCapabilities().floatTextures)
+                glbuff.forwardProg = CShaderManager::Inst()->GetProgram("material.glsl", &(materialDefines + normalDefines).Define("CLUSTERED"));
         }
         
-        // VERTEX BUFFER DATA
-        glBufferData(GL_ARRAY_BUFFER, vbuflen, vbufdata, GL_STATIC_DRAW);
-        PrintGLError("uploading vertex buffer data");
-        free(vbufdata);
-        
-        // INDEX BUFFER
-        glGenBuffers(1, &glbuff.indBuffer);
-        PrintGLError("generating index buffer");
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glbuff.indBuffer);
-        PrintGLError("binding index buffer");
-        
-        glbuff.numInds = 0;
-        for (unsigned f=0; f<mesh->mNumFaces; f++)
-            glbuff.numInds += mesh->mFaces[f].mNumIndices;
-        
-        glbuff.primType = 0;
-        if (mesh->mNumFaces>0)
+        // bounds and texture coordinate density for mip streaming
+        if (mesh->mNumVertices)
         {
-            switch(mesh->mFaces[0].mNumIndices)
+            glbuff.aabbMin = glbuff.aabbMax = glm::vec3(mesh->mVertices[0].x, mesh->mVertices[0].y, mesh->mVertices[0].z);
+            for (unsigned v=1; v<mesh->mNumVertices; v++)
             {
-                case 1: glbuff.primType = GL_POINTS; break;
-                case 2: glbuff.primType = GL_LINES; break;
-                case 3: glbuff.primType = GL_TRIANGLES; break;
-                default: glbuff.primType = GL_POLYGON; break;
+                glm::vec3 p(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+                glbuff.aabbMin = glm::min(glbuff.aabbMin, p);
+                glbuff.aabbMax = glm::max(glbuff.aabbMax, p);
             }
         }
-        
-        unsigned short* ibufdata = (unsigned short*)malloc(glbuff.numInds*sizeof(unsigned short));
-        unsigned short* iptr = ibufdata;
-        for (unsigned f=0; f<mesh->mNumFaces; f++)
+        if (mesh->mTextureCoords[0])
         {
-            for (unsigned i=0; i<mesh->mFaces[f].mNumIndices; i++)
-                *(iptr++) = mesh->mFaces[f].mIndices[i];
+            float worldArea = 0, uvArea = 0;
+            for (unsigned f=0; f<mesh->mNumFaces; f++)
+            {
+                const struct aiFace& face = mesh->mFaces[f];
+                if (face.mNumIndices != 3) continue;
+                
+                const aiVector3D& p0 = mesh->mVertices[face.mIndices[0]];
+                const aiVector3D& p1 = mesh->mVertices[face.mIndices[1]];
+                const aiVector3D& p2 = mesh->mVertices[face.mIndices[2]];
+                const aiVector3D& t0 = mesh->mTextureCoords[0][face.mIndices[0]];
+                const aiVector3D& t1 = mesh->mTextureCoords[0][face.mIndices[1]];
+                const aiVector3D& t2 = mesh->mTextureCoords[0][face.mIndices[2]];
+                
+                worldArea += ((p1-p0)^(p2-p0)).Length();
+                uvArea += fabsf((t1.x-t0.x)*(t2.y-t0.y) - (t2.x-t0.x)*(t1.y-t0.y));
+            }
+            if (worldArea > 0)
+                glbuff.uvDensity = sqrtf(uvArea/worldArea);
         }
         
-        // INDEX BUFFER DATA
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*glbuff.numInds, ibufdata, GL_STATIC_DRAW);
-        PrintGLError("sending index buffer data");
-        
-        glbuff.indBufferType = GL_UNSIGNED_SHORT;
-        
-        free(ibufdata);
+        // GL buffers
+        CreateGLBuffers(mesh, glbuff);
         
         // ADD GLMESH TO LIST
         _glbuff.push_back(glbuff);
@@ -823,6 +1244,7 @@ bool CMesh::AddMeshPart(const CMeshPart &part)
     
     // VERTEX BUFFER DATA
     glBufferData(GL_ARRAY_BUFFER, vbuflen, vbufdata, GL_STATIC_DRAW);
+    AccountGPUMemory(vbuflen);
     PrintGLError("uploading vertex buffer data");
     free(vbufdata);
     
@@ -839,6 +1261,7 @@ bool CMesh::AddMeshPart(const CMeshPart &part)
         
         // INDEX BUFFER DATA
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, istream->GetByteLength(), istream->GetData(), GL_STATIC_DRAW);
+        AccountGPUMemory(istream->GetByteLength());
         PrintGLError("sending index buffer data");
         
         glbuff.numInds = part.GetIndexStream()->GetByteLength()/GetTypeSize(istream->GetType());
@@ -864,6 +1287,46 @@ bool CMesh::AddMeshPart(const CMeshPart &part)
     return true;
 }
 
+void CMesh::RequestTextureLevels(const GLBuffer& glbuff)const
+{
+    if (!glbuff.uvDensity) return;
+    if ((!glbuff.diffuseTex || !glbuff.diffuseTex->IsStreamed()) &&
+        (!glbuff.normalSpecularTex || !glbuff.normalSpecularTex->IsStreamed()))
+        return;
+    
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    
+    // distance from the camera to the closest point of the bounds in world space
+    glm::vec3 bmin = glbuff.aabbMin * _scale + _pos;
+    glm::vec3 bmax = glbuff.aabbMax * _scale + _pos;
+    glm::vec3 lo = glm::min(bmin, bmax), hi = glm::max(bmin, bmax);
+    glm::vec3 camPos = cam.GetPosition();
+    glm::vec3 delta = glm::max(glm::vec3(0), glm::max(lo - camPos, camPos - hi));
+    float dist = Max(glm::length(delta), cam.GetNearPlane());
+    
+    // screen pixels covered by one world unit at that distance (FOV is vertical, in degrees)
+    float pixelsPerUnit = glutGet(GLUT_WINDOW_HEIGHT) / (2.0f * tanf(cam.GetFieldOfView() * 0.5f * (float)M_PI / 180.0f) * dist);
+    float scale = Max(fabsf(_scale.x), Max(fabsf(_scale.y), fabsf(_scale.z)));
+    float uvPerPixel = glbuff.uvDensity / (scale * pixelsPerUnit);
+    
+    unsigned frame = CTextureStreamer::Inst()->GetFrame();
+    CTexture* texs[2] = { glbuff.diffuseTex, glbuff.normalSpecularTex };
+    for (unsigned i=0; i<2; i++)
+    {
+        CTexture* tex = texs[i];
+        if (!tex || !tex->IsStreamed()) continue;
+        
+        float texelsPerPixel = uvPerPixel * Max(tex->GetWidth(), tex->GetHeight());
+        tex->RequestLevel(CTextureStreamer::LevelForDensity(texelsPerPixel, tex->GetNumMips()), frame);
+    }
+}
+
+bool CMesh::SupportsGBufferPass()
+{
+    const CEngine::SRendererCaps& caps = CEngine::Inst()->GetRendererCapabilities();
+    return caps.MRT && caps.maxDrawBuffers >= 2;
+}
+
 void CMesh::DrawNode(EDrawPass pass, const struct aiNode *nd)const
 {
     // update transform
@@ -884,24 +1347,56 @@ void CMesh::DrawNode(EDrawPass pass, const struct aiNode *nd)const
         CShaderProgram* prog = NULL;
         if (pass == DRAW_Z)
             prog = glbuff.zProg;
-        else if (pass == DRAW_NORMAL)
+        else if (pass == DRAW_NORMAL || pass == DRAW_GBUFFER)
         {
-            prog = glbuff.normalProg;
+            prog = pass == DRAW_GBUFFER ? glbuff.gbufferProg : glbuff.normalProg;
             if (prog && glbuff.normalSpecularTex)
+            {
                 prog->SetUniform("uTexNormalSpecular", *glbuff.normalSpecularTex, 0);
+                if (glbuff.normalSpecularTex->IsArray())
+                    prog->SetUniform("uTexNormalSpecularLayer", (float)glbuff.normalSpecularLayer);
+            }
         }
         else if (pass == DRAW_MATERIAL)
         {
             prog = glbuff.materialProg;
             if (prog && glbuff.diffuseTex)
+            {
                 prog->SetUniform("uTex0", *glbuff.diffuseTex, 0);
+                if (glbuff.diffuseTex->IsArray())
+                    prog->SetUniform("uTex0Layer", (float)glbuff.diffuseLayer);
+            }
             
             if (prog)
             {
+                RequestTextureLevels(glbuff);
                 prog->SetUniform("uAmbientColor", scene->GetAmbientColor());
                 prog->SetUniform("uDiffuseAcc", scene->GetRTTexture(IScene::RT_DIFFUSE_ACC), 1);
             }
         }
+        else if (pass == DRAW_FORWARD)
+        {
+            prog = glbuff.forwardProg;
+            if (prog && glbuff.diffuseTex)
+            {
+                prog->SetUniform("uTex0", *glbuff.diffuseTex, 0);
+                if (glbuff.diffuseTex->IsArray())
+                    prog->SetUniform("uTex0Layer", (float)glbuff.diffuseLayer);
+            }
+            if (prog && glbuff.normalSpecularTex)
+            {
+                prog->SetUniform("uTexNormalSpecular", *glbuff.normalSpecularTex, 1);
+                if (glbuff.normalSpecularTex->IsArray())
+                    prog->SetUniform("uTexNormalSpecularLayer", (float)glbuff.normalSpecularLayer);
+            }
+            
+            if (prog)
+            {
+                RequestTextureLevels(glbuff);
+                prog->SetUniform("uAmbientColor", scene->GetAmbientColor());
+                scene->SetClusterUniforms(prog, 2);
+            }
+        }
         
         if (prog)
         {
@@ -942,9 +1437,9 @@ void CMesh::DrawBufferArray(EDrawPass pass)const
         CShaderProgram* prog = NULL;
         if (pass == DRAW_Z)
             prog = glbuff.zProg;
-        else if (pass == DRAW_NORMAL)
+        else if (pass == DRAW_NORMAL || pass == DRAW_GBUFFER)
         {
-            prog = glbuff.normalProg;
+            prog = pass == DRAW_GBUFFER ? glbuff.gbufferProg : glbuff.normalProg;
             if (prog && glbuff.normalSpecularTex)
                 prog->SetUniform("uTexNormalSpecular", *glbuff.normalSpecularTex, 0);
         }
@@ -960,6 +1455,20 @@ void CMesh::DrawBufferArray(EDrawPass pass)const
                 prog->SetUniform("uDiffuseAcc", scene->GetRTTexture(IScene::RT_DIFFUSE_ACC), 1);
             }
         }
+        else if (pass == DRAW_FORWARD)
+        {
+            prog = glbuff.forwardProg;
+            if (prog && glbuff.diffuseTex)
+                prog->SetUniform("uTex0", *glbuff.diffuseTex, 0);
+            if (prog && glbuff.normalSpecularTex)
+                prog->SetUniform("uTexNormalSpecular", *glbuff.normalSpecularTex, 1);
+            
+            if (prog)
+            {
+                prog->SetUniform("uAmbientColor", scene->GetAmbientColor());
+                scene->SetClusterUniforms(prog, 2);
+            }
+        }
         
         if (prog)
         {
@@ -11,10 +11,12 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <assert.h>
 #include <algorithm> // std::sort
 
 #include "Types.h"
+#include "GPUMemory.h"
 #include "vec3.hpp"
 
 struct aiScene;
@@ -34,7 +36,10 @@ enum EVertexAttrib {
 	ATTRIB_NORMAL	= 1<<3,
 	ATTRIB_TANGENT	= 1<<4,
 	ATTRIB_BITANGENT= 1<<5,
-	ATTRIB_PROJVEC	= 1<<6 // screen space projection direction
+	ATTRIB_PROJVEC	= 1<<6, // screen space projection direction
+	// per-instance (CMesh::DrawInstanced)
+	ATTRIB_INSTANCE0= 1<<7,
+	ATTRIB_INSTANCE1= 1<<8
 };
 
 // must be defined in s_primTypes
@@ -149,13 +154,14 @@ private:
 };
 
 /// Mesh representing renderable sets of vertices
-class CMesh
+class CMesh : public IGPUResource
 {
     /// Runtime data used for rendering
     struct GLBuffer
     {
         GLBuffer():vertBuffer(0),indBuffer(0),vertArrayObj(0),numInds(0),primType(0),
-        normalProg(0), zProg(0), materialProg(0), diffuseTex(0),normalSpecularTex(0){};
+        diffuseTex(0),normalSpecularTex(0),diffuseLayer(0),normalSpecularLayer(0),
+        normalProg(0), zProg(0), materialProg(0), gbufferProg(0), forwardProg(0), uvDensity(0){};
         
         unsigned    vertBuffer;
         unsigned    indBuffer;
@@ -167,19 +173,41 @@ class CMesh
         //material
         CTexture*   diffuseTex;
         CTexture*   normalSpecularTex;
+        unsigned    diffuseLayer; // layer of diffuseTex if it's an array
+        unsigned    normalSpecularLayer;
         CShaderProgram* normalProg;
         CShaderProgram* zProg;
         CShaderProgram* materialProg;
+        CShaderProgram* gbufferProg; // linear z + normal in one MRT pass (NULL without MRT)
+        CShaderProgram* forwardProg; // clustered forward shading (NULL without float textures)
+        
+        // texture streaming
+        glm::vec3   aabbMin, aabbMax; // object space bounds
+        float       uvDensity; // texture coordinate units per object space unit
     };
     typedef std::vector<GLBuffer> GLBufferArray;
+    /// Loaded material texture (a layer of an array texture when the textures are batched)
+    struct STextureRef
+    {
+        STextureRef():texture(NULL),layer(0){};
+        
+        CTexture* texture;
+        unsigned layer;
+    };
+    typedef std::map<std::string, STextureRef> TextureMap;
     
 public:
     enum EDrawPass {
         DRAW_Z=0,
         DRAW_NORMAL,
-        DRAW_MATERIAL
+        DRAW_MATERIAL,
+        DRAW_GBUFFER, // DRAW_Z and DRAW_NORMAL at once into two color attachments (see SupportsGBufferPass)
+        DRAW_FORWARD // lit material using the scene light clusters (see IScene::BuildLightClusters)
     };
     
+    /// Whether DRAW_GBUFFER can be used (MRT with at least two draw buffers)
+    static bool SupportsGBufferPass();
+    
     
     CMesh(const char* name = "unnamed");
     ~CMesh();
@@ -208,13 +236,33 @@ public:
     bool AddMeshPart(const CMeshPart& part);
     
     void Draw(EDrawPass pass = DRAW_MATERIAL)const;
+    /// Draws the mesh parts numInstances times using the bound program. Each instance has two vec4 attributes
+    /// (ATTRIB_INSTANCE0, ATTRIB_INSTANCE1) stored one after another in instanceBuffer from byteOffset.
+    /// \note Requires SRendererCaps.instancing; meshes loaded from files are not supported
+    void DrawInstanced(unsigned numInstances, unsigned instanceBuffer, unsigned byteOffset)const;
+    
+    // IGPUResource - vertex and index buffers of loaded meshes are recreated from the imported scene when drawn again
+    size_t GetEvictableBytes()const;
+    size_t Evict();
 
 private:
     void DrawNode(EDrawPass pass, const struct aiNode* nd)const;
     void DrawBufferArray(EDrawPass pass)const;
+    /// Requests the mip levels of streamed textures needed to draw the buffer at its current screen size
+    void RequestTextureLevels(const GLBuffer& glbuff)const;
     void CalcStatsInNode(const struct aiNode* nd, unsigned& outVerts, unsigned& outInds);
     void CreateGLMeshesFromAssimp();
+    /// Creates VAO, vertex and index buffer of the mesh
+    void CreateGLBuffers(const struct aiMesh* mesh, GLBuffer& glbuff);
+    void RestoreGLBuffers();
+    void AccountGPUMemory(unsigned bytes);
     std::string LocateTexture(const char* path)const;
+    /// Finds diffuse and normal(+specular) textures of the material (empty paths if not found)
+    /// \return False if the material has no diffuse texture assigned
+    bool LocateMaterialTextures(const struct aiMaterial* mat, std::string& outDiffuse, std::string& outNormal, bool& outInverseNormalY)const;
+    /// Decodes textures of all materials on CThreadPool and uploads them; maps located path -> texture
+    /// Same-sized textures of the same format are grouped into array textures (r_textureArrays)
+    void LoadMaterialTextures(TextureMap& outTextures)const;
     
     const struct aiScene* _scene;
     std::string _name;
@@ -222,6 +270,8 @@ private:
     unsigned _attrs; // EVertexAttrib
     glm::vec3 _pos;
     glm::vec3 _scale;
+    unsigned _gpuBytes; // vertex and index buffers
+    bool _evicted;
 };
 
 #endif /* defined(__glt__Mesh__) */
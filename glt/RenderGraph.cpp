@@ -0,0 +1,737 @@
+//
+//  RenderGraph.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "RenderGraph.h"
+#include "RenderTarget.h"
+#include "Engine.h"
+#include "GPUMemory.h"
+#include "GLState.h"
+#include "CVar.h"
+#include "Shared.h"
+
+#include "glstuff.h"
+
+#include <algorithm>
+
+static CVar cvAliasing("r_rtAliasing", true, CVar::FLAG_GUI_TWEAKABLE); // share textures between render-graph resources with disjoint lifetimes
+static CVar cvInvalidate("r_rtInvalidate", true, CVar::FLAG_GUI_TWEAKABLE); // invalidate render-graph resources instead of clearing them or storing unused contents
+
+static bool isDepthFormat(ETextureFormat fmt)
+{
+    return fmt == TF_DEPTH32 || fmt == TF_DEPTH16 || fmt == TF_DEPTH24 || fmt == TF_DEPTH24S8;
+}
+
+/// Format of the texture backing a resource; RGB8 is stored as RGBA8 by most drivers anyway,
+/// so allowing it lets RGB8 and RGBA8 resources share textures
+static ETextureFormat storageFormat(ETextureFormat fmt, bool aliasing)
+{
+    if (aliasing && fmt == TF_RGB8) return TF_RGBA8;
+    return fmt;
+}
+
+CRenderGraph::CRenderGraph()
+:_width(0), _height(0), _aliasing(true), _compiledAliasing(false), _dirty(true), _compileFailed(false), _allocatedBytes(0), _unaliasedBytes(0)
+{
+}
+
+CRenderGraph::~CRenderGraph()
+{
+    Release();
+}
+
+unsigned CRenderGraph::AddResource(const char* name, ETextureFormat format, const glm::vec4& clearColor, ESamplerState sampler)
+{
+    SResource res;
+    res.name = name;
+    res.format = format;
+    res.clearColor = clearColor;
+    res.sampler = sampler;
+    res.sizeDivisor = 1;
+    res.persistent = false;
+    res.physical = INVALID;
+    res.texture = NULL;
+    res.firstUse = res.lastUse = INVALID;
+    
+    _resources.push_back(res);
+    MarkDirty();
+    return (unsigned)_resources.size()-1;
+}
+
+unsigned CRenderGraph::AddPass(const char* name, FPassExecute execute, void* userData)
+{
+    SPass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.userData = userData;
+    pass.output = false;
+    pass.enabled = true;
+    pass.fbo = 0;
+    pass.numColor = 0;
+    pass.depth = INVALID;
+    pass.width = pass.height = 0;
+    
+    _passes.push_back(pass);
+    MarkDirty();
+    return (unsigned)_passes.size()-1;
+}
+
+void CRenderGraph::Read(unsigned pass, unsigned resource)
+{
+    _passes[pass].reads.push_back(resource);
+    MarkDirty();
+}
+
+void CRenderGraph::Sample(unsigned pass, unsigned resource)
+{
+    _passes[pass].samples.push_back(resource);
+    MarkDirty();
+}
+
+void CRenderGraph::Write(unsigned pass, unsigned resource)
+{
+    _passes[pass].writes.push_back(resource);
+    MarkDirty();
+}
+
+void CRenderGraph::WriteAll(unsigned pass, unsigned resource)
+{
+    Write(pass, resource);
+    _passes[pass].writesAll.push_back(resource);
+}
+
+void CRenderGraph::SetOutput(unsigned pass)
+{
+    _passes[pass].output = true;
+    MarkDirty();
+}
+
+void CRenderGraph::SetEnabled(unsigned pass, bool enable)
+{
+    if (_passes[pass].enabled == enable) return;
+    
+    _passes[pass].enabled = enable;
+    MarkDirty();
+}
+
+void CRenderGraph::MarkDirty()
+{
+    _dirty = true;
+    _compileFailed = false;
+}
+
+void CRenderGraph::Resize(unsigned width, unsigned height)
+{
+    if (width == _width && height == _height) return;
+    
+    _width = width;
+    _height = height;
+    MarkDirty();
+}
+
+void CRenderGraph::SetSizeDivisor(unsigned resource, unsigned divisor)
+{
+    divisor = Max(1u, divisor);
+    if (_resources[resource].sizeDivisor == divisor) return;
+    
+    _resources[resource].sizeDivisor = divisor;
+    MarkDirty();
+}
+
+void CRenderGraph::SetPersistent(unsigned resource)
+{
+    _resources[resource].persistent = true;
+    MarkDirty();
+}
+
+unsigned CRenderGraph::ResourceWidth(const SResource& res)const
+{
+    return Max(1u, _width / res.sizeDivisor);
+}
+
+unsigned CRenderGraph::ResourceHeight(const SResource& res)const
+{
+    return Max(1u, _height / res.sizeDivisor);
+}
+
+const CTexture& CRenderGraph::GetTexture(unsigned resource)const
+{
+    if (resource >= _resources.size() || !_resources[resource].texture)
+        return CTexture::None();
+    
+    return *_resources[resource].texture;
+}
+
+void CRenderGraph::Release()
+{
+    STD_FOREACH(std::vector<SPass>, _passes, it)
+    {
+        if (it->fbo)
+        {
+            CGLState::ForgetFramebuffer(it->fbo);
+            glDeleteFramebuffers(1, &it->fbo);
+        }
+        it->fbo = 0;
+        it->clears.clear();
+        it->invalidates.clear();
+        it->discards.clear();
+    }
+    
+    STD_FOREACH(std::vector<SResource>, _resources, it)
+    {
+        delete it->texture;
+        it->texture = NULL;
+        it->physical = INVALID;
+    }
+    
+    STD_FOREACH(std::vector<SPhysical>, _physical, it)
+    {
+        CTexture::ForgetGLTexture(it->glTex);
+        glDeleteTextures(1, &it->glTex);
+    }
+    _physical.clear();
+    _order.clear();
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_RENDERTARGET, _allocatedBytes);
+    _allocatedBytes = 0;
+}
+
+static bool contains(const std::vector<unsigned>& resources, unsigned resource)
+{
+    return std::find(resources.begin(), resources.end(), resource) != resources.end();
+}
+
+void CRenderGraph::BuildDependencies(PassEdges& outNeeds, PassEdges& outAfter)const
+{
+    outNeeds.assign(_passes.size(), std::vector<unsigned>());
+    outAfter.assign(_passes.size(), std::vector<unsigned>());
+    
+    for (unsigned r=0; r<_resources.size(); r++)
+    {
+        const SResource& res = _resources[r];
+        
+        unsigned firstWriter = INVALID;
+        for (unsigned p=0; p<_passes.size() && firstWriter == INVALID; p++)
+            if (_passes[p].enabled && contains(_passes[p].writes, r)) firstWriter = p;
+        
+        unsigned lastWriter = INVALID;
+        std::vector<unsigned> readers; // of the contents made by lastWriter (or of the previous frame)
+        for (unsigned p=0; p<_passes.size(); p++)
+        {
+            const SPass& pass = _passes[p];
+            if (!pass.enabled) continue;
+            
+            bool reads = contains(pass.reads, r) || contains(pass.samples, r);
+            bool writes = contains(pass.writes, r);
+            
+            // a read declared before any writer sees the previous frame of a persistent resource,
+            // otherwise it is a declaration order mistake and it waits for the first writer
+            if (reads)
+            {
+                unsigned writer = lastWriter != INVALID ? lastWriter : (res.persistent ? INVALID : firstWriter);
+                if (writer != INVALID && writer != p)
+                    outNeeds[p].push_back(writer);
+            }
+            
+            if (writes)
+            {
+                // written resources depend on earlier writers too - a pass may blend into or depth-test against earlier contents
+                if (lastWriter != INVALID)
+                    outNeeds[p].push_back(lastWriter);
+                for (unsigned i=0; i<readers.size(); i++)
+                    if (readers[i] != p) outAfter[p].push_back(readers[i]);
+                readers.clear();
+                lastWriter = p;
+            }
+            else if (reads && (lastWriter != INVALID || res.persistent))
+                readers.push_back(p);
+        }
+    }
+}
+
+void CRenderGraph::CullPasses(const PassEdges& needs, std::vector<bool>& outAlive)const
+{
+    outAlive.assign(_passes.size(), false);
+    
+    // outputs and writers of persistent resources (read by the next frame) are needed
+    std::vector<unsigned> stack;
+    for (unsigned p=0; p<_passes.size(); p++)
+    {
+        const SPass& pass = _passes[p];
+        if (!pass.enabled) continue;
+        
+        bool root = pass.output;
+        for (unsigned w=0; !root && w<pass.writes.size(); w++)
+            root = _resources[pass.writes[w]].persistent;
+        if (root) stack.push_back(p);
+    }
+    
+    // and so is everything they depend on
+    while (!stack.empty())
+    {
+        unsigned p = stack.back();
+        stack.pop_back();
+        if (outAlive[p]) continue;
+        
+        outAlive[p] = true;
+        for (unsigned i=0; i<needs[p].size(); i++)
+            stack.push_back(needs[p][i]);
+    }
+}
+
+bool CRenderGraph::SortPasses(const PassEdges& needs, const PassEdges& after, const std::vector<bool>& alive)
+{
+    _order.clear();
+    
+    std::vector<unsigned> waitingFor(_passes.size(), 0);
+    PassEdges unblocks(_passes.size());
+    unsigned numAlive = 0;
+    for (unsigned p=0; p<_passes.size(); p++)
+    {
+        if (!alive[p]) continue;
+        numAlive++;
+        
+        for (unsigned i=0; i<needs[p].size(); i++)
+        {
+            waitingFor[p]++;
+            unblocks[needs[p][i]].push_back(p);
+        }
+        for (unsigned i=0; i<after[p].size(); i++)
+        {
+            if (!alive[after[p][i]]) continue; // culled readers don't run at all
+            waitingFor[p]++;
+            unblocks[after[p][i]].push_back(p);
+        }
+    }
+    
+    // always pick the first declared pass which is ready, so that a correctly declared graph keeps its order
+    std::vector<bool> done(_passes.size(), false);
+    while (_order.size() < numAlive)
+    {
+        unsigned next = INVALID;
+        for (unsigned p=0; p<_passes.size() && next == INVALID; p++)
+            if (alive[p] && !done[p] && !waitingFor[p]) next = p;
+        
+        if (next == INVALID)
+        {
+            printf("Render graph: passes depend on each other in a cycle:");
+            for (unsigned p=0; p<_passes.size(); p++)
+                if (alive[p] && !done[p]) printf(" %s", _passes[p].name.c_str());
+            printf("\n");
+            _order.clear();
+            return false;
+        }
+        
+        done[next] = true;
+        _order.push_back(next);
+        for (unsigned i=0; i<unblocks[next].size(); i++)
+            waitingFor[unblocks[next][i]]--;
+    }
+    
+    // worth fixing in the declarations, even though the graph handles it
+    for (unsigned pos=1; pos<_order.size(); pos++)
+        if (_order[pos] < _order[pos-1])
+            printf("Render graph: pass %s runs before %s which is declared earlier\n", _passes[_order[pos-1]].name.c_str(), _passes[_order[pos]].name.c_str());
+    
+    return true;
+}
+
+unsigned CRenderGraph::AllocatePhysical(const SResource& res, unsigned firstUse, bool aliasing)
+{
+    ETextureFormat format = storageFormat(res.format, aliasing);
+    unsigned width = ResourceWidth(res), height = ResourceHeight(res);
+    
+    // without sampler objects the filtering is a property of the texture itself
+    bool samplerObjects = CEngine::Inst()->GetRendererCapabilities().samplerObjects;
+    
+    if (aliasing)
+    {
+        for (unsigned i=0; i<_physical.size(); i++)
+        {
+            SPhysical& phys = _physical[i];
+            if (phys.freeAfter < firstUse && phys.format == format && phys.width == width && phys.height == height
+                && (samplerObjects || phys.sampler == res.sampler))
+            {
+                phys.freeAfter = res.lastUse;
+                return i;
+            }
+        }
+    }
+    
+    SPhysical phys;
+    phys.format = format;
+    phys.sampler = res.sampler;
+    phys.width = width;
+    phys.height = height;
+    phys.freeAfter = res.lastUse;
+    
+    glGenTextures(1, &phys.glTex);
+    CTexture::BindForEdit(GL_TEXTURE_2D, phys.glTex);
+    
+    GLint filter = res.sampler == SS_LINEAR_CLAMP ? GL_LINEAR : GL_NEAREST;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    PrintGLError("setting render graph texture parameters");
+    
+    const SGLTextureFormatInfo& fi = CTexture::GLFormat(format);
+    glGetError();
+    glTexImage2D(GL_TEXTURE_2D, 0, fi.internalFormat, width, height, 0, fi.format, fi.type, 0);
+    if (glGetError() != GL_NO_ERROR)
+    {
+        printf("Error creating render graph texture for %s. Size: [%u,%u], Format: %d\n", res.name.c_str(), width, height, format);
+        CTexture::ForgetGLTexture(phys.glTex);
+        glDeleteTextures(1, &phys.glTex);
+        return INVALID;
+    }
+    
+    unsigned bytes = CTexture::MipSize(format, width, height);
+    _allocatedBytes += bytes;
+    CGPUMemory::Inst()->Allocated(GPUMEM_RENDERTARGET, bytes);
+    
+    _physical.push_back(phys);
+    return (unsigned)_physical.size()-1;
+}
+
+bool CRenderGraph::CreatePassFramebuffer(SPass& pass)
+{
+    GLenum buffs[16];
+    pass.numColor = 0;
+    pass.depth = INVALID;
+    
+    // depth-tested against counts as use of the depth attachment
+    for (unsigned r=0; r<pass.reads.size(); r++)
+        if (isDepthFormat(_resources[pass.reads[r]].format))
+            pass.depth = pass.reads[r];
+    
+    for (unsigned w=0; w<pass.writes.size(); w++)
+    {
+        if (isDepthFormat(_resources[pass.writes[w]].format))
+            pass.depth = pass.writes[w];
+        else if (pass.numColor < Min(16u, (unsigned)CEngine::Inst()->GetRendererCapabilities().maxDrawBuffers))
+        {
+            buffs[pass.numColor] = GLenum(GL_COLOR_ATTACHMENT0 + pass.numColor);
+            pass.numColor++;
+        }
+        else
+            printf("Render graph: pass %s writes more resources than draw buffers\n", pass.name.c_str());
+    }
+    
+    if (!pass.numColor && pass.depth == INVALID)
+        return true; // renders to the screen
+    
+    // viewport; all attachments have to be the same size
+    std::vector<unsigned> attached(pass.writes);
+    if (pass.depth != INVALID) attached.push_back(pass.depth);
+    pass.width = ResourceWidth(_resources[attached[0]]);
+    pass.height = ResourceHeight(_resources[attached[0]]);
+    for (unsigned a=1; a<attached.size(); a++)
+    {
+        const SResource& res = _resources[attached[a]];
+        if (ResourceWidth(res) != pass.width || ResourceHeight(res) != pass.height)
+            printf("Render graph: pass %s attaches %s of a different size than %s\n", pass.name.c_str(), res.name.c_str(), _resources[attached[0]].name.c_str());
+    }
+    
+    glGenFramebuffers(1, &pass.fbo);
+    CGLState::BindFramebuffer(pass.fbo);
+    PrintGLError("binding render graph framebuffer");
+    
+    unsigned slot = 0;
+    for (unsigned w=0; w<pass.writes.size() && slot<pass.numColor; w++)
+    {
+        const SResource& res = _resources[pass.writes[w]];
+        if (isDepthFormat(res.format)) continue;
+        
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GLenum(GL_COLOR_ATTACHMENT0 + slot), GL_TEXTURE_2D, _physical[res.physical].glTex, 0);
+        slot++;
+    }
+    if (pass.depth != INVALID)
+    {
+        GLenum attachment = _resources[pass.depth].format == TF_DEPTH24S8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, _physical[_resources[pass.depth].physical].glTex, 0);
+    }
+    PrintGLError("attaching render graph textures");
+    
+    // draw buffers are framebuffer state, so they are set just once here
+    if (pass.numColor)
+        glDrawBuffers(pass.numColor, buffs);
+    else
+    {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    CGLState::BindFramebuffer(0);
+    
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        printf("Render graph: incomplete framebuffer for pass %s (0x%x)\n", pass.name.c_str(), status);
+        return false;
+    }
+    
+    return true;
+}
+
+void CRenderGraph::ClearResource(const SResource& res)
+{
+    unsigned fbo;
+    glGenFramebuffers(1, &fbo);
+    CGLState::BindFramebuffer(fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _physical[res.physical].glTex, 0);
+    
+    CGLState::SetViewport(0, 0, ResourceWidth(res), ResourceHeight(res));
+    CGLState::SetColorMask(true, true, true, true);
+    glClearColor(res.clearColor.r, res.clearColor.g, res.clearColor.b, res.clearColor.a);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    CGLState::BindFramebuffer(0);
+    CGLState::ForgetFramebuffer(fbo);
+    glDeleteFramebuffers(1, &fbo);
+    PrintGLError("clearing persistent render graph resource");
+}
+
+bool CRenderGraph::Compile()
+{
+    Release();
+    
+    bool aliasing = _aliasing && cvAliasing;
+    _compiledAliasing = aliasing;
+    
+    if (!_width || !_height) return false;
+    
+    // execution order - needed passes sorted on their dependencies
+    PassEdges needs, after;
+    BuildDependencies(needs, after);
+    std::vector<bool> alive;
+    CullPasses(needs, alive);
+    if (!SortPasses(needs, after, alive))
+        return false;
+    
+    // lifetimes and clears
+    STD_FOREACH(std::vector<SResource>, _resources, it)
+        it->firstUse = it->lastUse = INVALID;
+    
+    for (unsigned pos=0; pos<_order.size(); pos++)
+    {
+        SPass& pass = _passes[_order[pos]];
+        
+        for (unsigned r=0; r<pass.reads.size(); r++)
+        {
+            SResource& res = _resources[pass.reads[r]];
+            if (res.firstUse == INVALID)
+            {
+                if (!res.persistent)
+                    printf("Render graph: pass %s reads %s before anything writes it\n", pass.name.c_str(), res.name.c_str());
+                res.firstUse = pos;
+            }
+            res.lastUse = pos;
+        }
+        for (unsigned s=0; s<pass.samples.size(); s++)
+        {
+            SResource& res = _resources[pass.samples[s]];
+            if (res.firstUse == INVALID)
+            {
+                if (!res.persistent)
+                    printf("Render graph: pass %s samples %s before anything writes it\n", pass.name.c_str(), res.name.c_str());
+                res.firstUse = pos;
+            }
+            res.lastUse = pos;
+        }
+        for (unsigned w=0; w<pass.writes.size(); w++)
+        {
+            SResource& res = _resources[pass.writes[w]];
+            if (res.firstUse == INVALID)
+            {
+                res.firstUse = pos;
+                if (!res.persistent)
+                {
+                    bool all = std::find(pass.writesAll.begin(), pass.writesAll.end(), pass.writes[w]) != pass.writesAll.end();
+                    (all ? pass.invalidates : pass.clears).push_back(pass.writes[w]);
+                }
+            }
+            res.lastUse = pos;
+        }
+    }
+    
+    // contents of the others are not needed after their last use
+    for (unsigned i=0; i<_resources.size(); i++)
+    {
+        const SResource& res = _resources[i];
+        if (!res.persistent && res.lastUse != INVALID)
+            _passes[_order[res.lastUse]].discards.push_back(i);
+    }
+    
+    // persistent resources live through the whole frame (and into the next one)
+    STD_FOREACH(std::vector<SResource>, _resources, it)
+    {
+        if (!it->persistent || it->firstUse == INVALID) continue;
+        
+        it->firstUse = 0;
+        it->lastUse = (unsigned)_order.size()-1;
+    }
+    
+    // assign textures in the order resources come to life
+    _unaliasedBytes = 0;
+    for (unsigned pos=0; pos<_order.size(); pos++)
+    {
+        for (unsigned i=0; i<_resources.size(); i++)
+        {
+            SResource& res = _resources[i];
+            if (res.firstUse != pos) continue;
+            
+            _unaliasedBytes += CTexture::MipSize(res.format, ResourceWidth(res), ResourceHeight(res));
+            
+            res.physical = AllocatePhysical(res, pos, aliasing && !res.persistent);
+            if (res.physical == INVALID)
+            {
+                Release();
+                return false;
+            }
+            
+            res.texture = new CTexture(res.name.c_str(), _physical[res.physical].glTex, ResourceWidth(res), ResourceHeight(res), true);
+            res.texture->SetSamplerState(res.sampler);
+            
+            if (res.persistent)
+                ClearResource(res); // no previous frame yet
+        }
+    }
+    
+    bool ok = true;
+    for (unsigned pos=0; pos<_order.size(); pos++)
+        ok = CreatePassFramebuffer(_passes[_order[pos]]) && ok;
+    
+    printf("Render graph: %u of %u passes, %u resources in %u textures, peak RT memory %.1f MB (%.1f MB without aliasing)\n",
+           (unsigned)_order.size(), (unsigned)_passes.size(), (unsigned)_resources.size(), (unsigned)_physical.size(),
+           _allocatedBytes/(1024.0f*1024.0f), _unaliasedBytes/(1024.0f*1024.0f));
+    
+    // don't leave passes with missing framebuffers behind - they would draw to the screen
+    if (!ok) Release();
+    return ok;
+}
+
+bool CRenderGraph::IsAttached(const SPass& pass, unsigned resource)const
+{
+    if (pass.depth == resource) return true;
+    return !isDepthFormat(_resources[resource].format) && std::find(pass.writes.begin(), pass.writes.end(), resource) != pass.writes.end();
+}
+
+void CRenderGraph::Invalidate(const SPass& pass, const std::vector<unsigned>& resources)const
+{
+    GLenum atts[17]; GLsizei num = 0;
+    for (unsigned i=0; i<resources.size(); i++)
+    {
+        const SResource& res = _resources[resources[i]];
+        
+        if (pass.fbo && IsAttached(pass, resources[i]))
+        {
+            if (isDepthFormat(res.format))
+                atts[num++] = res.format == TF_DEPTH24S8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+            else
+            {
+                unsigned slot = 0;
+                for (unsigned w=0; w<pass.writes.size() && pass.writes[w] != resources[i]; w++)
+                    if (!isDepthFormat(_resources[pass.writes[w]].format)) slot++;
+                atts[num++] = GLenum(GL_COLOR_ATTACHMENT0 + slot);
+            }
+        }
+        else
+            glInvalidateTexImage(_physical[res.physical].glTex, 0); // only sampled by the pass
+    }
+    
+    if (num)
+    {
+        CGLState::BindFramebuffer(pass.fbo);
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, num, atts);
+    }
+    PrintGLError("invalidating render graph resources");
+}
+
+void CRenderGraph::Execute()
+{
+    bool aliasing = _aliasing && cvAliasing;
+    if (_compiledAliasing != aliasing)
+        MarkDirty();
+    
+    // a graph which failed to compile stays dirty and is retried once something changes
+    if (_dirty && !_compileFailed)
+    {
+        _dirty = !Compile();
+        _compileFailed = _dirty;
+        if (_compileFailed && _width && _height)
+            printf("Render graph: failed to compile, passes are skipped until the graph changes\n");
+    }
+    if (_dirty) return;
+    
+    bool invalidate = cvInvalidate && CEngine::Inst()->GetRendererCapabilities().invalidateSubdata;
+    
+    for (unsigned pos=0; pos<_order.size(); pos++)
+    {
+        const SPass& pass = _passes[_order[pos]];
+        
+        if (!pass.fbo)
+            CRenderTarget::Screen().Use(0);
+        else
+        {
+            CGLState::BindFramebuffer(pass.fbo);
+            PrintGLError("binding render graph framebuffer");
+            CGLState::SetViewport(0, 0, pass.width, pass.height);
+            
+            // first writers overwriting every pixel neither clear nor load
+            if (invalidate && !pass.invalidates.empty())
+                Invalidate(pass, pass.invalidates);
+            
+            // first writers clear; each color attachment may have its own clear color
+            bool colorCleared = false;
+            for (unsigned c=0; c<pass.clears.size(); c++)
+            {
+                const SResource& res = _resources[pass.clears[c]];
+                
+                if (isDepthFormat(res.format))
+                {
+                    CGLState::SetDepthMask(true); // glClear honors the write masks left by the previous pass
+                    if (res.format == TF_DEPTH24S8)
+                    {
+                        CGLState::SetStencilMask(0xff);
+                        glClearStencil(0);
+                        glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                    }
+                    else
+                        glClear(GL_DEPTH_BUFFER_BIT);
+                    continue;
+                }
+                
+                unsigned slot = 0;
+                for (unsigned w=0; w<pass.writes.size() && pass.writes[w] != pass.clears[c]; w++)
+                    if (!isDepthFormat(_resources[pass.writes[w]].format)) slot++;
+                
+                if (pass.numColor > 1)
+                    glDrawBuffer(GLenum(GL_COLOR_ATTACHMENT0 + slot));
+                CGLState::SetColorMask(true, true, true, true);
+                glClearColor(res.clearColor.r, res.clearColor.g, res.clearColor.b, res.clearColor.a);
+                glClear(GL_COLOR_BUFFER_BIT);
+                colorCleared = true;
+            }
+            
+            if (colorCleared && pass.numColor > 1)
+            {
+                GLenum buffs[16];
+                for (unsigned i=0; i<pass.numColor; i++)
+                    buffs[i] = GLenum(GL_COLOR_ATTACHMENT0 + i);
+                glDrawBuffers(pass.numColor, buffs);
+            }
+            PrintGLError("clearing render graph pass targets");
+        }
+        
+        pass.execute(pass.userData);
+        
+        // last uses; aliasing is off when resources are inspected after the frame
+        if (invalidate && _compiledAliasing && !pass.discards.empty())
+            Invalidate(pass, pass.discards);
+    }
+}
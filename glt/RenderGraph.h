@@ -0,0 +1,170 @@
+//
+//  RenderGraph.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__RenderGraph__
+#define __glt__RenderGraph__
+
+#include <vector>
+#include <string>
+
+#include "Texture.h"
+#include "vec4.hpp"
+
+/// Frame made of passes which declare the render-target resources they read and write.
+/// From the declarations the graph derives the execution order (culling passes nobody needs),
+/// clears (the first writer of a resource clears it), the framebuffer and glDrawBuffers of each
+/// pass, and the lifetime of every resource. Resources with disjoint lifetimes share (alias)
+/// textures of a pool. Resources have the size given by Resize() divided by their size divisor;
+/// the viewport of a pass is the size of its attachments, which must all be the same.
+/// \note Resources with a depth format are bound as the depth attachment of passes that read
+/// (depth test) or write them. Passes that only read them may also sample them, with depth
+/// writes disabled (read-only attachment); Sample() uses them without attaching them.
+/// TF_DEPTH24S8 is bound as depth+stencil and its stencil is cleared to 0 together with the depth.
+/// \note Persistent resources (history of temporal effects) keep their contents between frames.
+/// \note Resources are invalidated after their last use (store action "discard") and first writers
+/// covering every pixel (WriteAll) invalidate instead of clearing (load action "don't care"), so that
+/// tile-based and bandwidth-limited GPUs neither load nor write back contents nobody needs.
+class CRenderGraph
+{
+public:
+    /// Called to draw a pass; framebuffer, viewport and clears are already set up
+    typedef void (*FPassExecute)(void* userData);
+    
+    enum { INVALID = 0xffffffff };
+    
+    CRenderGraph();
+    ~CRenderGraph();
+    
+    /// Declares a full-size texture resource
+    /// \param clearColor Color the first writer clears it to (ignored for depth formats which clear to 1)
+    /// \return Resource handle
+    unsigned AddResource(const char* name, ETextureFormat format, const glm::vec4& clearColor, ESamplerState sampler = SS_POINT_CLAMP);
+    /// Declares a pass; passes are executed in declaration order unless culled, except that a pass
+    /// reading a resource declared before all of its writers is moved after the first writer
+    /// \return Pass handle
+    unsigned AddPass(const char* name, FPassExecute execute, void* userData);
+    /// Pass samples the resource (depth test for depth resources)
+    void Read(unsigned pass, unsigned resource);
+    /// Pass only samples the resource - depth resources are not attached (e.g. for passes rendering to the screen)
+    void Sample(unsigned pass, unsigned resource);
+    /// Pass renders into the resource; color resources become COLOR0, COLOR1... in the order of Write calls
+    void Write(unsigned pass, unsigned resource);
+    /// Write() by a pass overwriting every pixel (e.g. a fullscreen quad) - the first writer doesn't clear
+    void WriteAll(unsigned pass, unsigned resource);
+    /// Pass renders to the screen - it is never culled and everything it depends on is kept
+    void SetOutput(unsigned pass);
+    /// Disabled passes are culled; used to switch between alternative passes producing the same resources
+    void SetEnabled(unsigned pass, bool enable);
+    
+    /// Size of all resources; textures are recreated on the next Execute
+    void Resize(unsigned width, unsigned height);
+    /// Makes the resource 1/divisor of the Resize() size in both dimensions (1 = full size)
+    void SetSizeDivisor(unsigned resource, unsigned divisor);
+    /// Makes a color resource keep its contents between frames: it gets a texture of its own, is cleared
+    /// only when the texture is (re)created and passes reading it before it is written see the previous frame.
+    /// Passes writing it are kept even though nothing reads the result in the same frame.
+    void SetPersistent(unsigned resource);
+    /// Allows resources with disjoint lifetimes to share a texture (also needs r_rtAliasing) and to be
+    /// invalidated after their last use (also needs r_rtInvalidate); disable to inspect any resource after Execute
+    void SetAliasing(bool enable){ _aliasing = enable; };
+    
+    /// Executes all passes (compiles the graph first if anything changed).
+    /// Nothing is executed while the graph fails to compile.
+    void Execute();
+    
+    /// Texture of the resource (CTexture::None() before the first Execute)
+    const CTexture& GetTexture(unsigned resource)const;
+    /// Peak render-target memory of the compiled graph, with and without aliasing
+    unsigned GetAllocatedBytes()const{ return _allocatedBytes; };
+    unsigned GetUnaliasedBytes()const{ return _unaliasedBytes; };
+
+private:
+    struct SResource
+    {
+        std::string name;
+        ETextureFormat format;
+        glm::vec4 clearColor;
+        ESamplerState sampler;
+        unsigned sizeDivisor;
+        bool persistent;
+        
+        // compiled
+        unsigned physical; // index into _physical
+        CTexture* texture; // wraps the physical texture with this resource's sampler state
+        unsigned firstUse, lastUse; // positions in _order
+    };
+    struct SPass
+    {
+        std::string name;
+        FPassExecute execute;
+        void* userData;
+        std::vector<unsigned> reads;
+        std::vector<unsigned> samples; // reads which are never attached
+        std::vector<unsigned> writes;
+        std::vector<unsigned> writesAll; // writes covering every pixel
+        bool output;
+        bool enabled;
+        
+        // compiled
+        unsigned fbo;
+        unsigned numColor; // color attachments
+        unsigned depth; // depth resource or INVALID
+        unsigned width, height; // of the attachments
+        std::vector<unsigned> clears; // resources cleared before executing (first writes)
+        std::vector<unsigned> invalidates; // first writes by WriteAll - invalidated instead of cleared
+        std::vector<unsigned> discards; // resources invalidated after executing (last uses)
+    };
+    struct SPhysical
+    {
+        unsigned glTex;
+        ETextureFormat format;
+        ESamplerState sampler;
+        unsigned width, height;
+        unsigned freeAfter; // position in _order after which it can be reused
+    };
+    
+    bool Compile();
+    void Release();
+    /// Requests a compile on the next Execute (also retrying a failed one)
+    void MarkDirty();
+    typedef std::vector<std::vector<unsigned> > PassEdges; // per pass, passes it has to run after
+    /// \param outNeeds Writers of the contents each enabled pass reads or writes over (read-after-write)
+    /// \param outAfter Readers of previous contents each enabled pass overwrites (ordering only, write-after-read)
+    void BuildDependencies(PassEdges& outNeeds, PassEdges& outAfter)const;
+    /// Marks passes whose results reach an output pass
+    void CullPasses(const PassEdges& needs, std::vector<bool>& outAlive)const;
+    /// Topologically sorts the alive passes into _order, keeping declaration order where possible
+    /// \return False if the passes depend on each other in a cycle
+    bool SortPasses(const PassEdges& needs, const PassEdges& after, const std::vector<bool>& alive);
+    /// Size of the resource's texture
+    unsigned ResourceWidth(const SResource& res)const;
+    unsigned ResourceHeight(const SResource& res)const;
+    unsigned AllocatePhysical(const SResource& res, unsigned firstUse, bool aliasing);
+    bool CreatePassFramebuffer(SPass& pass);
+    /// Clears the texture of a color resource to its clear color outside of any pass
+    void ClearResource(const SResource& res);
+    /// Whether the resource is attached to the pass framebuffer
+    bool IsAttached(const SPass& pass, unsigned resource)const;
+    /// Invalidates resources of the pass - attached ones through its framebuffer, others as textures
+    void Invalidate(const SPass& pass, const std::vector<unsigned>& resources)const;
+    
+    std::vector<SResource> _resources;
+    std::vector<SPass> _passes;
+    std::vector<SPhysical> _physical;
+    std::vector<unsigned> _order; // compiled pass execution order
+    
+    unsigned _width, _height;
+    bool _aliasing;
+    bool _compiledAliasing;
+    bool _dirty; // not compiled
+    bool _compileFailed; // the last compile failed and nothing has changed since
+    unsigned _allocatedBytes;
+    unsigned _unaliasedBytes;
+};
+
+#endif /* defined(__glt__RenderGraph__) */
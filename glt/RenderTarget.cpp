@@ -14,6 +14,8 @@
 #include "glstuff.h"
 #include "Shared.h"
 #include "Engine.h"
+#include "GPUMemory.h"
+#include "GLState.h"
 
 #include <stdio.h>
 
@@ -22,7 +24,8 @@
 #endif
 
 CRenderTarget::CRenderTarget()
-: _frameBuffer(0), _valid(true/*empty buffer is screen - so valid*/), _viewportX(0), _viewportY(0), _viewportWid(0), _viewportHei(0)
+: _frameBuffer(0), _valid(true/*empty buffer is screen - so valid*/), _viewportX(0), _viewportY(0), _viewportWid(0), _viewportHei(0), _gpuBytes(0),
+  _usedAttachments(ATT_NONE), _nextReadback(0), _lastTicket(0), _readbackBytes(0)
 {
 }
 
@@ -30,29 +33,47 @@ CRenderTarget::~CRenderTarget()
 {
     STD_CONST_FOREACH(SRTDataArray, _colorAttachments, it)
     {
-        if (it->glTex) glDeleteTextures(1, &it->glTex);
+        if (it->glTex)
+        {
+            CTexture::ForgetGLTexture(it->glTex);
+            glDeleteTextures(1, &it->glTex);
+        }
         if (it->glRenderbuffer) glDeleteRenderbuffers(1, &it->glRenderbuffer);
         if (it->texture) delete it->texture;
     }
     
-    if (_depthAttachment.glTex) glDeleteTextures(1, &_depthAttachment.glTex);
+    if (_depthAttachment.glTex)
+    {
+        CTexture::ForgetGLTexture(_depthAttachment.glTex);
+        glDeleteTextures(1, &_depthAttachment.glTex);
+    }
     if (_depthAttachment.glRenderbuffer) glDeleteRenderbuffers(1, &_depthAttachment.glRenderbuffer);
     if (_depthAttachment.texture) delete _depthAttachment.texture;
+    if (_stencilAttachment.glRenderbuffer) glDeleteRenderbuffers(1, &_stencilAttachment.glRenderbuffer);
     
-    if (_frameBuffer) glDeleteFramebuffers(1, &_frameBuffer);
+    if (_frameBuffer)
+    {
+        CGLState::ForgetFramebuffer(_frameBuffer);
+        glDeleteFramebuffers(1, &_frameBuffer);
+    }
+    
+    // no GL work or accounting left for the screen (destroyed statically) once its ring has been released
+    ReleaseReadbackBuffers();
+    if (_gpuBytes)
+        CGPUMemory::Inst()->Freed(GPUMEM_RENDERTARGET, _gpuBytes);
 }
 
 void CRenderTarget::SetColorMask(bool red, bool green, bool blue, bool alpha)const
 {
-    glColorMask(red?GL_TRUE:GL_FALSE, green?GL_TRUE:GL_FALSE, blue?GL_TRUE:GL_FALSE, alpha?GL_TRUE:GL_FALSE);
+    CGLState::SetColorMask(red, green, blue, alpha);
 }
 void CRenderTarget::SetDepthMask(bool enable)const
 {
-    glDepthMask(enable?GL_TRUE:GL_FALSE);
+    CGLState::SetDepthMask(enable);
 }
 void CRenderTarget::SetStencilMask(bool enable)const
 {
-    glStencilMask(enable?GL_TRUE:GL_FALSE);
+    CGLState::SetStencilMask(enable?GL_TRUE:GL_FALSE);
 }
 bool CRenderTarget::SetClearColor(unsigned colorAttachmentIndex, const glm::vec4& color)
 {
@@ -66,6 +87,27 @@ bool CRenderTarget::SetClearColor(unsigned colorAttachmentIndex, const glm::vec4
     return true;
 }
 
+bool CRenderTarget::SetColorSamplerState(unsigned colorAttachmentIndex, ESamplerState ss)
+{
+    if (colorAttachmentIndex >= _colorAttachments.size() || !_colorAttachments[colorAttachmentIndex].texture)
+    {
+        printf("No color RT texture for color attachment index %u\n", colorAttachmentIndex);
+        return false;
+    }
+    
+    SRTData& att = _colorAttachments[colorAttachmentIndex];
+    att.texture->SetSamplerState(ss);
+    
+    // texture object filtering is used when sampler objects are not available
+    GLint filter = ss == SS_LINEAR_CLAMP ? GL_LINEAR : GL_NEAREST;
+    CTexture::BindForEdit(GL_TEXTURE_2D, att.glTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    PrintGLError("setting RT color min/mag filter");
+    
+    return true;
+}
+
 void CRenderTarget::CreateFramebufferInNotExists()
 {
     if (!_frameBuffer)
@@ -74,7 +116,7 @@ void CRenderTarget::CreateFramebufferInNotExists()
         PrintGLError("generating framebuffer");
     }
     
-    glBindFramebuffer(GL_FRAMEBUFFER, _frameBuffer);
+    CGLState::BindFramebuffer(_frameBuffer);
     PrintGLError("binding framebuffer");
 }
 
@@ -119,7 +161,7 @@ bool CRenderTarget::CheckFramebufferValidity()
     }
     
     // set to onscreen renderbuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CGLState::BindFramebuffer(0);
     
     return _valid;
 }
@@ -142,13 +184,14 @@ bool CRenderTarget::AddColorTexture(int width, int height, ETextureFormat format
     rtData.wid = width;
     rtData.hei = height;
     rtData.format = format;
+    rtData.mips = genMips;
     
     CreateFramebufferInNotExists();
     
     // texture
     glGenTextures(1, &rtData.glTex);
     PrintGLError("generating RT color texture");
-    glBindTexture(GL_TEXTURE_2D, rtData.glTex);
+    CTexture::BindForEdit(GL_TEXTURE_2D, rtData.glTex);
     PrintGLError("binding RT color texture");
     
     // set filtering - needed
@@ -166,11 +209,12 @@ bool CRenderTarget::AddColorTexture(int width, int height, ETextureFormat format
     if (glGetError() != GL_NO_ERROR)
     {
         printf("Error creating RT color texture. Size: [%d,%d], Format: %d\n", width, height, format);
+        CTexture::ForgetGLTexture(rtData.glTex);
         glDeleteTextures(1, &rtData.glTex);
         rtData.glTex = 0;
         
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        CGLState::BindFramebuffer(0);
         return false;
     }
     
@@ -186,20 +230,23 @@ bool CRenderTarget::AddColorTexture(int width, int height, ETextureFormat format
     
     if (!CheckFramebufferValidity())
     {
+        CTexture::ForgetGLTexture(rtData.glTex);
         glDeleteTextures(1, &rtData.glTex);
         rtData.glTex = 0;
         
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        CGLState::BindFramebuffer(0);
         return false;
     }
     
     rtData.texture = new CTexture("rtcolor", rtData.glTex, rtData.wid, rtData.hei, true);
+    rtData.texture->SetSamplerState(SS_POINT_CLAMP);
+    AccountAttachment(format, width, height, genMips);
     
     _colorAttachments.push_back(rtData);
     
     // set to onscreen renderbuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CGLState::BindFramebuffer(0);
     
     return true;
 }
@@ -227,7 +274,7 @@ bool CRenderTarget::AddDepthStencilTexture(int width, int height, ETextureFormat
     // texture
     glGenTextures(1, &_depthAttachment.glTex);
     PrintGLError("generating RT color texture");
-    glBindTexture(GL_TEXTURE_2D, _depthAttachment.glTex);
+    CTexture::BindForEdit(GL_TEXTURE_2D, _depthAttachment.glTex);
     PrintGLError("binding RT color texture");
     
     // set filtering
@@ -257,11 +304,12 @@ bool CRenderTarget::AddDepthStencilTexture(int width, int height, ETextureFormat
     if (glGetError() != GL_NO_ERROR)
     {
         printf("Error creating RT depth texture. Size: [%d,%d], Format: %d", width, height, format);
+        CTexture::ForgetGLTexture(_depthAttachment.glTex);
         glDeleteTextures(1, &_depthAttachment.glTex);
         _depthAttachment.glTex = 0;
         
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        CGLState::BindFramebuffer(0);
         return false;
     }
     
@@ -271,19 +319,92 @@ bool CRenderTarget::AddDepthStencilTexture(int width, int height, ETextureFormat
     
     if (!CheckFramebufferValidity())
     {
+        CTexture::ForgetGLTexture(_depthAttachment.glTex);
         glDeleteTextures(1, &_depthAttachment.glTex);
         _depthAttachment.glTex = 0;
         
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        CGLState::BindFramebuffer(0);
         return false;
     }
     
     _depthAttachment.texture = new CTexture("rtdepth", _depthAttachment.glTex, _depthAttachment.wid, _depthAttachment.hei, true);
+    AccountAttachment(format, width, height);
     
     return true;
 }
 
+bool CRenderTarget::ResizeAttachment(SRTData& att, int width, int height)
+{
+    if (att.glTex)
+    {
+        const SGLTextureFormatInfo& fi = CTexture::GLFormat(att.format);
+        
+        CTexture::BindForEdit(GL_TEXTURE_2D, att.glTex);
+        glGetError();
+        glTexImage2D(GL_TEXTURE_2D, 0, fi.internalFormat, width, height, 0, fi.format, fi.type, 0);
+        if (glGetError() != GL_NO_ERROR)
+        {
+            printf("Error resizing RT texture. Size: [%d,%d], Format: %d\n", width, height, att.format);
+            return false;
+        }
+        if (att.mips)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            PrintGLError("setting RT color mipmap generation");
+        }
+        
+        if (att.texture) att.texture->SetSize(width, height);
+    }
+    else if (att.glRenderbuffer)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, att.glRenderbuffer);
+        glGetError();
+        glRenderbufferStorage(GL_RENDERBUFFER, CTexture::GLFormat(att.format).internalFormat, width, height);
+        if (glGetError() != GL_NO_ERROR)
+        {
+            printf("Error resizing RT renderbuffer. Size: [%d,%d], Format: %d\n", width, height, att.format);
+            return false;
+        }
+    }
+    else
+        return true; // not used
+    
+    att.wid = width;
+    att.hei = height;
+    AccountAttachment(att.format, width, height, att.mips);
+    return true;
+}
+
+bool CRenderTarget::Resize(int width, int height)
+{
+    if (!_frameBuffer) return true; // screen follows the window
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_RENDERTARGET, _gpuBytes);
+    _gpuBytes = 0;
+    
+    bool ok = true;
+    STD_FOREACH(SRTDataArray, _colorAttachments, it)
+        ok = ResizeAttachment(*it, width, height) && ok;
+    ok = ResizeAttachment(_depthAttachment, width, height) && ok;
+    ok = ResizeAttachment(_stencilAttachment, width, height) && ok;
+    
+    _viewportX = _viewportY = 0;
+    _viewportWid = width;
+    _viewportHei = height;
+    
+    return CheckFramebufferValidity() && ok;
+}
+
+void CRenderTarget::AccountAttachment(ETextureFormat format, int width, int height, bool mips)
+{
+    unsigned bytes = CTexture::MipSize(format, width, height);
+    if (mips) bytes = bytes * 4 / 3;
+    
+    _gpuBytes += bytes;
+    CGPUMemory::Inst()->Allocated(GPUMEM_RENDERTARGET, bytes);
+}
+
 bool CRenderTarget::AddRenderbuffer(unsigned& outRenderbuffer, unsigned attachment/*GLenum*/, unsigned internalformat/*GLenum*/, int width, int height)
 {
     glGenRenderbuffers(1, &outRenderbuffer);
@@ -316,7 +437,7 @@ bool CRenderTarget::AddRenderbuffer(unsigned& outRenderbuffer, unsigned attachme
         outRenderbuffer = 0;
         
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        CGLState::BindFramebuffer(0);
         return false;
     }
     
@@ -341,10 +462,11 @@ bool CRenderTarget::AddColorRenderbuffer(int width, int height, ETextureFormat f
     if (!AddRenderbuffer(rtData.glRenderbuffer, GLenum(GL_COLOR_ATTACHMENT0 + _colorAttachments.size()), CTexture::GLFormat(format).internalFormat, width, height))
         return false;
     
+    AccountAttachment(format, width, height);
     _colorAttachments.push_back(rtData);
     
     // set to onscreen renderbuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CGLState::BindFramebuffer(0);
     
     return true;
 }
@@ -357,12 +479,23 @@ bool CRenderTarget::AddDepthRenderbuffer(int width, int height, ETextureFormat f
         return false;
     }
     
+    if (!_viewportWid || !_viewportHei)
+    {
+        _viewportWid = width;
+        _viewportHei = height;
+    }
+    
+    _depthAttachment.wid = width;
+    _depthAttachment.hei = height;
+    _depthAttachment.format = format;
+    
     CreateFramebufferInNotExists();
     
     bool ret = AddRenderbuffer(_depthAttachment.glRenderbuffer, GL_DEPTH_ATTACHMENT, CTexture::GLFormat(format).internalFormat, width, height);
+    if (ret) AccountAttachment(format, width, height);
     
     // set to onscreen renderbuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CGLState::BindFramebuffer(0);
     
     return ret;
 }
@@ -375,19 +508,24 @@ bool CRenderTarget::AddStencilRenderbuffer(int width, int height, ETextureFormat
         return false;
     }
     
+    _stencilAttachment.wid = width;
+    _stencilAttachment.hei = height;
+    _stencilAttachment.format = format;
+    
     CreateFramebufferInNotExists();
     
-    bool ret = AddRenderbuffer(_depthAttachment.glRenderbuffer, GL_STENCIL_ATTACHMENT, CTexture::GLFormat(format).internalFormat, width, height);
+    bool ret = AddRenderbuffer(_stencilAttachment.glRenderbuffer, GL_STENCIL_ATTACHMENT, CTexture::GLFormat(format).internalFormat, width, height);
+    if (ret) AccountAttachment(format, width, height);
     
     // set to onscreen renderbuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CGLState::BindFramebuffer(0);
     
     return ret;
 }
 
 static bool ReadPixels(unsigned framebuffer, ETextureFormat fmt, int x, int y, int width, int height, GLenum readbufferMode, char* inoutData)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    CGLState::BindFramebuffer(framebuffer);
     PrintGLError("binding RT framebuffer");
     glReadBuffer(readbufferMode);
     PrintGLError("trying to read RT color renderbuffer attachment");
@@ -436,25 +574,255 @@ bool CRenderTarget::ReadStencilPixels(int x, int y, int width, int height, EText
     return ReadPixels(_frameBuffer, _stencilAttachment.format, x, y, width, height, GL_STENCIL_ATTACHMENT, inoutData);
 }
 
+unsigned CRenderTarget::StartReadback(unsigned readBuffer, unsigned format, unsigned type, unsigned bytesPerPixel, int x, int y, int width, int height)const
+{
+    if (!CEngine::Inst()->GetRendererCapabilities().pixelBufferObject)
+    {
+        printf("Asynchronous RT readback needs pixel buffer objects\n");
+        return 0;
+    }
+    
+    // the next free buffer of the ring
+    SReadback* rb = NULL;
+    for (unsigned i=0; i<RT_READBACK_RING_SIZE && !rb; i++)
+    {
+        unsigned slot = (_nextReadback + i) % RT_READBACK_RING_SIZE;
+        if (!_readbacks[slot].ticket)
+        {
+            rb = &_readbacks[slot];
+            _nextReadback = (slot + 1) % RT_READBACK_RING_SIZE;
+        }
+    }
+    if (!rb)
+    {
+        printf("All %u RT readback buffers are in use - release finished readbacks\n", RT_READBACK_RING_SIZE);
+        return 0;
+    }
+    
+    unsigned bytes = width*height*bytesPerPixel;
+    if (!rb->pbo)
+    {
+        glGenBuffers(1, &rb->pbo);
+        PrintGLError("generating RT readback buffer");
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    if (rb->capacity < bytes)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        PrintGLError("allocating RT readback buffer");
+        
+        CGPUMemory::Inst()->Freed(GPUMEM_RENDERTARGET, rb->capacity);
+        CGPUMemory::Inst()->Allocated(GPUMEM_RENDERTARGET, bytes);
+        _readbackBytes += bytes - rb->capacity;
+        rb->capacity = bytes;
+    }
+    
+    CGLState::BindFramebuffer(_frameBuffer);
+    PrintGLError("binding RT framebuffer");
+    if (readBuffer) glReadBuffer(readBuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1); // tightly packed rows
+    glReadPixels(x, y, width, height, format, type, 0); // offset into the bound pack buffer
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    PrintGLError("starting RT readback");
+    
+    if (CEngine::Inst()->GetRendererCapabilities().fenceSync)
+        rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    
+    rb->bytes = bytes;
+    if (!++_lastTicket) ++_lastTicket; // 0 is not a ticket
+    rb->ticket = _lastTicket;
+    return rb->ticket;
+}
+
+CRenderTarget::SReadback* CRenderTarget::FindReadback(unsigned ticket)const
+{
+    if (!ticket) return NULL;
+    
+    for (unsigned i=0; i<RT_READBACK_RING_SIZE; i++)
+        if (_readbacks[i].ticket == ticket)
+            return &_readbacks[i];
+    
+    return NULL;
+}
+
+unsigned CRenderTarget::ReadColorPixelsAsync(unsigned colorAttachmentIndex, int x, int y, int width, int height)const
+{
+    if (!_frameBuffer)
+        return StartReadback(GL_BACK, GL_RGBA, GL_UNSIGNED_BYTE, 4, x, y, width, height);
+    
+    if (colorAttachmentIndex >= _colorAttachments.size())
+    {
+        printf("No color RT attachment for color attachment index %u\n", colorAttachmentIndex);
+        return 0;
+    }
+    
+    ETextureFormat format = _colorAttachments[colorAttachmentIndex].format;
+    const SGLTextureFormatInfo& fi = CTexture::GLFormat(format);
+    return StartReadback(GLenum(GL_COLOR_ATTACHMENT0 + colorAttachmentIndex), fi.format, fi.type, CTexture::MipSize(format, 1, 1), x, y, width, height);
+}
+
+unsigned CRenderTarget::ReadDepthPixelsAsync(int x, int y, int width, int height)const
+{
+    if (_frameBuffer && !_depthAttachment.glTex && !_depthAttachment.glRenderbuffer)
+    {
+        printf("No depth RT attachment\n");
+        return 0;
+    }
+    
+    return StartReadback(0, GL_DEPTH_COMPONENT, GL_FLOAT, 4, x, y, width, height);
+}
+
+unsigned CRenderTarget::ReadStencilPixelsAsync(int x, int y, int width, int height)const
+{
+    if (_frameBuffer && !_stencilAttachment.glRenderbuffer && _depthAttachment.format != TF_DEPTH24S8)
+    {
+        printf("No stencil RT attachment\n");
+        return 0;
+    }
+    
+    return StartReadback(0, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, 1, x, y, width, height);
+}
+
+bool CRenderTarget::IsReadbackReady(unsigned ticket)const
+{
+    SReadback* rb = FindReadback(ticket);
+    if (!rb) return false;
+    if (!rb->fence) return true;
+    
+    GLenum status = glClientWaitSync((GLsync)rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    
+    glDeleteSync((GLsync)rb->fence);
+    rb->fence = NULL;
+    return true;
+}
+
+const void* CRenderTarget::MapReadback(unsigned ticket, unsigned* outBytes)const
+{
+    SReadback* rb = FindReadback(ticket);
+    if (!rb) return NULL;
+    
+    if (!rb->data)
+    {
+        // mapping waits for the copy if needed
+        if (rb->fence)
+        {
+            glDeleteSync((GLsync)rb->fence);
+            rb->fence = NULL;
+        }
+        
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+        rb->data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        PrintGLError("mapping RT readback buffer");
+    }
+    
+    if (outBytes) *outBytes = rb->data ? rb->bytes : 0;
+    return rb->data;
+}
+
+void CRenderTarget::ReleaseReadback(unsigned ticket)const
+{
+    SReadback* rb = FindReadback(ticket);
+    if (!rb) return;
+    
+    if (rb->data)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        rb->data = NULL;
+    }
+    if (rb->fence)
+    {
+        glDeleteSync((GLsync)rb->fence);
+        rb->fence = NULL;
+    }
+    rb->ticket = 0;
+}
+
+void CRenderTarget::ReleaseReadbackBuffers()const
+{
+    for (unsigned i=0; i<RT_READBACK_RING_SIZE; i++)
+    {
+        SReadback& rb = _readbacks[i];
+        if (!rb.pbo) continue;
+        
+        ReleaseReadback(rb.ticket);
+        glDeleteBuffers(1, &rb.pbo);
+        rb = SReadback();
+    }
+    
+    if (_readbackBytes)
+    {
+        CGPUMemory::Inst()->Freed(GPUMEM_RENDERTARGET, _readbackBytes);
+        _readbackBytes = 0;
+    }
+}
+
 void CRenderTarget::SetViewport(int x, int y, int wid, int hei)
 {
     _viewportX = x; _viewportY = y; _viewportWid = wid; _viewportHei = hei;
 }
 
-void CRenderTarget::Use(unsigned enabledAttachments, unsigned clear)const
+void CRenderTarget::Invalidate(unsigned enabledAttachments, unsigned buffers)const
+{
+    if (!CEngine::Inst()->GetRendererCapabilities().invalidateSubdata)
+        return;
+    
+    GLenum atts[16]; GLsizei num = 0;
+    if (!_frameBuffer)
+    {
+        // default framebuffer names the buffers themselves
+        if (buffers & CLEAR_COLOR) atts[num++] = GL_COLOR;
+        if (buffers & CLEAR_DEPTH) atts[num++] = GL_DEPTH;
+        if (buffers & CLEAR_STENCIL) atts[num++] = GL_STENCIL;
+    }
+    else
+    {
+        if (buffers & CLEAR_COLOR)
+        {
+            for (unsigned i=0; i<8 && i<_colorAttachments.size(); i++)
+                if (enabledAttachments & (ATT_COLOR0<<i))
+                    atts[num++] = GLenum(GL_COLOR_ATTACHMENT0 + i);
+        }
+        if ((buffers & CLEAR_DEPTH) && _depthAttachment.format != TF_NONE)
+            atts[num++] = GL_DEPTH_ATTACHMENT;
+        if ((buffers & CLEAR_STENCIL) && (_stencilAttachment.format != TF_NONE || _depthAttachment.format == TF_DEPTH24S8))
+            atts[num++] = GL_STENCIL_ATTACHMENT;
+    }
+    
+    if (num)
+    {
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, num, atts);
+        PrintGLError("invalidating RT buffers");
+    }
+}
+
+void CRenderTarget::Discard(unsigned buffers)const
+{
+    CGLState::BindFramebuffer(_frameBuffer);
+    Invalidate(_usedAttachments, buffers);
+}
+
+void CRenderTarget::Use(unsigned enabledAttachments, unsigned clear, unsigned dontCare)const
 {
+    _usedAttachments = enabledAttachments;
+    
     if (!_frameBuffer)
     {
         // set to onscreen renderbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, CEngine::Inst()->GetScreenSize().width, CEngine::Inst()->GetScreenSize().height);
+        CGLState::BindFramebuffer(0);
+        CGLState::SetViewport(0, 0, CEngine::Inst()->GetScreenSize().width, CEngine::Inst()->GetScreenSize().height);
     }
     else
     {
         // bind framebuffer and set the viewport
-        glBindFramebuffer(GL_FRAMEBUFFER, _frameBuffer);
+        CGLState::BindFramebuffer(_frameBuffer);
         PrintGLError("binding RT framebuffer");
-        glViewport(0, 0, _viewportWid, _viewportHei);
+        CGLState::SetViewport(0, 0, _viewportWid, _viewportHei);
         PrintGLError("setting RT viewport");
         
         // construct the list of enabled attachments
@@ -481,6 +849,11 @@ void CRenderTarget::Use(unsigned enabledAttachments, unsigned clear)const
         glDrawBuffers(idx, buffs);
     }
     
+    // old contents the pass doesn't need are dropped instead of cleared
+    dontCare &= ~clear;
+    if (dontCare)
+        Invalidate(enabledAttachments, dontCare);
+    
     // clear buffers
     GLenum glclear = 0;
     if (clear & CLEAR_COLOR)
@@ -537,24 +910,3 @@ const CTexture& CRenderTarget::GetDepthStencilTexture()const
     else
         return CTexture::None();
 }
-
-// TODO: discarding attachments & what about pc?
-/*
-void CRenderTarget::Discard(bool color, bool depth)
-{
-	if (!_bColorTexture) color = false;
-	if (!_bDepthTexture) depth = false;
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, _frameBuffer);
-	
-    GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_DEPTH_ATTACHMENT};
-     
-	if (color && depth)
-		glDiscardFramebufferEXT(GL_FRAMEBUFFER, 2, attachments);
-	else if (color)
-		glDiscardFramebufferEXT(GL_FRAMEBUFFER, 1, attachments);
-	else if (depth)
-		glDiscardFramebufferEXT(GL_FRAMEBUFFER, 1, &attachments[1]);
- 
-}*/
-
@@ -15,26 +15,40 @@
 #include "Texture.h"
 #include "vec4.hpp"
 
-#ifdef WIN32
-    #ifndef NAN
-        static const unsigned long __nan[2] = {0xffffffff, 0x7fffffff};
-        #define NAN (*(const float *) __nan)
-    #endif
+/// Pixel pack buffers per render target for asynchronous reading (readbacks in flight)
+#define RT_READBACK_RING_SIZE 4
+
+#ifdef WIN32
+    #ifndef NAN
+        static const unsigned long __nan[2] = {0xffffffff, 0x7fffffff};
+        #define NAN (*(const float *) __nan)
+    #endif
 #endif
 
 class CRenderTarget
 {
     struct SRTData
     {
-        SRTData():glTex(0), clearColor(NAN), texture(NULL), glRenderbuffer(0), wid(0), hei(0){};
+        SRTData():glTex(0), clearColor(NAN), texture(NULL), glRenderbuffer(0), wid(0), hei(0), format(TF_NONE), mips(false){};
         unsigned glTex; // renderable texture (or 0 if not assigned = is a renderbuffer)
         unsigned glRenderbuffer; // renderbuffer handle (or 0 if not assigned = is a framebuffer texture)
         unsigned wid, hei;
         ETextureFormat format;
+        bool mips;
         CTexture* texture;
         glm::vec4 clearColor;
     };
     typedef std::vector<SRTData> SRTDataArray;
+    struct SReadback
+    {
+        SReadback():pbo(0), capacity(0), bytes(0), fence(NULL), ticket(0), data(NULL){};
+        unsigned pbo; // pixel pack buffer
+        unsigned capacity; // of the buffer
+        unsigned bytes; // of the pending read
+        void* fence; // GLsync signaled when the copy finishes (NULL without GL_ARB_sync or when signaled)
+        unsigned ticket; // 0 = free
+        const void* data; // while mapped
+    };
     
 public:
     enum EAttachment
@@ -52,6 +66,7 @@ public:
         ATT_ALL = 0xffffffff
     };
     
+    /// Buffer kinds; also used as masks of the load (clear, don't care) and store (discard) actions of a pass
     enum EClearFlags
     {
         CLEAR_NONE,
@@ -72,14 +87,29 @@ public:
 	~CRenderTarget();
 	
     // - common tasks
+    // Load actions of a pass are given to Use: buffers in `clear` are cleared, buffers in `dontCare` are
+    // invalidated (the pass overwrites every pixel, so the old contents are neither cleared nor loaded),
+    // other buffers are loaded. The store action of buffers not needed after the pass is Discard.
+    // Invalidation needs GL_ARB_invalidate_subdata; without it, don't care buffers are simply not cleared.
     /// \param enabledAttachments bitmask made of EAttachment
-	void Use(unsigned enabledAttachments = ATT_COLOR0, unsigned clear = CLEAR_NONE)const;
+    /// \param clear, dontCare bitmasks made of EClearFlags
+	void Use(unsigned enabledAttachments = ATT_COLOR0, unsigned clear = CLEAR_NONE, unsigned dontCare = CLEAR_NONE)const;
+    /// Invalidates the contents of the buffers (of the attachments enabled by the last Use) after a pass
+    /// so that they are not written back to memory; call right after the pass
+    /// \param buffers bitmask made of EClearFlags
+    void Discard(unsigned buffers = CLEAR_ALL)const;
     bool IsValid()const{ return _valid; };
     void SetViewport(int x, int y, int wid, int hei);
     void SetColorMask(bool red, bool green, bool blue, bool alpha)const;
     void SetDepthMask(bool enable)const;
     void SetStencilMask(bool enable)const;
     bool SetClearColor(unsigned colorAttachmentIndex, const glm::vec4& color);
+    /// Filtering used when the color texture is sampled (SS_POINT_CLAMP by default)
+    bool SetColorSamplerState(unsigned colorAttachmentIndex, ESamplerState ss);
+    /// Re-specifies all attachments with a new size (contents are lost) and resets the viewport
+    bool Resize(int width, int height);
+    int GetWidth()const{ return _viewportWid; };
+    int GetHeight()const{ return _viewportHei; };
     
     // -- adding attachments
     /// Color texture can be then used as a normal texture; You can get the textury by calling GetColorTexture
@@ -92,13 +122,36 @@ public:
     bool AddStencilRenderbuffer(int width, int height, ETextureFormat format);
     
     // - reading pixels.
-    /// \note Blocks until pixels are copied! Better alternative for reading may be GL PBO (see http://stackoverflow.com/a/12159293/314437)
+    /// \note Blocks until pixels are copied! ReadColorPixelsAsync doesn't.
     bool ReadColorPixels(unsigned colorAttachmentIndex, int x, int y, int width, int height, ETextureFormat format, char* inoutData);
-	/// \note Blocks until pixels are copied! Better alternative for reading may be GL PBO (see http://stackoverflow.com/a/12159293/314437)
+	/// \note Blocks until pixels are copied! ReadDepthPixelsAsync doesn't.
     bool ReadDepthPixels(int x, int y, int width, int height, ETextureFormat format, char* inoutData);
-    /// \note Blocks until pixels are copied! Better alternative for reading may be GL PBO (see http://stackoverflow.com/a/12159293/314437)
+    /// \note Blocks until pixels are copied! ReadStencilPixelsAsync doesn't.
     bool ReadStencilPixels(int x, int y, int width, int height, ETextureFormat format, char* inoutData);
     
+    // - asynchronous reading (see http://stackoverflow.com/a/12159293/314437)
+    // glReadPixels goes into one of RT_READBACK_RING_SIZE pixel pack buffers and returns at once;
+    // the caller polls the ticket (a frame or more later) and maps the pixels when the copy is done.
+    // Works with the Screen() too (back buffer, RGBA8). Binds the framebuffer.
+    /// Starts reading pixels of a color attachment (texture or renderbuffer) in its format
+    /// \return Ticket for the functions below or 0 on error (e.g. all ring buffers are in use)
+    unsigned ReadColorPixelsAsync(unsigned colorAttachmentIndex, int x, int y, int width, int height)const;
+    /// Starts reading depth as floats (window depth, 0-1)
+    unsigned ReadDepthPixelsAsync(int x, int y, int width, int height)const;
+    /// Starts reading stencil as bytes
+    unsigned ReadStencilPixelsAsync(int x, int y, int width, int height)const;
+    /// Whether the copy has finished so that MapReadback won't block; never blocks
+    /// \note Always true without GL_ARB_sync - mapping may block then
+    bool IsReadbackReady(unsigned ticket)const;
+    /// Pixels of the readback, rows bottom-up and tightly packed; blocks if the copy hasn't finished yet
+    /// \return NULL for an unknown ticket; valid until ReleaseReadback
+    const void* MapReadback(unsigned ticket, unsigned* outBytes = NULL)const;
+    /// Unmaps the pixels and frees the ring buffer for further readbacks
+    void ReleaseReadback(unsigned ticket)const;
+    /// Deletes the readback ring (pending readbacks are dropped); it is recreated by the next readback.
+    /// Must be called for Screen() before the GL context goes away, as it is destroyed after that.
+    void ReleaseReadbackBuffers()const;
+    
     // - getting textures
     /// Returns 0 if not available
 	const CTexture& GetColorTexture(unsigned colorAttachmentIndex)const;
@@ -109,6 +162,14 @@ private:
     void CreateFramebufferInNotExists();
     bool CheckFramebufferValidity();
     bool AddRenderbuffer(unsigned& outRenderbuffer, unsigned attachment, unsigned internalformat, int width, int height);
+    bool ResizeAttachment(SRTData& att, int width, int height);
+    /// Adds the attachment size to CGPUMemory
+    void AccountAttachment(ETextureFormat format, int width, int height, bool mips=false);
+    /// glReadPixels into a free buffer of the ring; readBuffer 0 for depth/stencil
+    unsigned StartReadback(unsigned readBuffer, unsigned format, unsigned type, unsigned bytesPerPixel, int x, int y, int width, int height)const;
+    SReadback* FindReadback(unsigned ticket)const;
+    /// glInvalidateFramebuffer of the buffers of the bound framebuffer
+    void Invalidate(unsigned enabledAttachments, unsigned buffers)const;
     
     bool _valid;
     unsigned _frameBuffer;
@@ -118,6 +179,14 @@ private:
     SRTData _stencilAttachment;
     
     int _viewportX, _viewportY, _viewportWid, _viewportHei;
+    unsigned _gpuBytes; // all attachments
+    mutable unsigned _usedAttachments; // by the last Use
+    
+    // readback ring; mutable so that the (const) Screen() can be read too
+    mutable SReadback _readbacks[RT_READBACK_RING_SIZE];
+    mutable unsigned _nextReadback;
+    mutable unsigned _lastTicket;
+    mutable unsigned _readbackBytes;
 };
 
 #endif /* defined(__glt__RenderTarget__) */
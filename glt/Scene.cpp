@@ -7,71 +7,144 @@
 //
 
 #include "Scene.h"
-#include "RenderTarget.h"
+#include "RenderGraph.h"
 #include "Shaders.h"
 #include "Engine.h"
 #include "Mesh.h"
 #include "CVar.h"
+#include "GPUMemory.h"
+#include "GLState.h"
+#include "Shared.h"
 
 #include "func_matrix.hpp"
 #include "transform.hpp"
 #include "glstuff.h"
 
 static CVar cvLightDebug("r_lightDebug", false, CVar::FLAG_GUI_TWEAKABLE);
+// clusters for forward shading: screen tiles of CLUSTER_TILE_SIZE pixels split into CLUSTER_SLICES depth slices
+#define CLUSTER_TILE_SIZE 64
+#define CLUSTER_SLICES 16
+
+static CVar cvNormalEncoding("r_normalEncoding", 0, CVar::FLAG_NONE, 0, IScene::_NE_NUM-1); // IScene::ENormalEncoding; startup only (e.g. glt +r_normalEncoding 2)
+static CVar cvHWDepth("r_hwDepth", true, CVar::FLAG_GUI_TWEAKABLE); // sample the z-buffer instead of rendering linear z into RT_DEPTH
+static CVar cvLightScissor("r_lightScissor", true, CVar::FLAG_GUI_TWEAKABLE); // scissor each light volume to its projected sphere
+static CVar cvLightStencil("r_lightStencil", false, CVar::FLAG_GUI_TWEAKABLE); // stencil-mark pixels inside each light volume before shading it (extra draw per light; not with r_hwDepth)
+static CVar cvLightDepthBounds("r_lightDepthBounds", true, CVar::FLAG_GUI_TWEAKABLE); // skip pixels outside the depth range of each light volume (GL_EXT_depth_bounds_test)
+static CVar cvLightStats("r_lightStats", true, CVar::FLAG_GUI_TWEAKABLE); // count pixels shaded by the lighting (occlusion queries, read a frame later)
+static CVar cvLightInstancing("r_lightInstancing", true, CVar::FLAG_GUI_TWEAKABLE); // light volumes in two instanced draws instead of a draw per light
+static CVar cvTiledLighting("r_tiledLighting", true, CVar::FLAG_GUI_TWEAKABLE); // one full-screen pass with per-tile light lists instead of a volume per light
 
 IScene::~IScene()
 {
-    if (_rt) delete _rt;
+    if (_graph) delete _graph;
+    if (_lightTiler) delete _lightTiler;
+    if (_lightClusters) delete _lightClusters;
+    if (_lightInstanceVBO)
+    {
+        glDeleteBuffers(1, &_lightInstanceVBO);
+        CGPUMemory::Inst()->Freed(GPUMEM_MESH, _lightInstanceBytes);
+    }
+    if (!_lightQueries.empty())
+        glDeleteQueries((GLsizei)_lightQueries.size(), &_lightQueries[0]);
 }
 
 bool IScene::Init()
 {
-    _rt = new CRenderTarget();
-    
-    _rt->AddDepthRenderbuffer(800, 600, TF_DEPTH32);
-//#ifdef WIN32
-//	_rt->AddColorTexture(800, 600, TF_RGB8); // 0: linear z
-//#else
-    _rt->AddColorTexture(800, 600, TF_RGBA16F); // 0: linear z
-//#endif
-	_rt->SetClearColor(RT_DEPTH, glm::vec4(0,0,0,1));
+    _graph = new CRenderGraph();
     
-    _rt->AddColorTexture(800, 600, TF_RGBA8); // 1: normal; specular texture
-    _rt->SetClearColor(RT_NORMAL, glm::vec4(0,0,0,0));
+    // declared in ERT order so that resource handles match; textures are created by the graph
+    // at the render size and shared where lifetimes don't overlap
+    _graph->AddResource("linear z", TF_RGBA16F, glm::vec4(0,0,0,1));
+    _graph->AddResource("normal; specular", GetNormalFormat(GetNormalEncoding()), glm::vec4(0,0,0,0));
+    _graph->AddResource("diffuse acc; specular acc", TF_RGBA8, glm::vec4(0,0,0,0));
+    // composited to the screen - bilinear so that a lower render size is upscaled smoothly
+    _graph->AddResource("final", TF_RGB8, glm::vec4(0,1,1,0), SS_LINEAR_CLAMP);
+    _graph->AddResource("post-process", TF_RGB8, glm::vec4(0,0,0,0));
+    _graph->AddResource("post-process2", TF_RGB8, glm::vec4(0,0,0,0), SS_LINEAR_CLAMP);
+    // with stencil when available for r_lightStencil
+    _graph->AddResource("z-buffer", CEngine::Inst()->GetRendererCapabilities().packedDepthStencil ? TF_DEPTH24S8 : TF_DEPTH32, glm::vec4(0,0,0,0));
+    _graph->AddResource("ssao normal; depth", TF_RGBA16F, glm::vec4(0,0,0,1));
+    _graph->AddResource("ssao temporal", TF_RGBA16F, glm::vec4(1,0,0,0));
+    // no accumulated frames (green) until written
+    _graph->AddResource("ssao history", TF_RGBA16F, glm::vec4(1,0,0,0));
+    _graph->SetPersistent(RT_SSAO_HISTORY);
     
-    _rt->AddColorTexture(800, 600, TF_RGBA8); // 2: diffuse light accum; specular accum
-    _rt->SetClearColor(RT_DIFFUSE_ACC, glm::vec4(0,0,0,0));
-    
-    _rt->AddColorTexture(800, 600, TF_RGB8); // 3: final scene
-    _rt->SetClearColor(RT_FINAL, glm::vec4(0,1,1,0));
-    
-    _rt->AddColorTexture(800, 600, TF_RGB8); // 4: post-process
-    _rt->SetClearColor(RT_POSTPROCESS, glm::vec4(0,0,0,0));
-    
-    _rt->AddColorTexture(800, 600, TF_RGB8); // 5: post-process2
-    _rt->SetClearColor(RT_POSTPROCESS2, glm::vec4(0,0,0,0));
+    const CEngine::SScreenSize& size = CEngine::Inst()->GetRenderSize();
+    _graph->Resize(size.width ? size.width : 800, size.height ? size.height : 600);
     
     // pre-load standard shaders
     CShaderDefines defines;
+    if (UsesHardwareDepth()) defines.Define("HW_DEPTH");
     CShaderManager::Inst()->GetProgram("point_light.glsl", &defines);
+    if (CEngine::Inst()->GetRendererCapabilities().instancing)
+    {
+        CShaderDefines instanced(defines);
+        instanced.Define("INSTANCED");
+        CShaderManager::Inst()->GetProgram("point_light.glsl", &instanced);
+    }
+    if (CEngine::Inst()->GetRendererCapabilities().floatTextures)
+    {
+        _lightTiler = new CLightTiler();
+        _lightClusters = new CLightTiler(CLUSTER_TILE_SIZE, CLUSTER_SLICES);
+        CShaderManager::Inst()->GetProgram("tiled_light.glsl", &defines);
+    }
     
     return true;
 }
 
-const CRenderTarget& IScene::GetRT()const
+void IScene::Resize(unsigned width, unsigned height)
 {
-    if (_rt)
-        return *_rt;
-    else
-        return CRenderTarget::Screen();
+    if (_graph) _graph->Resize(width, height);
 }
 
 const CTexture& IScene::GetRTTexture(IScene::ERT type)const
 {
-    if (type >= IScene::_RT_NUM)
+    if (type >= IScene::_RT_NUM || !_graph)
         return CTexture::None();
     
-    return _rt->GetColorTexture(type);
+    return _graph->GetTexture(type);
+}
+
+IScene::ENormalEncoding IScene::GetNormalEncoding()
+{
+    ENormalEncoding encoding = (ENormalEncoding)MinMax(cvNormalEncoding.GetInt(), 0, _NE_NUM-1);
+    
+    // two-channel encodings need the 10-bit target to be worth it
+    if (encoding != NE_XYZ && !CTexture::IsSupported(TF_RGB10A2))
+        return NE_XYZ;
+    
+    return encoding;
+}
+
+void IScene::DefineNormalEncoding(CShaderDefines& defines, ENormalEncoding encoding)
+{
+    defines.Define("NORMAL_ENCODING", (int)encoding);
+}
+
+ETextureFormat IScene::GetNormalFormat(ENormalEncoding encoding)
+{
+    return encoding == NE_XYZ ? TF_RGBA8 : TF_RGB10A2;
+}
+
+const char* IScene::GetNormalEncodingName(ENormalEncoding encoding)
+{
+    switch(encoding)
+    {
+        case NE_XYZ: return "xyz";
+        case NE_SPHEREMAP: return "spheremap";
+        case NE_OCTAHEDRAL: return "octahedral";
+        default: return "unknown";
+    }
+}
+
+bool IScene::UsesHardwareDepth()const
+{
+    return cvHWDepth;
+}
+
+const CTexture& IScene::GetDepthTexture()const
+{
+    return GetRTTexture(UsesHardwareDepth() ? RT_ZBUFFER : RT_DEPTH);
 }
 
 void IScene::SetCommonUniforms(CShaderProgram *prog, const glm::mat4& modelTransform)const
@@ -85,41 +158,294 @@ void IScene::SetCommonUniforms(CShaderProgram *prog, const glm::mat4& modelTrans
     prog->SetUniform("uIProj", glm::inverse(cam.GetProjection()));
     prog->SetUniform("uModelView", cam.GetView() * modelTransform);
     prog->SetUniform("uNearFar", glm::vec2(cam.GetNearPlane(), cam.GetFarPlane()));
-    const CEngine::SScreenSize& screenSize = CEngine::Inst()->GetScreenSize();
-    prog->SetUniform("uScreenSize", glm::vec2(screenSize.width, screenSize.height));
+    const CEngine::SScreenSize& renderSize = CEngine::Inst()->GetRenderSize();
+    prog->SetUniform("uScreenSize", glm::vec2(renderSize.width, renderSize.height));
     float tanHalfFov = tanf(glm::radians(cam.GetFieldOfView()/2.0f));
     prog->SetUniform("uTanFovAspect", glm::vec2(cam.GetViewportAspectRatio()*tanHalfFov, tanHalfFov));
 }
 
-void IScene::DrawLight(glm::vec3 lightPosW, glm::vec3 color, float range)const
+void IScene::DrawLight(glm::vec3 lightPosW, glm::vec3 color, float range)
 {
     const CFlyCamera& cam = CEngine::Inst()->GetCamera();
  
+    const CEngine::SRendererCaps& caps = CEngine::Inst()->GetRendererCapabilities();
+    glm::mat4 modelTransform = glm::scale(glm::translate(lightPosW), glm::vec3(range));
+    glm::vec3 lightPosV = glm::vec3(cam.GetView() * glm::vec4(lightPosW,1));
+    
+    // nearest and farthest view-space distance of the volume
+    float zNear = Max(-lightPosV.z - range, cam.GetNearPlane());
+    float zFar = Min(-lightPosV.z + range, cam.GetFarPlane());
+    if (zNear >= zFar) return; // behind the camera or beyond the far plane
+    
+    // screen rectangle of the sphere
+    glm::vec4 rect;
+    if (cvLightScissor && CLightTiler::ProjectSphere(lightPosV, range, cam.GetProjection(), cam.GetNearPlane(), rect))
+    {
+        if (rect.z < -1 || rect.x > 1 || rect.w < -1 || rect.y > 1) return; // outside of the screen
+        
+        const CEngine::SScreenSize& size = CEngine::Inst()->GetRenderSize();
+        int x0 = (int)floorf((MinMax(rect.x, -1.0f, 1.0f)*0.5f+0.5f) * size.width);
+        int y0 = (int)floorf((MinMax(rect.y, -1.0f, 1.0f)*0.5f+0.5f) * size.height);
+        int x1 = (int)ceilf((MinMax(rect.z, -1.0f, 1.0f)*0.5f+0.5f) * size.width);
+        int y1 = (int)ceilf((MinMax(rect.w, -1.0f, 1.0f)*0.5f+0.5f) * size.height);
+        CGLState::Enable(GL_SCISSOR_TEST);
+        glScissor(x0, y0, x1-x0, y1-y0);
+    }
+    
+    // z-buffer values outside of the volume's depth range can't be lit
+    bool depthBounds = cvLightDepthBounds && caps.depthBoundsTest;
+    if (depthBounds)
+    {
+        CGLState::Enable(GL_DEPTH_BOUNDS_TEST_EXT);
+        glDepthBoundsEXT(WindowDepth(cam.GetProjection(), zNear), WindowDepth(cam.GetProjection(), zFar));
+    }
+    
+    // mark pixels whose surface is inside the volume (z-fail): back faces failing the depth test INCR_WRAP,
+    // front faces failing it DECR_WRAP, so only surfaces in front of the back faces but behind the front
+    // faces keep a non-zero stencil. The stencil lives in the z-buffer, which the light shader samples as
+    // depth with r_hwDepth - writing it then would be a feedback loop, so hw depth shades without marking.
+    bool stencil = cvLightStencil && caps.packedDepthStencil && !UsesHardwareDepth();
+    if (stencil)
+    {
+        CShaderDefines markDefines("STENCIL_MARK");
+        CShaderProgram* markProg = CShaderManager::Inst()->GetProgram("point_light.glsl", &markDefines);
+        markProg->Use();
+        SetCommonUniforms(markProg, modelTransform);
+        
+        CGLState::Enable(GL_STENCIL_TEST);
+        CGLState::SetStencilMask(0xff);
+        CGLState::SetStencilFunc(GL_ALWAYS, 0, 0xff);
+        CGLState::SetStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        CGLState::SetStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        CGLState::SetColorMask(false, false, false, false);
+        CGLState::Disable(GL_CULL_FACE);
+        CGLState::Enable(GL_DEPTH_TEST);
+        
+        CMesh::UnitIcosphere().Draw();
+        
+        CGLState::SetColorMask(true, true, true, true);
+        CGLState::SetStencilFunc(GL_NOTEQUAL, 0, 0xff);
+        CGLState::SetStencilOp(GL_KEEP, GL_KEEP, GL_ZERO); // shading resets the marks for the next light
+    }
+    
     CShaderDefines defines;
     if (cvLightDebug) defines.Define("LIGHT_DEBUG");
+    if (UsesHardwareDepth()) defines.Define("HW_DEPTH");
     CShaderProgram* prog = CShaderManager::Inst()->GetProgram("point_light.glsl", &defines);
     
     prog->Use();
     
-    SetCommonUniforms(prog, glm::scale(glm::translate(lightPosW), glm::vec3(range)));
-    prog->SetUniform("uLightPosV", glm::vec3(cam.GetView() * glm::vec4(lightPosW,1)) );
-    prog->SetUniform("uDepthTex", GetRTTexture(IScene::RT_DEPTH), 0);
+    SetCommonUniforms(prog, modelTransform);
+    prog->SetUniform("uLightPosV", lightPosV);
+    prog->SetUniform("uDepthTex", GetDepthTexture(), 0);
     prog->SetUniform("uNormalTex", GetRTTexture(IScene::RT_NORMAL), 1);
     prog->SetUniform("uLightColorInvRange", glm::vec4(color.r, color.g, color.b, 1.0f/range));
     
-    glEnable(GL_CULL_FACE);
-    if (glm::length(lightPosW-cam.GetPosition()) < range+1+cam.GetNearPlane())
+    CGLState::Enable(GL_CULL_FACE);
+    if (stencil || glm::length(lightPosW-cam.GetPosition()) < range+1+cam.GetNearPlane())
     {
-        // cam inside
-        glDisable(GL_DEPTH_TEST); // disable depth so we light everything
-        glCullFace(GL_FRONT); // when inside, draw backfaces only
+        // cam inside (or the stencil already did the depth test)
+        CGLState::Disable(GL_DEPTH_TEST); // disable depth so we light everything
+        CGLState::SetCullFace(GL_FRONT); // when inside, draw backfaces only
     }
     else
     {
-        glEnable(GL_DEPTH_TEST); // enable z-test when OUTSIDE light volume (so we don't compute light on objects between light sphere and camera)
-        glCullFace(GL_BACK); // we can see only faces with normals pointing to the direction of camera
+        CGLState::Enable(GL_DEPTH_TEST); // enable z-test when OUTSIDE light volume (so we don't compute light on objects between light sphere and camera)
+        CGLState::SetCullFace(GL_BACK); // we can see only faces with normals pointing to the direction of camera
     }
     
+    bool query = BeginLightQuery();
     CMesh::UnitIcosphere().Draw();
+    if (query) glEndQuery(GL_SAMPLES_PASSED);
+    
+    CGLState::Disable(GL_SCISSOR_TEST);
+    if (depthBounds) CGLState::Disable(GL_DEPTH_BOUNDS_TEST_EXT);
+    if (stencil) CGLState::Disable(GL_STENCIL_TEST);
+}
+
+float IScene::WindowDepth(const glm::mat4& proj, float distance)
+{
+    float z = -distance;
+    float ndcZ = (proj[2][2]*z + proj[3][2]) / -z;
+    return MinMax(ndcZ*0.5f+0.5f, 0.0f, 1.0f);
+}
+
+bool IScene::BeginLightQuery()
+{
+    if (!cvLightStats) return false;
+    
+    if (_numLightQueries == _lightQueries.size())
+    {
+        unsigned q;
+        glGenQueries(1, &q);
+        _lightQueries.push_back(q);
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, _lightQueries[_numLightQueries++]);
+    return true;
+}
+
+void IScene::CollectLightQueries()
+{
+    if (!_numLightQueries) return;
+    
+    // results of the previous frame; if the GPU is still behind, the old value stays and the queries are reissued
+    GLuint available = 0;
+    glGetQueryObjectuiv(_lightQueries[_numLightQueries-1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+        _shadedLightPixels = 0;
+        for (unsigned i=0; i<_numLightQueries; i++)
+        {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(_lightQueries[i], GL_QUERY_RESULT, &samples);
+            _shadedLightPixels += samples;
+        }
+    }
+    _numLightQueries = 0;
+}
+
+void IScene::AddLight(const glm::vec3& lightPosW, const glm::vec3& color, float range)
+{
+    SPointLight light;
+    light.posW = lightPosW;
+    light.color = color;
+    light.range = range;
+    _lights.push_back(light);
+}
+
+void IScene::CullLights()
+{
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    
+    ClearLights();
+    _lightManager.Cull(cam.GetView(), cam.GetProjection(), CEngine::Inst()->GetRenderSize().height, _lights);
 }
 
+void IScene::DrawLights()
+{
+    CollectLightQueries();
+    if (!cvLightStats) _shadedLightPixels = 0;
+    
+    bool stencil = cvLightStencil && CEngine::Inst()->GetRendererCapabilities().packedDepthStencil;
+    
+    if (cvTiledLighting && _lightTiler)
+        DrawLightsTiled();
+    else if (cvLightInstancing && !stencil && CEngine::Inst()->GetRendererCapabilities().instancing)
+        DrawLightsInstanced();
+    else
+    {
+        STD_CONST_FOREACH(std::vector<SPointLight>, _lights, it)
+            DrawLight(it->posW, it->color, it->range);
+    }
+}
+
+void IScene::DrawLightsInstanced()
+{
+    if (_lights.empty()) return;
+    
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    
+    // lights containing the camera first, the rest after them; the same test as DrawLight
+    _lightInstances.clear();
+    unsigned numInside = 0;
+    for (int group=0; group<2; group++)
+    {
+        STD_CONST_FOREACH(std::vector<SPointLight>, _lights, it)
+        {
+            bool inside = glm::length(it->posW-cam.GetPosition()) < it->range+1+cam.GetNearPlane();
+            if (inside != (group == 0)) continue;
+            
+            _lightInstances.push_back(it->posW.x); _lightInstances.push_back(it->posW.y); _lightInstances.push_back(it->posW.z);
+            _lightInstances.push_back(it->range);
+            _lightInstances.push_back(it->color.r); _lightInstances.push_back(it->color.g); _lightInstances.push_back(it->color.b);
+            _lightInstances.push_back(1.0f/it->range);
+            if (group == 0) numInside++;
+        }
+    }
+    unsigned numOutside = (unsigned)_lights.size() - numInside;
+    
+    // upload; the buffer is respecified every frame so the driver doesn't wait for the previous draws
+    unsigned bytes = (unsigned)_lightInstances.size()*sizeof(float);
+    if (!_lightInstanceVBO) glGenBuffers(1, &_lightInstanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, _lightInstanceVBO);
+    if (bytes > _lightInstanceBytes)
+    {
+        CGPUMemory::Inst()->Freed(GPUMEM_MESH, _lightInstanceBytes);
+        _lightInstanceBytes = Max(bytes, _lightInstanceBytes*2);
+        CGPUMemory::Inst()->Allocated(GPUMEM_MESH, _lightInstanceBytes);
+    }
+    glBufferData(GL_ARRAY_BUFFER, _lightInstanceBytes, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &_lightInstances[0]);
+    PrintGLError("uploading light instances");
+    
+    CShaderDefines defines("INSTANCED");
+    if (cvLightDebug) defines.Define("LIGHT_DEBUG");
+    if (UsesHardwareDepth()) defines.Define("HW_DEPTH");
+    CShaderProgram* prog = CShaderManager::Inst()->GetProgram("point_light.glsl", &defines);
+    
+    prog->Use();
+    
+    SetCommonUniforms(prog, glm::mat4());
+    prog->SetUniform("uDepthTex", GetDepthTexture(), 0);
+    prog->SetUniform("uNormalTex", GetRTTexture(IScene::RT_NORMAL), 1);
+    
+    bool query = BeginLightQuery();
+    CGLState::Enable(GL_CULL_FACE);
+    if (numInside)
+    {
+        CGLState::Disable(GL_DEPTH_TEST); // disable depth so we light everything
+        CGLState::SetCullFace(GL_FRONT); // when inside, draw backfaces only
+        CMesh::UnitIcosphere().DrawInstanced(numInside, _lightInstanceVBO, 0);
+    }
+    if (numOutside)
+    {
+        CGLState::Enable(GL_DEPTH_TEST); // objects between the light sphere and the camera are not lit
+        CGLState::SetCullFace(GL_BACK);
+        CMesh::UnitIcosphere().DrawInstanced(numOutside, _lightInstanceVBO, numInside*8*sizeof(float));
+    }
+    if (query) glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void IScene::BuildLightClusters()
+{
+    if (!_lightClusters) return;
+    
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    const CEngine::SScreenSize& size = CEngine::Inst()->GetRenderSize();
+    
+    _lightClusters->Update(_lights.empty() ? NULL : &_lights[0], (unsigned)_lights.size(), cam.GetView(), cam.GetProjection(),
+                           cam.GetNearPlane(), cam.GetFarPlane(), size.width, size.height);
+}
+
+void IScene::SetClusterUniforms(CShaderProgram* prog, unsigned firstUnit)const
+{
+    if (_lightClusters) _lightClusters->SetUniforms(prog, firstUnit);
+}
+
+void IScene::DrawLightsTiled()
+{
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    const CEngine::SScreenSize& size = CEngine::Inst()->GetRenderSize();
+    
+    _lightTiler->Update(_lights.empty() ? NULL : &_lights[0], (unsigned)_lights.size(), cam.GetView(), cam.GetProjection(),
+                        cam.GetNearPlane(), cam.GetFarPlane(), size.width, size.height);
+    
+    CShaderDefines defines;
+    if (cvLightDebug) defines.Define("LIGHT_DEBUG");
+    if (UsesHardwareDepth()) defines.Define("HW_DEPTH");
+    CShaderProgram* prog = CShaderManager::Inst()->GetProgram("tiled_light.glsl", &defines);
+    
+    prog->Use();
+    
+    SetCommonUniforms(prog, glm::mat4());
+    prog->SetUniform("uDepthTex", GetDepthTexture(), 0);
+    prog->SetUniform("uNormalTex", GetRTTexture(IScene::RT_NORMAL), 1);
+    _lightTiler->SetUniforms(prog, 2);
+    
+    // every pixel is shaded once; the light lists do the culling
+    CGLState::Disable(GL_DEPTH_TEST);
+    CGLState::Disable(GL_CULL_FACE);
+    bool query = BeginLightQuery();
+    CMesh::FullscreenQuad().Draw();
+    if (query) glEndQuery(GL_SAMPLES_PASSED);
+}
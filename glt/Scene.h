@@ -9,44 +9,121 @@
 #ifndef glt_Scene_h
 #define glt_Scene_h
 
+#include <vector>
+
 #include "vec3.hpp"
 #include "mat4x4.hpp"
+#include "LightTiler.h"
+#include "LightManager.h"
 
-class CRenderTarget;
+class CRenderGraph;
 class CTexture;
 class CShaderProgram;
+class CShaderDefines;
 
 class IScene
 {
 public:
     enum ERT
     {
-        RT_DEPTH=0,
+        RT_DEPTH=0, // linear z (not rendered with r_hwDepth)
         RT_NORMAL,
         RT_DIFFUSE_ACC,
         RT_FINAL,
         RT_POSTPROCESS,
         RT_POSTPROCESS2,
+        RT_ZBUFFER, // depth attachment; also the G-buffer depth with r_hwDepth
+        RT_SSAO_DEPTH, // view-space normal and linear z at the SSAO resolution (r_ssao)
+        RT_SSAO_TEMPORAL, // AO accumulated over frames, written by r_ssaoTemporal
+        RT_SSAO_HISTORY, // RT_SSAO_TEMPORAL of the previous frame (persistent)
         _RT_NUM
     };
     
+    /// How RT_NORMAL stores view-space normals (NORMAL_ENCODING in common.incl)
+    enum ENormalEncoding
+    {
+        NE_XYZ=0, // normal*0.5+0.5 in RGBA8, specular in alpha
+        NE_SPHEREMAP, // spheremap transform in RG of RGB10A2, specular in blue
+        NE_OCTAHEDRAL, // octahedral in RG of RGB10A2, specular in blue
+        _NE_NUM
+    };
+    
+    IScene():_graph(NULL),_lightTiler(NULL),_lightClusters(NULL),_lightInstanceVBO(0),_lightInstanceBytes(0),_numLightQueries(0),_shadedLightPixels(0){};
     virtual ~IScene();
     
     virtual bool Init()=0;
+    /// Called when the internal render size changes (window resize, dynamic resolution)
+    virtual void Resize(unsigned width, unsigned height);
     virtual void Update(float delta)=0;
     virtual void Draw()=0;
     
-    const CRenderTarget& GetRT()const;
+    /// Passes of the frame; render-target resource handles are ERT values
+    CRenderGraph& GetGraph()const{ return *_graph; };
     const CTexture& GetRTTexture(ERT type)const;
-    void DrawLight(glm::vec3 lightPosW, glm::vec3 color, float range)const;
+    /// With r_hwDepth the G-buffer depth is the z-buffer itself (RT_ZBUFFER sampled, HW_DEPTH shader define)
+    /// instead of linear z in RT_DEPTH; must not change between declaring and executing a frame's passes
+    bool UsesHardwareDepth()const;
+    /// RT_ZBUFFER or RT_DEPTH, see UsesHardwareDepth
+    const CTexture& GetDepthTexture()const;
+    
+    /// Encoding selected by r_normalEncoding; read when the renderer starts (shaders are compiled with it)
+    static ENormalEncoding GetNormalEncoding();
+    /// Adds NORMAL_ENCODING for the encoding
+    static void DefineNormalEncoding(CShaderDefines& defines, ENormalEncoding encoding);
+    /// RT_NORMAL format of the encoding
+    static ETextureFormat GetNormalFormat(ENormalEncoding encoding);
+    static const char* GetNormalEncodingName(ENormalEncoding encoding);
+    /// Draws a light volume; with r_lightScissor, r_lightDepthBounds and r_lightStencil the shading is limited
+    /// to the sphere's screen rectangle, depth range and (stencil) the pixels actually inside it
+    void DrawLight(glm::vec3 lightPosW, glm::vec3 color, float range);
+    /// Queues a point light for DrawLights and BuildLightClusters
+    void AddLight(const glm::vec3& lightPosW, const glm::vec3& color, float range);
+    void ClearLights(){ _lights.clear(); };
+    /// Lights of the scene; CullLights queues the visible ones every frame
+    CLightManager& GetLightManager(){ return _lightManager; };
+    const CLightManager& GetLightManager()const{ return _lightManager; };
+    /// Replaces the queued lights with the lights of the light manager visible from the camera
+    void CullLights();
+    /// Accumulates the queued lights into the bound target.
+    /// With r_tiledLighting a single full-screen pass shades each pixel with the lights of its screen tile,
+    /// otherwise the lights are drawn as volumes: with r_lightInstancing in two instanced draws
+    /// (lights around the camera and the rest), else (or with r_lightStencil) one DrawLight per light.
+    void DrawLights();
+    /// Pixels shaded by DrawLights (summed over all lights) a frame or more ago; 0 without r_lightStats
+    unsigned GetShadedLightPixels()const{ return _shadedLightPixels; };
+    /// Whether forward shading with light clusters is available (needs float textures)
+    bool SupportsClusteredShading()const{ return _lightClusters != NULL; };
+    /// Bins the queued lights into view-space clusters (froxels) for CMesh::DRAW_FORWARD
+    void BuildLightClusters();
+    /// Binds the cluster light lists to three texture units starting at firstUnit
+    void SetClusterUniforms(CShaderProgram* prog, unsigned firstUnit)const;
     void SetCommonUniforms(CShaderProgram* prog, const glm::mat4& modelTransform)const;
     
     void SetAmbientColor(const glm::vec3 color){_ambientColor = color;};
     const glm::vec3 GetAmbientColor()const{ return _ambientColor; };
     
 private:
-    CRenderTarget* _rt;
+    void DrawLightsTiled();
+    void DrawLightsInstanced();
+    /// Depth buffer value of the view-space distance
+    static float WindowDepth(const glm::mat4& proj, float distance);
+    /// Starts a GL_SAMPLES_PASSED query for the shaded pixel statistics; the caller ends it if it returns true
+    bool BeginLightQuery();
+    /// Sums the query results of the previous frame into _shadedLightPixels
+    void CollectLightQueries();
+    
+    CRenderGraph* _graph;
     glm::vec3    _ambientColor;
+    CLightTiler* _lightTiler;
+    CLightTiler* _lightClusters;
+    CLightManager _lightManager;
+    std::vector<SPointLight> _lights; // queued for DrawLights/BuildLightClusters
+    std::vector<float> _lightInstances; // light volume instance data (see DrawLightsInstanced)
+    unsigned _lightInstanceVBO;
+    unsigned _lightInstanceBytes;
+    std::vector<unsigned> _lightQueries;
+    unsigned _numLightQueries; // issued this frame
+    unsigned _shadedLightPixels;
 };
 
 
@@ -12,8 +12,10 @@
 #include "Types.h"
 #include "Mesh.h"
 #include "Engine.h"
+#include "FileSystem.h"
+#include "GLState.h"
 
-#include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include "type_ptr.hpp"
@@ -205,24 +207,28 @@ char* CBaseShader::ParsePreprocessorTokenValue(const char* cline, const char* to
 
 CBaseShader::Lines CBaseShader::LoadShaderSource(const char* path)
 {
-    std::ifstream file;
-    
-    file.open(path, std::ios::in);
-    if(!file)
+    char* data;
+    unsigned size;
+    if (!CFileSystem::Inst()->ReadFile(path, data, size))
         return Lines();
     
     Lines lines;
     
-    // load lines from file
-    std::string line;
-    while(std::getline(file, line))
-        lines.push_back(line);
+    // split into lines
+    for (char* ln = data; ln < data + size; )
+    {
+        char* end = (char*)memchr(ln, '\n', data + size - ln);
+        if (!end) end = data + size;
+        
+        lines.push_back(std::string(ln, end));
+        ln = end + 1;
+    }
     
     // this will make the shader in "path" to start on line 0 as when error happens,
     // we will more likely be editing this shader than some included file
     //if (lines.size()) lines.insert(lines.begin(), "#line 0");
     
-    file.close();
+    free(data);
     
     // find and include all includes
     STD_FOREACH_NOINC(Lines, lines, lit)
@@ -311,12 +317,12 @@ bool CBaseShader::Compile(CShaderDefines *defines)
     // create complete source
     _compiledDefines.UndefineAll();
     if (defines) _compiledDefines += *defines;
+    _compiledDefines += CShaderManager::Inst()->GetGlobalDefines(); // doesn't replace values from defines
     
     std::string finalSource = _compiledDefines.GetCode();
     
     finalSource += std::string("#define ") + ((GetType()==T_FRAGMENT)?"FS":"VS") + " defined\n";
     if (CEngine::Inst()->GetRendererCapabilities().MRT) finalSource += "#define MRT defined\n";
-    //finalSource += "#define NORMAL_ENCODE_SPHEREMAP defined\n";
     
     // compute extra lines
     unsigned extraLines=0; // number of extra lines added at the beginning of shader source
@@ -418,7 +424,6 @@ bool CBaseShader::Compile(CShaderDefines *defines)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-const CShaderProgram* CShaderProgram::s_currentProgram = NULL;
 
 CShaderProgram::CShaderProgram(const char* name)
 : _linked(false), _object(0), _name(name)
@@ -435,6 +440,7 @@ CShaderProgram::~CShaderProgram()
 {
     if (_object)
     {
+        CGLState::ForgetProgram(_object);
         glDeleteProgram(_object);
         PrintGLError("deleting shader object (2)");
     }
@@ -473,6 +479,10 @@ void CShaderProgram::BindAttributes()
     PrintGLError("binding vertex attribute location");
 	glBindAttribLocation(_object,	Attrib2Index(ATTRIB_PROJVEC),	"aProjVec");
     PrintGLError("binding vertex attribute location");
+	glBindAttribLocation(_object,	Attrib2Index(ATTRIB_INSTANCE0),	"aInstance0");
+    PrintGLError("binding vertex attribute location");
+	glBindAttribLocation(_object,	Attrib2Index(ATTRIB_INSTANCE1),	"aInstance1");
+    PrintGLError("binding vertex attribute location");
 }
 
 bool CShaderProgram::Link()
@@ -494,7 +504,12 @@ bool CShaderProgram::Link()
         return false;
     }
     
-    if (_object) glDeleteProgram(_object);
+    if (_object)
+    {
+        CGLState::ForgetProgram(_object);
+        glDeleteProgram(_object);
+    }
+    _samplerUnits.clear();
     _object = glCreateProgram();
     PrintGLError("creating program object");
     if (!_object) return false;
@@ -586,23 +601,24 @@ bool CShaderProgram::Link()
 
 void CShaderProgram::Use()const
 {
-    if (s_currentProgram == this)
-        return;
-    
     if (!IsValid())
     {
-        glUseProgram(0);
-        s_currentProgram = this;
+        CGLState::UseProgram(0);
         return;
     }
     
     glGetError();
     
-    glUseProgram(_object);
-    s_currentProgram = this;
+    CGLState::UseProgram(_object);
     PrintGLError("using program object");
 }
 
+void CShaderProgram::MakeCurrent()const
+{
+    if (!CGLState::IsProgramUsed(IsValid() ? _object : 0))
+        Use();
+}
+
 
 int CShaderProgram::GetUniformLocation(SHArg name)
 {
@@ -617,7 +633,7 @@ int CShaderProgram::GetUniformLocation(SHArg name)
 
 bool CShaderProgram::SetUniform(SHArg name, const glm::mat4& mat)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
 	glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(mat));
@@ -626,7 +642,7 @@ bool CShaderProgram::SetUniform(SHArg name, const glm::mat4& mat)
 
 bool CShaderProgram::SetUniform(SHArg name, int val)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
 	glUniform1i(loc, val);
@@ -634,7 +650,7 @@ bool CShaderProgram::SetUniform(SHArg name, int val)
 }
 bool CShaderProgram::SetUniform(SHArg name, float val)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
     glUniform1f(loc, val);
@@ -642,7 +658,7 @@ bool CShaderProgram::SetUniform(SHArg name, float val)
 }
 bool CShaderProgram::SetUniform(SHArg name, const glm::vec2& v)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
 	glUniform2fv(loc, 1, glm::value_ptr(v));
@@ -650,7 +666,7 @@ bool CShaderProgram::SetUniform(SHArg name, const glm::vec2& v)
 }
 bool CShaderProgram::SetUniform(SHArg name, unsigned count, const glm::vec3& v)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
 	glUniform3fv(loc, count, glm::value_ptr(v));
@@ -662,7 +678,7 @@ bool CShaderProgram::SetUniform(SHArg name, const glm::vec3& v)
 }
 bool CShaderProgram::SetUniform(SHArg name, const glm::vec4& v)
 {
-    Use();
+    MakeCurrent();
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
 	glUniform4fv(loc, 1, glm::value_ptr(v));
@@ -670,11 +686,17 @@ bool CShaderProgram::SetUniform(SHArg name, const glm::vec4& v)
 }
 bool CShaderProgram::SetUniform(SHArg name, const CTexture& tex, unsigned textureUnit)
 {
-    Use();
+    MakeCurrent();
     tex.Use(textureUnit);
     int loc = GetUniformLocation(name);
     if (loc < 0) return false;
-	glUniform1i(loc, textureUnit); // we are setting texture unit number to the uniform actually (not a texture ID)!
+    
+    SamplerUnitMap::iterator it = _samplerUnits.find(loc);
+    if (it != _samplerUnits.end() && it->second == textureUnit)
+        return true;
+    
+    glUniform1i(loc, textureUnit); // we are setting texture unit number to the uniform actually (not a texture ID)!
+    _samplerUnits[loc] = textureUnit;
     return true;
 }
 
@@ -692,6 +714,8 @@ CShaderProgram* CShaderManager::GetProgram(SHArg name, CShaderDefines* defines,
     
     if (compileIfNotFound)
     {
+        int startTime = glutGet(GLUT_ELAPSED_TIME);
+        
         CShaderProgram* prog = new CShaderProgram(name.GetString());
         
         CVertexShader* vs = GetVShader(name, defines, compileIfNotFound);
@@ -702,12 +726,90 @@ CShaderProgram* CShaderManager::GetProgram(SHArg name, CShaderDefines* defines,
         prog->RemoveShaders();
         
         _progCache.insert(std::pair<SHType, CShaderProgram*>(hash, prog));
+        
+        // remember the permutation for the manifest
+        SPermutation perm;
+        perm.name = name.GetString();
+        if (defines) perm.defines = defines->ToString();
+        _permutations.insert(std::pair<SHType, SPermutation>(hash, perm));
+        
+        if (_warnOnCompile)
+        {
+            printf("Warning: %s <%s> compiled during gameplay (%d ms)! It will be warmed up on the next start.\n",
+                   perm.name.c_str(), perm.defines.c_str(), glutGet(GLUT_ELAPSED_TIME)-startTime);
+        }
+        
         return prog;
     }
         
     return 0;
 }
 
+unsigned CShaderManager::WarmUpFromManifest(const char* path)
+{
+    if (!path) return 0;
+    
+    char* data;
+    unsigned size;
+    if (!CFileSystem::Inst()->ReadFile(path, data, size))
+        return 0;
+    
+    std::istringstream file(std::string(data, size));
+    free(data);
+    
+    int startTime = glutGet(GLUT_ELAPSED_TIME);
+    unsigned numCompiled = 0;
+    
+    std::string line;
+    while(std::getline(file, line))
+    {
+        // skip comments and empty lines
+        if (line.size() == 0 || line[0] == '#')
+            continue;
+        
+        char name[256], defs[1024];
+        defs[0] = 0;
+        if (sscanf(line.c_str(), "%255s %1023s", name, defs) < 1)
+            continue;
+        
+        // program name must stay in memory as CShaderProgram and LocateFile use the string behind the hash
+        const std::string& nameStr = *_manifestNames.insert(std::string(name)).first;
+        SHArg nameHash = CStringHash::FromStackString(nameStr.c_str());
+        CShaderDefines defines(defs);
+        
+        SHType hash = nameHash.GetHash() + defines.GetHash();
+        if (_progCache.find(hash) != _progCache.end())
+            continue;
+        
+        if (GetProgram(nameHash, &defines))
+            numCompiled++;
+    }
+    
+    printf("Shader manifest %s: %u program permutations warmed up in %d ms\n", basename(path), numCompiled, glutGet(GLUT_ELAPSED_TIME)-startTime);
+    return numCompiled;
+}
+
+bool CShaderManager::SaveManifest(const char* path)const
+{
+    if (!path) return false;
+    
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        printf("Failed to write shader manifest %s\n", path);
+        return false;
+    }
+    
+    fprintf(fp, "# program permutations requested by glt; compiled on startup\n");
+    STD_CONST_FOREACH(PermutationMap, _permutations, it)
+    {
+        fprintf(fp, "%s %s\n", it->second.name.c_str(), it->second.defines.c_str());
+    }
+    fclose(fp);
+    
+    return true;
+}
+
 CVertexShader* CShaderManager::GetVShader(SHArg name, CShaderDefines* defines, bool compileIfNotFound)
 {
     // get complete hash
@@ -11,6 +11,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include "vec2.hpp"
 #include "vec3.hpp"
@@ -34,7 +35,8 @@ public:
     CShaderDefines& Define(const char* name, const char* value);
     template <typename T> CShaderDefines& Define(const char* name, T value)
     {
-        return Define(name, variable_to_string(value));
+        char buf[64];
+        return Define(name, variable_to_string(buf, value));
     }
     /// \param commaSeparatedValueAssignments Value doesn't need to be specified (exmaple "VS,ITERATIONS=1,BLUE")
     CShaderDefines& Undefine(const char* commaSeparatedValueAssignments);
@@ -148,6 +150,7 @@ public:
 class CShaderProgram
 {
     typedef std::map<SHType, int> UniformMap;
+    typedef std::map<int, unsigned> SamplerUnitMap; // uniform location -> texture unit
     
 public:
     CShaderProgram(const char* name="");
@@ -185,6 +188,8 @@ public:
     
 private:
     void BindAttributes();
+    /// Use() if not used already, without counting a redundant state change (for setting uniforms)
+    void MakeCurrent()const;
     
     std::string _name;
     CVertexShader* _vs;
@@ -194,7 +199,7 @@ private:
     CShaderDefines _defines;
     
     UniformMap _uniforms;
-    static const CShaderProgram* s_currentProgram;
+    SamplerUnitMap _samplerUnits; // values of sampler uniforms, to skip setting them again
 };
 
 class CShaderManager
@@ -203,7 +208,18 @@ class CShaderManager
     typedef std::map<SHType, CVertexShader*> VSMap;
     typedef std::map<SHType, CFragmentShader*> FSMap;
     
+    /// Program permutation as requested from GetProgram (used for the manifest)
+    struct SPermutation
+    {
+        std::string name;
+        std::string defines; // CShaderDefines::ToString() format
+    };
+    typedef std::map<SHType, SPermutation> PermutationMap;
+    
 public:
+    CShaderManager():_warnOnCompile(false){};
+    
+    
     static CShaderManager* Inst()
     {
         static CShaderManager* inst = 0;
@@ -220,7 +236,24 @@ public:
     unsigned PurgeProgCache();
     unsigned PurgeShaderCaches(){ return PurgeFSCache() + PurgeVSCache(); }
     
+    /// Compiles and links all program permutations listed in the manifest so they are ready before the first frame
+    /// \return Number of permutations compiled
+    unsigned WarmUpFromManifest(const char* path);
+    /// Writes all program permutations requested so far (including the warmed-up ones) to the manifest
+    bool SaveManifest(const char* path)const;
+    /// When enabled, each program permutation compiled on demand prints a warning (use after loading is done)
+    void SetWarnOnCompile(bool warn){ _warnOnCompile = warn; };
+    /// Defines added to every shader compiled afterwards (renderer-wide settings like the G-buffer layout).
+    /// Defines passed to GetProgram take precedence. Not part of the cache keys - set before compiling anything.
+    void SetGlobalDefines(const CShaderDefines& defines){ _globalDefines = defines; };
+    const CShaderDefines& GetGlobalDefines()const{ return _globalDefines; };
+    
 private:
+    PermutationMap _permutations;
+    std::set<std::string> _manifestNames; // keeps program names loaded from the manifest alive for CStringHash
+    bool _warnOnCompile;
+    CShaderDefines _globalDefines;
+    
     ProgMap _progCache;
     VSMap _vsCache;
     FSMap _fsCache;
@@ -9,6 +9,7 @@
 #include "Shared.h"
 #include "glstuff.h"
 #include "main.h"
+#include "FileSystem.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -29,6 +30,13 @@ const char* LocateFile(const char* filename)
 {
     static char temp[2048];
     
+    // mounted archives first - just a directory lookup, no syscalls
+    if (CFileSystem::Inst()->Contains(filename))
+    {
+        snprintf(temp, sizeof(temp), "%s%s", VFS_PREFIX, basename(filename));
+        return temp;
+    }
+    
     strcpy(temp, GetExecutableDir());
     
     strcat(temp, "/");
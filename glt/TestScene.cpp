@@ -10,7 +10,8 @@
 #include "Shared.h"
 #include "CVar.h"
 #include "Engine.h"
-#include "RenderTarget.h"
+#include "RenderGraph.h"
+#include "GLState.h"
 
 #include "glstuff.h"
 #include "func_matrix.hpp"
@@ -19,6 +20,13 @@
 //#define CRYTEK
 
 static CVar cvRT("r_rt", 0, CVar::FLAG_GUI_TWEAKABLE, 0, 6 +0.9f);
+static CVar cvGBufferMRT("r_gbufferMRT", true, CVar::FLAG_GUI_TWEAKABLE); // linear z and normals in one geometry pass (needs MRT)
+static CVar cvPipeline("r_pipeline", 0, CVar::FLAG_GUI_TWEAKABLE, 0, 1); // 0 = deferred light pre-pass, 1 = clustered forward (needs float textures)
+static CVar cvSSAO("r_ssao", 2, CVar::FLAG_GUI_TWEAKABLE, 0, 3); // 0 = off, 1 = quarter, 2 = half, 3 = full resolution
+static CVar cvSSAOTemporal("r_ssaoTemporal", true, CVar::FLAG_GUI_TWEAKABLE); // accumulate SSAO over frames with reprojection (needs MRT)
+static CVar cvSSAOTemporalSamples("r_ssaoTemporalSamples", 4, CVar::FLAG_GUI_TWEAKABLE, 1, SSAO_KERNEL_SIZE); // kernel taps per frame
+static CVar cvSSAOTemporalFrames("r_ssaoTemporalFrames", 8, CVar::FLAG_GUI_TWEAKABLE, 1, 32); // frames averaged
+static CVar cvTestLights("r_testLights", 8, CVar::FLAG_GUI_TWEAKABLE, 8, 10000); // the hand-placed lights plus generated ones (for comparing pipelines); 10000 = light culling stress test
 
 static glm::vec3 s_ambient(0.07,0.05,0.05);
 
@@ -42,12 +50,18 @@ bool CTestScene::Init()
     _fullscreenQuadProg = CShaderManager::Inst()->GetProgram("basic.glsl", &defines);
     // TEXTURE1 for SSAO multiply
     _fullscreenQuadProgSSAO = CShaderManager::Inst()->GetProgram("basic.glsl", &CShaderDefines(defines).Define("TEXTURE1"));
+    // bilateral upsample of reduced resolution SSAO, guided by the z-buffer
+    _fullscreenQuadProgSSAOUpsample = CShaderManager::Inst()->GetProgram("basic.glsl", &CShaderDefines(defines).Define("TEXTURE1,SSAO_UPSAMPLE,HW_DEPTH"));
     // DEBUG_VISUALIZE_ALPHA to visualize alpha channel
     _fullscreenQuadProgDebug = CShaderManager::Inst()->GetProgram("basic.glsl", &CShaderDefines(defines).Define("DEBUG_VISUALIZE_ALPHA"));
     
     // ssao
     defines.UndefineAll();
     _ssaoProg = CShaderManager::Inst()->GetProgram("ssao.glsl", &defines);
+    _ssaoProgHWDepth = CShaderManager::Inst()->GetProgram("ssao.glsl", &CShaderDefines(defines).Define("HW_DEPTH"));
+    _ssaoProgDownsampled = CShaderManager::Inst()->GetProgram("ssao.glsl", &CShaderDefines(defines).Define("DOWNSAMPLED"));
+    _ssaoDownsampleProg = CShaderManager::Inst()->GetProgram("ssao_downsample.glsl", &CShaderDefines(defines).Define("HW_DEPTH"));
+    _ssaoTemporalProg = CShaderManager::Inst()->GetProgram("ssao_temporal.glsl", &CShaderDefines(defines).Define("MRT"));
     _ssaoBlurProg = CShaderManager::Inst()->GetProgram("ssao_blur.glsl", &defines);
     _ssaoRandom = CTexture::FromFile(LocateFile("ssao_random.png"));
     
@@ -71,8 +85,128 @@ bool CTestScene::Init()
         _ssaoKernel[i] = glm::normalize(_ssaoKernel[i]) * (0.5f+sinf(the*8)/0.5f);
         _ssaoKernel[i] *= 0.3+(1.0-0.3)/SSAO_KERNEL_SIZE*(i%2);
     }
+    // temporal kernel: a spiral over the hemisphere, denser near the center
+    for (unsigned i=0; i<SSAO_TEMPORAL_KERNEL_SIZE; i++)
+    {
+        float t = (i+0.5f)/SSAO_TEMPORAL_KERNEL_SIZE;
+        float phi = i*2.39996f; // golden angle - consecutive taps (one frame's) are spread around
+        float z = 1.0f-0.85f*t;
+        float r = sqrtf(1.0f-z*z);
+        _ssaoTemporalKernel[i] = glm::vec3(r*cosf(phi), r*sinf(phi), z) * (0.1f+0.9f*t*t);
+    }
+    _ssaoDivisor = 1;
+    _frame = 0;
+    
+    if (!IScene::Init())
+        return false;
+    
+    // frame passes; clears, framebuffers and texture sharing follow from the reads/writes
+    // (WriteAll for fullscreen passes which overwrite every pixel and need no clear)
+    CRenderGraph& graph = GetGraph();
+    unsigned pass;
+    
+    // DEFERRED (light pre-pass)
+    // linear z in RT_DEPTH: either a single MRT geometry pass or separate z and normal passes
+    _gbufferPass = pass = graph.AddPass("g-buffer", PassGBuffer, this);
+    graph.Write(pass, RT_DEPTH);
+    graph.Write(pass, RT_NORMAL);
+    graph.Write(pass, RT_ZBUFFER);
+    
+    _linearZPass = pass = graph.AddPass("linear z", PassLinearZ, this);
+    graph.Write(pass, RT_DEPTH);
+    graph.Write(pass, RT_ZBUFFER);
+    
+    _normalPass = pass = graph.AddPass("normal", PassNormal, this);
+    graph.Read(pass, RT_ZBUFFER);
+    graph.Write(pass, RT_NORMAL);
+    
+    // hardware depth: normals are the only color target, the z-buffer is sampled directly
+    _hwDepthPasses.push_back(pass = graph.AddPass("g-buffer (hw depth)", PassGBufferHWDepth, this));
+    graph.Write(pass, RT_NORMAL);
+    graph.Write(pass, RT_ZBUFFER);
+    
+    _linearDepthPasses.push_back(pass = graph.AddPass("lights", PassLights, this));
+    graph.Read(pass, RT_DEPTH);
+    graph.Read(pass, RT_NORMAL);
+    graph.Read(pass, RT_ZBUFFER);
+    graph.Write(pass, RT_DIFFUSE_ACC);
+    
+    _hwDepthPasses.push_back(pass = graph.AddPass("lights (hw depth)", PassLights, this));
+    graph.Read(pass, RT_NORMAL);
+    graph.Read(pass, RT_ZBUFFER);
+    graph.Write(pass, RT_DIFFUSE_ACC);
+    
+    _deferredPasses.push_back(pass = graph.AddPass("material", PassMaterial, this));
+    graph.Read(pass, RT_DIFFUSE_ACC);
+    graph.Read(pass, RT_ZBUFFER);
+    graph.Write(pass, RT_FINAL);
+    
+    _ssaoPass = pass = graph.AddPass("ssao", PassSSAO, this);
+    graph.Read(pass, RT_DEPTH);
+    graph.Read(pass, RT_NORMAL);
+    graph.WriteAll(pass, RT_POSTPROCESS);
+    
+    _ssaoHWDepthPass = pass = graph.AddPass("ssao (hw depth)", PassSSAO, this);
+    graph.Sample(pass, RT_ZBUFFER); // texture input only - attaching it while sampling would be a feedback loop
+    graph.Read(pass, RT_NORMAL);
+    graph.WriteAll(pass, RT_POSTPROCESS);
+    
+    // reduced resolution SSAO: RT_SSAO_DEPTH, RT_POSTPROCESS and RT_POSTPROCESS2 are made smaller in Draw;
+    // depth always comes from the z-buffer so that one variant serves both r_hwDepth modes
+    _ssaoDownsamplePass = pass = graph.AddPass("ssao downsample", PassSSAODownsample, this);
+    graph.Sample(pass, RT_ZBUFFER);
+    graph.Read(pass, RT_NORMAL);
+    graph.WriteAll(pass, RT_SSAO_DEPTH);
+    
+    _ssaoDownsampledPass = pass = graph.AddPass("ssao (downsampled)", PassSSAODownsampled, this);
+    graph.Read(pass, RT_SSAO_DEPTH);
+    graph.WriteAll(pass, RT_POSTPROCESS);
+    
+    _ssaoBlurPass = pass = graph.AddPass("ssao blur", PassSSAOBlur, this);
+    graph.Read(pass, RT_POSTPROCESS);
+    graph.WriteAll(pass, RT_POSTPROCESS2);
     
-    return IScene::Init();
+    // temporal SSAO (instead of the blur): this frame's few taps averaged with the reprojected history
+    _ssaoTemporalPass = pass = graph.AddPass("ssao temporal", PassSSAOTemporal, this);
+    graph.Read(pass, RT_POSTPROCESS);
+    graph.Read(pass, RT_SSAO_DEPTH);
+    graph.Read(pass, RT_SSAO_HISTORY);
+    graph.WriteAll(pass, RT_POSTPROCESS2);
+    graph.WriteAll(pass, RT_SSAO_TEMPORAL);
+    
+    _ssaoHistoryPass = pass = graph.AddPass("ssao history", PassSSAOHistory, this);
+    graph.Read(pass, RT_SSAO_TEMPORAL);
+    graph.Write(pass, RT_SSAO_HISTORY);
+    
+    _compositePass = pass = graph.AddPass("composite", PassComposite, this);
+    graph.Read(pass, RT_FINAL);
+    graph.Read(pass, RT_POSTPROCESS2);
+    graph.SetOutput(pass);
+    
+    _compositeUpsamplePass = pass = graph.AddPass("composite (ssao upsample)", PassCompositeUpsample, this);
+    graph.Read(pass, RT_FINAL);
+    graph.Read(pass, RT_POSTPROCESS2);
+    graph.Read(pass, RT_SSAO_DEPTH);
+    graph.Sample(pass, RT_ZBUFFER);
+    graph.SetOutput(pass);
+    
+    _compositePlainPass = pass = graph.AddPass("composite (no ssao)", PassCompositePlain, this);
+    graph.Read(pass, RT_FINAL);
+    graph.SetOutput(pass);
+    
+    // CLUSTERED FORWARD (no normals are rendered, so no SSAO)
+    _forwardPasses.push_back(pass = graph.AddPass("depth prepass", PassLinearZ, this));
+    graph.Write(pass, RT_ZBUFFER);
+    
+    _forwardPasses.push_back(pass = graph.AddPass("forward", PassForward, this));
+    graph.Read(pass, RT_ZBUFFER);
+    graph.Write(pass, RT_FINAL);
+    
+    _forwardPasses.push_back(pass = graph.AddPass("composite forward", PassCompositePlain, this));
+    graph.Read(pass, RT_FINAL);
+    graph.SetOutput(pass);
+    
+    return true;
 }
 
 void CTestScene::Update(float delta)
@@ -101,90 +235,362 @@ static void endWireframe()
 
 void CTestScene::Draw()
 {
-    glDepthMask(GL_TRUE); // enable z write
-    glEnable(GL_DEPTH_TEST); // enable z test
+    CGLState::SetDepthMask(true); // enable z write
+    CGLState::Enable(GL_DEPTH_TEST); // enable z test
     glLineWidth(1);
-    glDisable(GL_BLEND);
+    CGLState::Disable(GL_BLEND);
     
-    // LINEAR Z
-    // TODO: simplify Use() on render target here so we don't need to remember attachment number and use symbolic names like IScene::RT_DEPTH
-    GetRT().Use(CRenderTarget::ATT_COLOR0, CRenderTarget::CLEAR_BOTH); // can theoretically not clear the color buffer (depending on the scene)
-    _mesh->Draw(CMesh::DRAW_Z);
+    CRenderGraph& graph = GetGraph();
     
-    // NORMAL
-    GetRT().Use(CRenderTarget::ATT_COLOR1, CRenderTarget::CLEAR_COLOR); // can theoretically not clear the color buffer (depending on the scene)
-    glDepthMask(GL_FALSE); // disable z write (we already have z renderbuffer created)
-    _mesh->Draw(CMesh::DRAW_NORMAL);
+    bool forward = cvPipeline.GetInt() == 1 && SupportsClusteredShading();
+    for (unsigned i=0; i<_deferredPasses.size(); i++)
+        graph.SetEnabled(_deferredPasses[i], !forward);
+    for (unsigned i=0; i<_forwardPasses.size(); i++)
+        graph.SetEnabled(_forwardPasses[i], forward);
+    
+    bool hwDepth = UsesHardwareDepth();
+    for (unsigned i=0; i<_linearDepthPasses.size(); i++)
+        graph.SetEnabled(_linearDepthPasses[i], !forward && !hwDepth);
+    for (unsigned i=0; i<_hwDepthPasses.size(); i++)
+        graph.SetEnabled(_hwDepthPasses[i], !forward && hwDepth);
+    
+    bool mrt = cvGBufferMRT && CMesh::SupportsGBufferPass();
+    graph.SetEnabled(_gbufferPass, !forward && !hwDepth && mrt);
+    graph.SetEnabled(_linearZPass, !forward && !hwDepth && !mrt);
+    graph.SetEnabled(_normalPass, !forward && !hwDepth && !mrt);
+    
+    // temporal SSAO works on RT_SSAO_DEPTH, so at full resolution it goes through the downsampled passes too
+    ESSAOPreset ssao = forward ? SSAO_OFF : GetSSAOPreset();
+    bool temporal = ssao != SSAO_OFF && UsesTemporalSSAO();
+    bool downsampled = ssao == SSAO_QUARTER_RES || ssao == SSAO_HALF_RES || (ssao == SSAO_FULL_RES && temporal);
+    graph.SetEnabled(_ssaoPass, ssao == SSAO_FULL_RES && !temporal && !hwDepth);
+    graph.SetEnabled(_ssaoHWDepthPass, ssao == SSAO_FULL_RES && !temporal && hwDepth);
+    graph.SetEnabled(_ssaoDownsamplePass, downsampled);
+    graph.SetEnabled(_ssaoDownsampledPass, downsampled);
+    graph.SetEnabled(_ssaoBlurPass, ssao != SSAO_OFF && !temporal);
+    graph.SetEnabled(_ssaoTemporalPass, temporal);
+    graph.SetEnabled(_ssaoHistoryPass, temporal);
+    graph.SetEnabled(_compositePass, ssao == SSAO_FULL_RES && !temporal);
+    graph.SetEnabled(_compositeUpsamplePass, downsampled);
+    graph.SetEnabled(_compositePlainPass, !forward && ssao == SSAO_OFF);
+    
+    _ssaoDivisor = ssao == SSAO_QUARTER_RES ? 4 : ssao == SSAO_HALF_RES ? 2 : 1;
+    graph.SetSizeDivisor(RT_SSAO_DEPTH, _ssaoDivisor);
+    graph.SetSizeDivisor(RT_POSTPROCESS, _ssaoDivisor);
+    graph.SetSizeDivisor(RT_POSTPROCESS2, _ssaoDivisor);
+    graph.SetSizeDivisor(RT_SSAO_TEMPORAL, _ssaoDivisor);
+    graph.SetSizeDivisor(RT_SSAO_HISTORY, _ssaoDivisor);
+    
+    if ((unsigned)cvTestLights.GetInt() != GetLightManager().GetNumLights())
+        AddSceneLights();
+    CullLights();
+    
+    // the debug view can show any target, so they must not share textures then
+    graph.SetAliasing(cvRT.GetInt() == 0);
+    graph.Execute();
+    
+    _frame++;
+}
+
+CTestScene::ESSAOPreset CTestScene::GetSSAOPreset()const
+{
+    ESSAOPreset preset = (ESSAOPreset)MinMax(cvSSAO.GetInt(), 0, _SSAO_NUM-1);
+    
+    // RT_SSAO_DEPTH is a float target
+    if ((preset == SSAO_QUARTER_RES || preset == SSAO_HALF_RES) && !CEngine::Inst()->GetRendererCapabilities().floatTextures)
+        return SSAO_FULL_RES;
+    
+    return preset;
+}
+
+bool CTestScene::UsesTemporalSSAO()const
+{
+    const CEngine::SRendererCaps& caps = CEngine::Inst()->GetRendererCapabilities();
+    return cvSSAOTemporal && caps.MRT && caps.floatTextures;
+}
+
+void CTestScene::AddSceneLights()
+{
+    CLightManager& lights = GetLightManager();
+    lights.Clear();
     
-    // ACCUMULATION
-    GetRT().Use(CRenderTarget::ATT_COLOR2, CRenderTarget::CLEAR_COLOR);
-    glDepthMask(GL_FALSE); // disable z write (so that two intersecting light spheres will work)
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
     static float s_pos = 0.1f;
     //s_pos += CEngine::Inst()->GetDeltaTime() * 0.4;
-    DrawLight(glm::vec3(5*sinf(s_pos)+6,0.5,0), glm::vec3(1,0.5,0), 12);
-    DrawLight(glm::vec3(-5*sinf(s_pos)-6,0.5,0), glm::vec3(1.0,0.9,0.7), 12);
+    lights.Add(glm::vec3(5*sinf(s_pos)+6,0.5,0), glm::vec3(1,0.5,0), 12);
+    lights.Add(glm::vec3(-5*sinf(s_pos)-6,0.5,0), glm::vec3(1.0,0.9,0.7), 12);
     
     // middle top
-    DrawLight(glm::vec3(0,7,-5), glm::vec3(1.0,0.9,0.7), 5);
-    DrawLight(glm::vec3(0,7,5), glm::vec3(1.0,0.9,0.7), 5);
+    lights.Add(glm::vec3(0,7,-5), glm::vec3(1.0,0.9,0.7), 5);
+    lights.Add(glm::vec3(0,7,5), glm::vec3(1.0,0.9,0.7), 5);
+    
+    lights.Add(glm::vec3(7,7,-5), glm::vec3(1.0,0.9,0.7), 5);
+    lights.Add(glm::vec3(7,7,5), glm::vec3(1.0,0.9,0.7), 5);
+    lights.Add(glm::vec3(-7,7,-5), glm::vec3(1.0,0.9,0.7), 5);
+    lights.Add(glm::vec3(-7,7,5), glm::vec3(1.0,0.9,0.7), 5);
+    
+    // small lights spread over the atrium; same sequence every time
+    unsigned seed = 12345;
+    for (int i=8; i<cvTestLights.GetInt(); i++)
+    {
+        float r[7];
+        for (unsigned j=0; j<7; j++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            r[j] = (seed >> 8) / 16777216.0f;
+        }
+        lights.Add(glm::vec3(-14+28*r[0], -0.5f+12*r[1], -6+12*r[2]), glm::vec3(0.2f+0.8f*r[3], 0.2f+0.8f*r[4], 0.2f+0.8f*r[5]), 1+2*r[6]);
+    }
+}
+
+void CTestScene::PassGBuffer(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // LINEAR Z + NORMAL
+    self->_mesh->Draw(CMesh::DRAW_GBUFFER);
+}
+
+void CTestScene::PassLinearZ(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
-    DrawLight(glm::vec3(7,7,-5), glm::vec3(1.0,0.9,0.7), 5);
-    DrawLight(glm::vec3(7,7,5), glm::vec3(1.0,0.9,0.7), 5);
-    DrawLight(glm::vec3(-7,7,-5), glm::vec3(1.0,0.9,0.7), 5);
-    DrawLight(glm::vec3(-7,7,5), glm::vec3(1.0,0.9,0.7), 5);
+    // LINEAR Z
+    self->_mesh->Draw(CMesh::DRAW_Z);
+}
+
+void CTestScene::PassNormal(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
-    glDisable(GL_BLEND);
+    // NORMAL
+    CGLState::SetDepthMask(false); // disable z write (we already have z renderbuffer created)
+    self->_mesh->Draw(CMesh::DRAW_NORMAL);
+}
+
+void CTestScene::PassGBufferHWDepth(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // NORMAL + Z
+    CGLState::Enable(GL_DEPTH_TEST);
+    CGLState::SetDepthMask(true);
+    self->_mesh->Draw(CMesh::DRAW_NORMAL);
+}
+
+void CTestScene::PassLights(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // ACCUMULATION
+    CGLState::SetDepthMask(false); // disable z write (so that two intersecting light spheres will work)
+    CGLState::Enable(GL_BLEND);
+    CGLState::SetBlendFunc(GL_ONE, GL_ONE);
+    self->DrawLights();
+    
+    CGLState::Disable(GL_BLEND);
+}
+
+void CTestScene::PassMaterial(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
     // FINAL SCENE
-    GetRT().Use(CRenderTarget::ATT_COLOR3, CRenderTarget::CLEAR_COLOR);
     //glEnable(GL_MULTISAMPLE_ARB);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    CGLState::Enable(GL_CULL_FACE);
+    CGLState::SetCullFace(GL_BACK);
     beginWireframe();
-    glEnable(GL_DEPTH_TEST); // enable depth test (if not enabled; we want to reuse z for the final pass)
-    glDepthMask(GL_TRUE); // disable z-write (we have the wbuffer already)
-    _mesh->Draw(CMesh::DRAW_MATERIAL);
+    CGLState::Enable(GL_DEPTH_TEST); // enable depth test (if not enabled; we want to reuse z for the final pass)
+    CGLState::SetDepthMask(true); // disable z-write (we have the wbuffer already)
+    self->_mesh->Draw(CMesh::DRAW_MATERIAL);
     endWireframe();
     //glDisable(GL_MULTISAMPLE_ARB);
     
-    glDisable(GL_DEPTH_TEST); // disable z test (no more scene drawing; now postprocess only)
+    CGLState::Disable(GL_DEPTH_TEST); // disable z test (no more scene drawing; now postprocess only)
+}
+
+void CTestScene::PassSSAO(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
     // SSAO
-    GetRT().Use(CRenderTarget::ATT_COLOR4, CRenderTarget::CLEAR_COLOR);
-    _ssaoProg->Use();
-    SetCommonUniforms(_ssaoProg, glm::mat4());
-    _ssaoProg->SetUniform("uDepthTex", GetRTTexture(IScene::RT_DEPTH), 0);
-    _ssaoProg->SetUniform("uNormalTex", GetRTTexture(IScene::RT_NORMAL), 1);
-    _ssaoProg->SetUniform("uRandomTex", *_ssaoRandom, 2);
-    _ssaoProg->SetUniform("uKernel", SSAO_KERNEL_SIZE, _ssaoKernel[0]);
-    _ssaoProg->SetUniform("uKernelSize", SSAO_KERNEL_SIZE);
+    CShaderProgram* prog = self->UsesHardwareDepth() ? self->_ssaoProgHWDepth : self->_ssaoProg;
+    prog->Use();
+    self->SetCommonUniforms(prog, glm::mat4());
+    prog->SetUniform("uDepthTex", self->GetDepthTexture(), 0);
+    prog->SetUniform("uNormalTex", self->GetRTTexture(IScene::RT_NORMAL), 1);
+    prog->SetUniform("uRandomTex", *self->_ssaoRandom, 2);
+    prog->SetUniform("uKernel", SSAO_KERNEL_SIZE, self->_ssaoKernel[0]);
+    prog->SetUniform("uKernelSize", SSAO_KERNEL_SIZE);
+    CGLState::Disable(GL_DEPTH_TEST); // no depth attachment, the depth source is only sampled
+    CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassSSAODownsample(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // SSAO DEPTH + NORMAL (reduced resolution)
+    CShaderProgram* prog = self->_ssaoDownsampleProg;
+    prog->Use();
+    self->SetCommonUniforms(prog, glm::mat4());
+    const CTexture& zbuffer = self->GetRTTexture(IScene::RT_ZBUFFER);
+    prog->SetUniform("uDepthTex", zbuffer, 0);
+    prog->SetUniform("uNormalTex", self->GetRTTexture(IScene::RT_NORMAL), 1);
+    prog->SetUniform("uInvTex0Size", glm::vec2(1.0f/zbuffer.GetWidth(), 1.0f/zbuffer.GetHeight()));
+    prog->SetUniform("uDownsample", (float)self->_ssaoDivisor);
+    CGLState::Disable(GL_DEPTH_TEST);
+    CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassSSAODownsampled(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // SSAO (reduced resolution)
+    CShaderProgram* prog = self->_ssaoProgDownsampled;
+    prog->Use();
+    self->SetCommonUniforms(prog, glm::mat4());
+    const CTexture& depthTex = self->GetRTTexture(IScene::RT_SSAO_DEPTH);
+    prog->SetUniform("uScreenSize", glm::vec2(depthTex.GetWidth(), depthTex.GetHeight())); // tiles the random texture per pixel
+    prog->SetUniform("uDepthTex", depthTex, 0);
+    prog->SetUniform("uRandomTex", *self->_ssaoRandom, 2);
+    if (self->UsesTemporalSSAO())
+    {
+        // a few taps of the temporal kernel, different ones and a shifted random texture every frame
+        unsigned numTaps = (unsigned)cvSSAOTemporalSamples.GetInt();
+        glm::vec3 kernel[SSAO_KERNEL_SIZE];
+        for (unsigned i=0; i<numTaps; i++)
+            kernel[i] = self->_ssaoTemporalKernel[(self->_frame*numTaps + i) % SSAO_TEMPORAL_KERNEL_SIZE];
+        prog->SetUniform("uKernel", numTaps, kernel[0]);
+        prog->SetUniform("uKernelSize", (int)numTaps);
+        
+        // texel shift of the 4x4 random texture from the R2 sequence - it doesn't repeat in step with the tap sets,
+        // so every tap set meets every shift over time
+        double r2x = fmod(0.5 + self->_frame*0.7548776662466927, 1.0);
+        double r2y = fmod(0.5 + self->_frame*0.5698402909980532, 1.0);
+        prog->SetUniform("uRandomOffset", glm::vec2(floor(r2x*4), floor(r2y*4)) * 0.25f);
+    }
+    else
+    {
+        prog->SetUniform("uKernel", SSAO_KERNEL_SIZE, self->_ssaoKernel[0]);
+        prog->SetUniform("uKernelSize", SSAO_KERNEL_SIZE);
+        prog->SetUniform("uRandomOffset", glm::vec2(0,0));
+    }
+    CGLState::Disable(GL_DEPTH_TEST);
     CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassSSAOTemporal(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // SSAO TEMPORAL ACCUMULATION
+    const CFlyCamera& cam = CEngine::Inst()->GetCamera();
+    CShaderProgram* prog = self->_ssaoTemporalProg;
+    prog->Use();
+    self->SetCommonUniforms(prog, glm::mat4());
+    prog->SetUniform("uTex0", self->GetRTTexture(IScene::RT_POSTPROCESS), 0);
+    prog->SetUniform("uDepthTex", self->GetRTTexture(IScene::RT_SSAO_DEPTH), 1);
+    prog->SetUniform("uTex1", self->GetRTTexture(IScene::RT_SSAO_HISTORY), 2);
+    prog->SetUniform("uReprojection", cam.GetPreviousMatrix() * glm::inverse(cam.GetView()));
+    prog->SetUniform("uMaxFrames", (float)cvSSAOTemporalFrames.GetInt());
+    CGLState::Disable(GL_DEPTH_TEST);
+    CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassSSAOHistory(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    
+    // SSAO HISTORY for the next frame (copy)
+    self->_fullscreenQuadProg->Use();
+    self->_fullscreenQuadProg->SetUniform("uTex0", self->GetRTTexture(IScene::RT_SSAO_TEMPORAL), 0);
+    CGLState::Disable(GL_DEPTH_TEST);
+    CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassSSAOBlur(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
     // SSAO BLUR
-    GetRT().Use(CRenderTarget::ATT_COLOR5, CRenderTarget::CLEAR_COLOR);
-    _ssaoBlurProg->Use();
-    SetCommonUniforms(_ssaoBlurProg, glm::mat4());
-    _ssaoBlurProg->SetUniform("uInvTex0Size", glm::vec2(1.0f/800, 1.0f/600)); // TODO: for now hardcodded
-    _ssaoBlurProg->SetUniform("uTex0", GetRTTexture(IScene::RT_POSTPROCESS), 0);
+    self->_ssaoBlurProg->Use();
+    self->SetCommonUniforms(self->_ssaoBlurProg, glm::mat4());
+    const CTexture& ssaoTex = self->GetRTTexture(IScene::RT_POSTPROCESS);
+    self->_ssaoBlurProg->SetUniform("uInvTex0Size", glm::vec2(1.0f/ssaoTex.GetWidth(), 1.0f/ssaoTex.GetHeight()));
+    self->_ssaoBlurProg->SetUniform("uTex0", ssaoTex, 0);
     CMesh::FullscreenQuad().Draw();
+}
+
+void CTestScene::PassForward(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
     
+    // LIT MATERIAL (lights from the clusters, only visible fragments thanks to the depth prepass)
+    self->BuildLightClusters();
+    CGLState::Enable(GL_CULL_FACE);
+    CGLState::SetCullFace(GL_BACK);
+    beginWireframe();
+    CGLState::Enable(GL_DEPTH_TEST);
+    CGLState::SetDepthMask(false); // z is complete already
+    self->_mesh->Draw(CMesh::DRAW_FORWARD);
+    endWireframe();
+}
+
+void CTestScene::PassCompositePlain(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    self->Composite(COMPOSITE_PLAIN);
+}
+
+void CTestScene::PassComposite(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    self->Composite(COMPOSITE_SSAO);
+}
+
+void CTestScene::PassCompositeUpsample(void* userData)
+{
+    CTestScene* self = (CTestScene*)userData;
+    self->Composite(COMPOSITE_SSAO_UPSAMPLE);
+}
+
+void CTestScene::Composite(EComposite mode)
+{
     // SCREEN AGAIN
-    CRenderTarget::Screen().Use(0);
     glClearColor(0, 1, 1, 1);
-    glEnable(GL_CULL_FACE); // wa don't want to render backfaces again...
+    CGLState::Enable(GL_CULL_FACE); // wa don't want to render backfaces again...
     // (no need to clear anything - we are rendering fullscreen quad (unless wireframe))
     
+    // disable z test (no need to z-test for rendering fullscreen quads, and the depth of the target isn't cleared).
+    // Z-write is already disabled (no point in doing it for fullscreen quads)
+    CGLState::Disable(GL_DEPTH_TEST);
+    
     // draw final scene to the screen
     if (cvRT.GetInt()>0)
     {
         // draw fullscreen quad with RT (for debug)
-        glDisable(GL_DEPTH_TEST); // disable z test (no need to z-test for rendering fullscreen quads). Z-write is already disabled (no point in doing it for fullscreen quads)
         _fullscreenQuadProgDebug->Use();
-        _fullscreenQuadProgDebug->SetUniform("uTex0", GetRT().GetColorTexture(cvRT.GetInt()-1));
+        _fullscreenQuadProgDebug->SetUniform("uTex0", GetRTTexture((IScene::ERT)(cvRT.GetInt()-1)));
         CMesh::FullscreenQuad().Draw();
     }
+    else if (mode == COMPOSITE_PLAIN)
+    {
+        _fullscreenQuadProg->Use();
+        _fullscreenQuadProg->SetUniform("uTex0", GetRTTexture(RT_FINAL), 0);
+    }
+    else if (mode == COMPOSITE_SSAO_UPSAMPLE)
+    {
+        CShaderProgram* prog = _fullscreenQuadProgSSAOUpsample;
+        prog->Use();
+        SetCommonUniforms(prog, glm::mat4());
+        const CTexture& ssaoTex = GetRTTexture(RT_POSTPROCESS2);
+        prog->SetUniform("uTex0", GetRTTexture(RT_FINAL), 0);
+        prog->SetUniform("uTex1", ssaoTex, 1);
+        prog->SetUniform("uInvTex1Size", glm::vec2(1.0f/ssaoTex.GetWidth(), 1.0f/ssaoTex.GetHeight()));
+        prog->SetUniform("uAODepthTex", GetRTTexture(RT_SSAO_DEPTH), 2);
+        prog->SetUniform("uDepthTex", GetRTTexture(RT_ZBUFFER), 3);
+    }
     else
     {
         // normal scene
@@ -195,7 +601,7 @@ void CTestScene::Draw()
     CMesh::FullscreenQuad().Draw();
     
     // AXIS always last :P
-    glDisable(GL_DEPTH_TEST); // disable z test (always render a visible axis)
+    CGLState::Disable(GL_DEPTH_TEST); // disable z test (always render a visible axis)
     glLineWidth(2);
     _colorProg->Use();
     CMesh::AxisLines().Draw();
@@ -15,6 +15,8 @@
 #include "Texture.h"
 
 #define SSAO_KERNEL_SIZE 8
+/// Kernel taps cycled through by temporal SSAO, a few per frame (r_ssaoTemporalSamples)
+#define SSAO_TEMPORAL_KERNEL_SIZE 16
 
 class CTestScene : public IScene
 {
@@ -24,18 +26,75 @@ public:
     void Draw();
     
 private:
+    /// r_ssao values
+    enum ESSAOPreset
+    {
+        SSAO_OFF=0,
+        SSAO_QUARTER_RES, // downsampled depth and normals, bilateral upsample in the composite
+        SSAO_HALF_RES, // likewise
+        SSAO_FULL_RES,
+        _SSAO_NUM
+    };
+    /// How the composite applies SSAO
+    enum EComposite
+    {
+        COMPOSITE_PLAIN=0,
+        COMPOSITE_SSAO,
+        COMPOSITE_SSAO_UPSAMPLE // reduced resolution AO
+    };
+    
+    // render graph passes (userData is the scene)
+    static void PassGBuffer(void* userData);
+    static void PassLinearZ(void* userData);
+    static void PassNormal(void* userData);
+    static void PassGBufferHWDepth(void* userData);
+    static void PassLights(void* userData);
+    static void PassMaterial(void* userData);
+    static void PassSSAO(void* userData);
+    static void PassSSAODownsample(void* userData);
+    static void PassSSAODownsampled(void* userData);
+    static void PassSSAOTemporal(void* userData);
+    static void PassSSAOHistory(void* userData);
+    static void PassSSAOBlur(void* userData);
+    static void PassComposite(void* userData);
+    static void PassCompositeUpsample(void* userData);
+    static void PassForward(void* userData);
+    static void PassCompositePlain(void* userData);
+    /// Draws the final image to the screen
+    void Composite(EComposite mode);
+    /// r_ssao, falling back to full resolution without float textures
+    ESSAOPreset GetSSAOPreset()const;
+    /// r_ssaoTemporal, if supported
+    bool UsesTemporalSSAO()const;
+    /// Fills the light manager with the hand-placed and r_testLights generated lights
+    void AddSceneLights();
     
     CShaderProgram* _colorProg;
     CShaderProgram* _fullscreenQuadProg;
     CShaderProgram* _fullscreenQuadProgSSAO;
+    CShaderProgram* _fullscreenQuadProgSSAOUpsample;
     CShaderProgram* _fullscreenQuadProgDebug;
     CShaderProgram* _ssaoProg;
+    CShaderProgram* _ssaoProgHWDepth;
+    CShaderProgram* _ssaoProgDownsampled;
+    CShaderProgram* _ssaoDownsampleProg;
+    CShaderProgram* _ssaoTemporalProg;
     CShaderProgram* _ssaoBlurProg;
     
     CMesh* _mesh;
     
     CTexture* _ssaoRandom;
     glm::vec3 _ssaoKernel[SSAO_KERNEL_SIZE];
+    glm::vec3 _ssaoTemporalKernel[SSAO_TEMPORAL_KERNEL_SIZE];
+    unsigned _ssaoDivisor; // of the SSAO resolution
+    unsigned _frame;
+    
+    unsigned _gbufferPass, _linearZPass, _normalPass; // alternatives, see r_gbufferMRT
+    unsigned _ssaoPass, _ssaoHWDepthPass, _ssaoDownsamplePass, _ssaoDownsampledPass, _ssaoBlurPass; // see r_ssao
+    unsigned _ssaoTemporalPass, _ssaoHistoryPass; // see r_ssaoTemporal
+    unsigned _compositePass, _compositeUpsamplePass, _compositePlainPass; // alternatives, see r_ssao
+    std::vector<unsigned> _linearDepthPasses, _hwDepthPasses; // alternatives, see r_hwDepth
+    std::vector<unsigned> _deferredPasses, _forwardPasses; // pipelines, see r_pipeline
 };
 
 #endif /* defined(__glt__TestScene__) */
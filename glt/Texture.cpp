@@ -7,26 +7,51 @@
 //
 
 #include "Texture.h"
+#include "TextureCompressor.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
 #include "Engine.h"
+#include "CVar.h"
+#include "MappedFile.h"
+#include "FileSystem.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm> // std::swap
 #include "glstuff.h"
 #include "png.h"
 #include "tgalib.h"
+
+#ifdef WIN32
+# define strcasecmp stricmp
+#endif
+
+static CVar cvTextureCompression("r_textureCompression", true);
+static CVar cvTextureCache("r_textureCache", true);
+
+#define EVICTED_STANDIN_SIZE 16 // largest dimension of the mip level kept while a texture is evicted
     
 // array from ETextureFormat to gl texture format
 static SGLTextureFormatInfo s_texFormat[] = {
-    {0, 0, 0}, //TF_NONE
-    {GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE}, // TF_RGB8
-    {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE}, // TF_RGBA8
-    {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT}, // TF_RGBA16F
-    {GL_RGBA32F, GL_RGBA, GL_FLOAT}, // TF_RGBA32F
-    {GL_LUMINANCE_ALPHA, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE}, // TF_LA8
-    {GL_DEPTH_COMPONENT32, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT}, // TF_DEPTH32
-    {GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT}, // TF_DEPTH16
-    {GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT}, // TF_DEPTH24
-    {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8}, // TF_DEPTH24S8
+    {0, 0, 0, 0}, //TF_NONE
+    {GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 0}, // TF_RGB8
+    {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 0}, // TF_RGBA8
+    {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 0}, // TF_RGBA16F
+    {GL_RGBA32F, GL_RGBA, GL_FLOAT, 0}, // TF_RGBA32F
+    {GL_LUMINANCE_ALPHA, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 0}, // TF_LA8
+    {GL_DEPTH_COMPONENT32, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0}, // TF_DEPTH32
+    {GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0}, // TF_DEPTH16
+    {GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0}, // TF_DEPTH24
+    {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 0}, // TF_DEPTH24S8
+    {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_RGB, 0, 8}, // TF_BC1
+    {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_RGBA, 0, 8}, // TF_BC1A
+    {GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_RGBA, 0, 16}, // TF_BC2
+    {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RGBA, 0, 16}, // TF_BC3
+    {GL_COMPRESSED_RED_RGTC1, GL_RED, 0, 8}, // TF_BC4
+    {GL_COMPRESSED_RG_RGTC2, GL_RG, 0, 16}, // TF_BC5
+    {GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, GL_RGBA, 0, 16}, // TF_BC7
+    {GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 0}, // TF_RGB10A2
 };
 
 const SGLTextureFormatInfo& CTexture::GLFormat(ETextureFormat fmt)
@@ -37,9 +62,94 @@ const SGLTextureFormatInfo& CTexture::GLFormat(ETextureFormat fmt)
     return s_texFormat[fmt];
 }
 
+bool CTexture::IsSupported(ETextureFormat fmt)
+{
+    const CEngine::SRendererCaps& caps = CEngine::Inst()->GetRendererCapabilities();
+    
+    switch(fmt)
+    {
+        case TF_NONE: return false;
+        case TF_RGBA16F:
+        case TF_RGBA32F: return caps.floatTextures;
+        case TF_DEPTH24S8: return caps.packedDepthStencil;
+        case TF_BC1:
+        case TF_BC1A:
+        case TF_BC2:
+        case TF_BC3: return caps.textureCompressionS3TC;
+        case TF_BC4:
+        case TF_BC5: return caps.textureCompressionRGTC;
+        case TF_BC7: return caps.textureCompressionBPTC;
+        default: return true;
+    }
+}
+
+unsigned CTexture::CompressedSize(ETextureFormat fmt, unsigned wid, unsigned hei)
+{
+    unsigned blocksX = Max(1u, (wid+3)/4);
+    unsigned blocksY = Max(1u, (hei+3)/4);
+    return blocksX * blocksY * GLFormat(fmt).blockBytes;
+}
+
+unsigned CTexture::MipSize(ETextureFormat fmt, unsigned wid, unsigned hei)
+{
+    if (IsCompressed(fmt))
+        return CompressedSize(fmt, wid, hei);
+    
+    switch(fmt)
+    {
+        case TF_RGB8: return wid*hei*3;
+        case TF_LA8:
+        case TF_DEPTH16: return wid*hei*2;
+        case TF_RGBA16F: return wid*hei*8;
+        case TF_RGBA32F: return wid*hei*16;
+        default: return wid*hei*4;
+    }
+}
+
+/// Byte offset of the level in a mip chain stored largest first
+static unsigned mipOffset(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned level)
+{
+    unsigned offset = 0;
+    for (unsigned l=0; l<level; l++)
+        offset += CTexture::MipSize(fmt, Max(1u, wid>>l), Max(1u, hei>>l));
+    return offset;
+}
+
 CTexture::~CTexture()
 {
-    if (_gltex && !_doNotDeleteTexture) glDeleteTextures(1, &_gltex);
+    if (_streamSource || _restoring) CTextureStreamer::Inst()->Unregister(this);
+    delete _streamSource;
+    
+    CGPUMemory::Inst()->Unregister(this);
+    CGPUMemory::Inst()->Freed(GPUMEM_TEXTURE, _gpuBytes);
+    
+    if (_gltex && !_doNotDeleteTexture)
+    {
+        ForgetGLTexture(_gltex);
+        glDeleteTextures(1, &_gltex);
+    }
+}
+
+void STextureImage::Clear()
+{
+    free(ownedData);
+    delete mapping;
+    
+    format = TF_NONE;
+    width = height = numMips = 0;
+    data = ownedData = NULL;
+    mapping = NULL;
+}
+
+void STextureImage::Swap(STextureImage& other)
+{
+    std::swap(format, other.format);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(numMips, other.numMips);
+    std::swap(data, other.data);
+    std::swap(ownedData, other.ownedData);
+    std::swap(mapping, other.mapping);
 }
 
 struct SDataMem
@@ -53,23 +163,11 @@ struct SDataMem
 static SDataMem loadWholeFile(const char* path)
 {
     SDataMem r;
-    r.mem = NULL;
-    
-    FILE* fp = fopen(path, "rb");
-    if (!fp) return r;
-    
-    fseek(fp, 0, SEEK_END);
-    unsigned size = (unsigned)ftell(fp);
-    fseek(fp, 0, SEEK_SET);
     
-    char* mem = (char*)malloc(size);
-    if (!mem) return r;
-    
-    if (fread(mem, size, 1, fp) != 1)
-    {
-        fclose(fp);
+    char* mem;
+    unsigned size;
+    if (!CFileSystem::Inst()->ReadFile(path, mem, size))
         return r;
-    }
     
     r.mem = mem;
     r.len = size;
@@ -92,50 +190,103 @@ static void pngError(png_structp png, png_const_charp err)
     printf("PNG ERROR/WARNING: %s\n", err);
 }
 
-bool CTexture::CreateTexture(unsigned wid, unsigned hei, ETextureFormat pixFormat, const char* textureData)
+bool CTexture::CreateTexture(unsigned wid, unsigned hei, ETextureFormat pixFormat, const char* textureData, unsigned numMips, unsigned firstLevel)
 {
     _width = wid;
     _height = hei;
+    _format = pixFormat;
+    
+    // compressed data can't be mipmapped by the GPU, so there must be at least the precomputed first level
+    if (!numMips && IsCompressed(pixFormat)) numMips = 1;
+    
+    _numMips = numMips;
+    _residentLevel = firstLevel = Min(firstLevel, numMips ? numMips-1 : 0);
     
     glGenTextures(1, &_gltex);
     PrintGLError("generating texture");
-	glBindTexture(GL_TEXTURE_2D, _gltex);
+	BindForEdit(GL_TEXTURE_2D, _gltex);
     PrintGLError("binding texture");
     
-    // set texture parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR/*for mipmaps, otherwise would use GL_LINEAR*/);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture parameters (used when sampler objects are not available)
+    SetSamplerParams(GL_TEXTURE_2D);
+    _sampler = SS_TRILINEAR_REPEAT;
+    
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    
+    if (!numMips)
+    {
+        const SGLTextureFormatInfo& fi = GLFormat(pixFormat);
+        glTexImage2D(GL_TEXTURE_2D, 0/*level*/, fi.internalFormat, wid, hei, 0, fi.format, fi.type, textureData);
+        PrintGLError("uploading texture data");
+        
+        glGenerateMipmap(GL_TEXTURE_2D);
+        PrintGLError("generating mipmaps");
+        
+        AccountGPUMemory();
+        return true;
+    }
+    
+    // upload the precomputed chain (or its tail)
+    const char* levelData = textureData + mipOffset(pixFormat, wid, hei, firstLevel);
+    for (unsigned level=firstLevel; level<numMips; level++)
+    {
+        UploadLevel(level, levelData);
+        levelData += MipSize(pixFormat, Max(1u, wid>>level), Max(1u, hei>>level));
+    }
+    
+    // make the texture complete even if the chain doesn't go down to 1x1 or doesn't start at level 0
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numMips-1);
+    PrintGLError("setting base and max mip level");
+    
+    AccountGPUMemory();
+    return true;
+}
+
+void CTexture::SetSamplerParams(unsigned target)
+{
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR/*for mipmaps, otherwise would use GL_LINEAR*/);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameterf(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
     PrintGLError("setting texture filtering and wrapping");
     
     int aniso = Min(CEngine::Inst()->GetRendererConfig().textureAnisotropy, CEngine::Inst()->GetRendererCapabilities().maxTextureAnisotropy);
     if (aniso>0)
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+        glTexParameteri(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
         PrintGLError("setting texture anisotropy");
     }
+}
+
+void CTexture::UploadLevel(unsigned level, const char* levelData)
+{
+    const SGLTextureFormatInfo& fi = GLFormat(_format);
+    unsigned mipWid = Max(1u, _width>>level);
+    unsigned mipHei = Max(1u, _height>>level);
     
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    
-    //if (comprformat)
-    //    glCompressedTexImage2D(GL_TEXTURE_2D, 0, comprformat, wid, hei, 0, (bitsPerPixel*width*height)/8, textureData);
-	//else
-    glTexImage2D(GL_TEXTURE_2D, 0/*level*/, GLFormat(pixFormat).internalFormat, wid, hei, 0, GLFormat(pixFormat).format, GLFormat(pixFormat).type, textureData);
-    PrintGLError("uploading texture data");
-    
-    glGenerateMipmap(GL_TEXTURE_2D);
-    PrintGLError("generating mipmaps");
-    
-    return true;
+    if (IsCompressed(_format))
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, fi.internalFormat, mipWid, mipHei, 0, CompressedSize(_format, mipWid, mipHei), levelData);
+        PrintGLError("uploading compressed texture data");
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, level, fi.internalFormat, mipWid, mipHei, 0, fi.format, fi.type, levelData);
+        PrintGLError("uploading texture data");
+    }
 }
 
-bool CTexture::LoadAsTGA(const char* path)
+bool CTexture::LoadAsTGA(const char* path, const char* sourcePath, STextureImage& outImage)const
 {
-    tgaInfo* tga = tgaLoad(path);
+    SDataMem dm = loadWholeFile(path);
+    if (!dm.mem) return false;
+    
+    tgaInfo* tga = tgaLoadFromMemory((const unsigned char*)dm.mem, dm.len);
+    free(dm.mem);
     if (!tga) return false;
     
-    if (tga->type != TGA_OK)
+    if (tga->status != TGA_OK)
     {
         tgaDestroy(tga);
         return false;
@@ -155,18 +306,18 @@ bool CTexture::LoadAsTGA(const char* path)
     else
         printf("%s: Unknown format with %u components\n", GetName(), components);
     
-    if (!CreateTexture(tga->width, tga->height, pixFormat, (const char*)tga->imageData))
+    if (pixFormat == TF_NONE || !PrepareImage(tga->width, tga->height, components, (const char*)tga->imageData, sourcePath, outImage))
     {
         tgaDestroy(tga);
         return false;
     }
     
     tgaDestroy(tga);
-    printf("%s: TGA Texture loaded\n", GetName());
+    printf("%s: TGA Texture decoded\n", GetName());
     return true;
 }
 
-bool CTexture::LoadAsPNG(const char* path)
+bool CTexture::LoadAsPNG(const char* path, const char* sourcePath, STextureImage& outImage)const
 {
     SDataMem dm = loadWholeFile(path);
     
@@ -179,6 +330,7 @@ bool CTexture::LoadAsPNG(const char* path)
     if(!png_check_sig((const png_bytep)dm.mem, 8))
     {
         //printf("%s: Failed to load the texture. File %s is not a valid PNG file!\n", GetName(), path);
+        free(dm.mem);
         return false;
     }
     
@@ -262,6 +414,7 @@ bool CTexture::LoadAsPNG(const char* path)
     
     // close
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    free(dm.mem);
     
     // get the right GL format
     ETextureFormat pixFormat = TF_NONE;
@@ -276,7 +429,7 @@ bool CTexture::LoadAsPNG(const char* path)
     else
         printf("%s: Unknown format with %u components\n", GetName(), components);
     
-    if (!CreateTexture(wid, hei, pixFormat, textureData))
+    if (pixFormat == TF_NONE || !PrepareImage(wid, hei, components, textureData, sourcePath, outImage))
     {
         free(row_pointers);
         free(textureData);
@@ -286,33 +439,970 @@ bool CTexture::LoadAsPNG(const char* path)
     free(textureData);
     free(row_pointers); // oh do I need to do it manually??!!!
     
-    printf("%s: PNG Texture loaded\n", GetName());
+    printf("%s: PNG Texture decoded\n", GetName());
     return true;
 }
 
-bool CTexture::LoadFromFile(const char* path)
+// DDS file layout (see http://msdn.microsoft.com/en-us/library/windows/desktop/bb943991.aspx)
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDPF_ALPHAPIXELS 0x1
+#define DDPF_FOURCC 0x4
+#define DDS_FOURCC(a,b,c,d) ((unsigned)(a) | ((unsigned)(b)<<8) | ((unsigned)(c)<<16) | ((unsigned)(d)<<24))
+
+struct SDDSPixelFormat
+{
+    unsigned size;
+    unsigned flags;
+    unsigned fourCC;
+    unsigned rgbBitCount;
+    unsigned rBitMask, gBitMask, bBitMask, aBitMask;
+};
+
+struct SDDSHeader
+{
+    unsigned size;
+    unsigned flags;
+    unsigned height;
+    unsigned width;
+    unsigned pitchOrLinearSize;
+    unsigned depth;
+    unsigned mipMapCount;
+    unsigned reserved1[11];
+    SDDSPixelFormat pf;
+    unsigned caps, caps2, caps3, caps4;
+    unsigned reserved2;
+};
+
+struct SDDSHeaderDX10
+{
+    unsigned dxgiFormat;
+    unsigned resourceDimension;
+    unsigned miscFlag;
+    unsigned arraySize;
+    unsigned miscFlags2;
+};
+
+static ETextureFormat formatFromDXGI(unsigned dxgiFormat)
+{
+    switch(dxgiFormat)
+    {
+        case 71: case 72: return TF_BC1A; // DXGI_FORMAT_BC1_UNORM(_SRGB)
+        case 74: case 75: return TF_BC2; // DXGI_FORMAT_BC2_UNORM(_SRGB)
+        case 77: case 78: return TF_BC3; // DXGI_FORMAT_BC3_UNORM(_SRGB)
+        case 80: return TF_BC4; // DXGI_FORMAT_BC4_UNORM
+        case 83: return TF_BC5; // DXGI_FORMAT_BC5_UNORM
+        case 98: case 99: return TF_BC7; // DXGI_FORMAT_BC7_UNORM(_SRGB)
+        default: return TF_NONE;
+    }
+}
+
+/// Counts how many mip levels of the chain fit into dataLen bytes
+static unsigned countCompressedMips(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips, unsigned dataLen)
+{
+    unsigned levels = 0, offset = 0;
+    for (; levels<numMips; levels++)
+    {
+        unsigned mipSize = CTexture::CompressedSize(fmt, wid, hei);
+        if (offset + mipSize > dataLen) break;
+        
+        offset += mipSize;
+        wid = Max(1u, wid/2);
+        hei = Max(1u, hei/2);
+    }
+    return levels;
+}
+
+bool CTexture::LoadAsDDS(const char* path, STextureImage& outImage)const
+{
+    SDataMem dm = loadWholeFile(path);
+    if (!dm.mem) return false;
+    
+    if (dm.len < 4 + sizeof(SDDSHeader) || *(unsigned*)dm.mem != DDS_MAGIC)
+    {
+        free(dm.mem);
+        return false;
+    }
+    
+    const SDDSHeader* hdr = (const SDDSHeader*)(dm.mem + 4);
+    unsigned dataOffset = 4 + sizeof(SDDSHeader);
+    
+    ETextureFormat pixFormat = TF_NONE;
+    if (hdr->pf.flags & DDPF_FOURCC)
+    {
+        unsigned fourCC = hdr->pf.fourCC;
+        if (fourCC == DDS_FOURCC('D','X','1','0'))
+        {
+            if (dm.len < dataOffset + sizeof(SDDSHeaderDX10))
+            {
+                printf("%s: Truncated DDS DX10 header\n", GetName());
+                free(dm.mem);
+                return false;
+            }
+            const SDDSHeaderDX10* hdr10 = (const SDDSHeaderDX10*)(dm.mem + dataOffset);
+            dataOffset += sizeof(SDDSHeaderDX10);
+            
+            if (hdr10->arraySize > 1)
+                printf("%s: DDS texture array is not supported, using the first element\n", GetName());
+            
+            pixFormat = formatFromDXGI(hdr10->dxgiFormat);
+        }
+        else if (fourCC == DDS_FOURCC('D','X','T','1'))
+            pixFormat = (hdr->pf.flags & DDPF_ALPHAPIXELS) ? TF_BC1A : TF_BC1;
+        else if (fourCC == DDS_FOURCC('D','X','T','3'))
+            pixFormat = TF_BC2;
+        else if (fourCC == DDS_FOURCC('D','X','T','5'))
+            pixFormat = TF_BC3;
+        else if (fourCC == DDS_FOURCC('A','T','I','1') || fourCC == DDS_FOURCC('B','C','4','U'))
+            pixFormat = TF_BC4;
+        else if (fourCC == DDS_FOURCC('A','T','I','2') || fourCC == DDS_FOURCC('B','C','5','U'))
+            pixFormat = TF_BC5;
+    }
+    
+    if (pixFormat == TF_NONE)
+    {
+        printf("%s: Unsupported DDS pixel format (only block-compressed BC1-BC5 and BC7 are supported)\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    if (!IsSupported(pixFormat))
+    {
+        printf("%s: Compressed format of the DDS is not supported by the renderer\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    
+    unsigned numMips = Max(1u, hdr->mipMapCount);
+    numMips = countCompressedMips(pixFormat, hdr->width, hdr->height, numMips, dm.len - dataOffset);
+    if (!numMips)
+    {
+        printf("%s: Truncated DDS data\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    
+    outImage.Clear();
+    outImage.format = pixFormat;
+    outImage.width = hdr->width;
+    outImage.height = hdr->height;
+    outImage.numMips = numMips;
+    outImage.data = dm.mem + dataOffset;
+    outImage.ownedData = dm.mem;
+    
+    printf("%s: DDS Texture read (%u mips)\n", GetName(), numMips);
+    return true;
+}
+
+// KTX 1.1 file layout (see https://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/)
+static const unsigned char s_ktxIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct SKTXHeader
+{
+    unsigned char identifier[12];
+    unsigned endianness;
+    unsigned glType;
+    unsigned glTypeSize;
+    unsigned glFormat;
+    unsigned glInternalFormat;
+    unsigned glBaseInternalFormat;
+    unsigned pixelWidth;
+    unsigned pixelHeight;
+    unsigned pixelDepth;
+    unsigned numberOfArrayElements;
+    unsigned numberOfFaces;
+    unsigned numberOfMipmapLevels;
+    unsigned bytesOfKeyValueData;
+};
+
+bool CTexture::LoadAsKTX(const char* path, STextureImage& outImage)const
+{
+    SDataMem dm = loadWholeFile(path);
+    if (!dm.mem) return false;
+    
+    const SKTXHeader* hdr = (const SKTXHeader*)dm.mem;
+    if (dm.len < sizeof(SKTXHeader) || memcmp(hdr->identifier, s_ktxIdentifier, sizeof(s_ktxIdentifier)))
+    {
+        free(dm.mem);
+        return false;
+    }
+    
+    if (hdr->endianness != 0x04030201)
+    {
+        printf("%s: KTX with foreign endianness is not supported\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    if (hdr->pixelDepth > 1 || hdr->numberOfArrayElements > 1 || hdr->numberOfFaces > 1)
+    {
+        printf("%s: Only 2D KTX textures are supported\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    
+    // find the matching compressed format
+    ETextureFormat pixFormat = TF_NONE;
+    for (unsigned f=0; f<sizeof(s_texFormat)/sizeof(SGLTextureFormatInfo); f++)
+        if (s_texFormat[f].blockBytes && (unsigned)s_texFormat[f].internalFormat == hdr->glInternalFormat)
+        {
+            pixFormat = (ETextureFormat)f;
+            break;
+        }
+    
+    if (pixFormat == TF_NONE)
+    {
+        printf("%s: Unsupported KTX internal format 0x%x (only block-compressed BC1-BC5 and BC7 are supported)\n", GetName(), hdr->glInternalFormat);
+        free(dm.mem);
+        return false;
+    }
+    if (!IsSupported(pixFormat))
+    {
+        printf("%s: Compressed format of the KTX is not supported by the renderer\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    
+    unsigned wid = hdr->pixelWidth;
+    unsigned hei = hdr->pixelHeight;
+    unsigned numMips = Max(1u, hdr->numberOfMipmapLevels);
+    unsigned offset = sizeof(SKTXHeader) + hdr->bytesOfKeyValueData;
+    
+    // KTX prefixes each mip with its size; repack the levels into a contiguous chain (in place, from the buffer start)
+    unsigned chainLen = 0;
+    unsigned levels = 0;
+    unsigned mipWid = wid, mipHei = hei;
+    for (; levels<numMips; levels++)
+    {
+        if (offset + 4 > dm.len) break;
+        unsigned imageSize = *(unsigned*)(dm.mem + offset);
+        if (imageSize != CompressedSize(pixFormat, mipWid, mipHei) || offset + 4 + imageSize > dm.len) break;
+        
+        memmove(dm.mem + chainLen, dm.mem + offset + 4, imageSize);
+        chainLen += imageSize;
+        offset += 4 + ((imageSize + 3) & ~3u);
+        mipWid = Max(1u, mipWid/2);
+        mipHei = Max(1u, mipHei/2);
+    }
+    
+    if (!levels)
+    {
+        printf("%s: Truncated KTX data\n", GetName());
+        free(dm.mem);
+        return false;
+    }
+    
+    outImage.Clear();
+    outImage.format = pixFormat;
+    outImage.width = wid;
+    outImage.height = hei;
+    outImage.numMips = levels;
+    outImage.data = dm.mem;
+    outImage.ownedData = dm.mem;
+    
+    printf("%s: KTX Texture read (%u mips)\n", GetName(), levels);
+    return true;
+}
+
+bool CTexture::PrepareImage(unsigned wid, unsigned hei, unsigned components, const char* pixels, const char* sourcePath, STextureImage& outImage)const
+{
+    outImage.Clear();
+    outImage.width = wid;
+    outImage.height = hei;
+    
+    // the whole chain is built on the CPU so it can be cached; only LA8 is left to the driver
+    unsigned numMips = 0;
+    unsigned char* chain = CTextureCompressor::BuildMipChainRGBA(wid, hei, components, (const unsigned char*)pixels, numMips);
+    if (!chain)
+    {
+        unsigned len = wid*hei*components;
+        outImage.format = components==4 ? TF_RGBA8 : components==3 ? TF_RGB8 : TF_LA8;
+        outImage.ownedData = (char*)malloc(len);
+        if (!outImage.ownedData) return false;
+        
+        memcpy(outImage.ownedData, pixels, len);
+        outImage.data = outImage.ownedData;
+        return true;
+    }
+    
+    ETextureFormat fmt = TF_NONE;
+    if (cvTextureCompression)
+        fmt = CTextureCompressor::ChooseFormat(GetName(), components, (const unsigned char*)pixels, wid*hei);
+    
+    unsigned blocksLen = 0;
+    unsigned char* blocks = NULL;
+    if (fmt != TF_NONE)
+    {
+        blocksLen = CTextureCompressor::MipChainSize(fmt, wid, hei, numMips);
+        blocks = (unsigned char*)malloc(blocksLen);
+        
+        CTextureCompressor::SStats stats;
+        if (blocks && CTextureCompressor::CompressMipChain(fmt, wid, hei, numMips, chain, blocks, &stats))
+        {
+            static const char* s_fmtNames[] = {"BC1", "BC1A", "BC2", "BC3", "BC4", "BC5", "BC7"};
+            printf("%s: %s encoded %.2f MPix in %.1f ms (%.1f MPix/s), PSNR %.2f dB\n", GetName(), s_fmtNames[fmt-TF_BC1],
+                   stats.pixels/1e6, stats.seconds*1000, stats.seconds>0 ? stats.pixels/stats.seconds/1e6 : 0.0, stats.psnr);
+        }
+        else
+        {
+            free(blocks);
+            blocks = NULL;
+        }
+    }
+    
+    outImage.numMips = numMips;
+    if (blocks)
+    {
+        free(chain);
+        outImage.format = fmt;
+        outImage.ownedData = (char*)blocks;
+        outImage.data = outImage.ownedData;
+    }
+    else
+    {
+        // keep uncompressed levels
+        blocksLen = 0;
+        for (unsigned level=0, w=wid, h=hei; level<numMips; level++, w=Max(1u, w/2), h=Max(1u, h/2))
+            blocksLen += w*h*4;
+        
+        outImage.format = TF_RGBA8;
+        outImage.ownedData = (char*)chain;
+        outImage.data = outImage.ownedData;
+    }
+    
+    if (sourcePath && cvTextureCache)
+        CTextureCache::Store(sourcePath, GetName(), cvTextureCompression, outImage.format, wid, hei, numMips, outImage.data, blocksLen);
+    
+    return true;
+}
+
+enum EImageFileType
+{
+    IFT_UNKNOWN=0,
+    IFT_PNG,
+    IFT_TGA,
+    IFT_DDS,
+    IFT_KTX
+};
+
+/// Picks the decoder by the extension; files with other extensions are identified by their first bytes
+static EImageFileType imageFileType(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    if (ext && !strchr(ext, '/'))
+    {
+        if (!strcasecmp(ext, ".png")) return IFT_PNG;
+        if (!strcasecmp(ext, ".tga")) return IFT_TGA;
+        if (!strcasecmp(ext, ".dds")) return IFT_DDS;
+        if (!strcasecmp(ext, ".ktx")) return IFT_KTX;
+    }
+    
+    char header[12];
+    unsigned len = 0;
+    if (!CFileSystem::Inst()->ReadFileHeader(path, header, sizeof(header), len))
+        return IFT_UNKNOWN;
+    
+    if (len >= 8 && !png_sig_cmp((png_bytep)header, 0, 8))
+        return IFT_PNG;
+    if (len >= 4 && *(unsigned*)header == DDS_MAGIC)
+        return IFT_DDS;
+    if (len >= sizeof(s_ktxIdentifier) && !memcmp(header, s_ktxIdentifier, sizeof(s_ktxIdentifier)))
+        return IFT_KTX;
+    return IFT_TGA; // has no magic number
+}
+
+static bool fileExists(const char* path)
+{
+    unsigned long long size, mtime;
+    return CFileSystem::Inst()->Stat(path, size, mtime);
+}
+
+bool CTexture::DecodeFile(const char* path, STextureImage& outImage)
 {
     if (!path || !*path) return false;
     
+    _sourcePaths.assign(1, std::string(path));
     _name = basename(const_cast<char*>(path));
     
-    if (LoadAsPNG(path))
-        return true;
+    return DecodeImage(path, outImage);
+}
+
+bool CTexture::DecodeImage(const char* path, STextureImage& outImage)const
+{
+    EImageFileType type = imageFileType(path);
+    if (type == IFT_UNKNOWN)
+        return false;
     
-    if (LoadAsTGA(path))
-        return true;
+    // prefer a pre-compressed sibling with precomputed mips (e.g. lion.dds next to lion.png), even over
+    // a cache entry made before it was added; siblings are only read when they exist
+    unsigned pathLen = (unsigned)strlen(path);
+    if ((type == IFT_PNG || type == IFT_TGA) && pathLen>4 && path[pathLen-4] == '.' && pathLen < 1024)
+    {
+        char tmpPath[1024];
+        strcpy(tmpPath, path);
+        
+        strcpy(&tmpPath[pathLen-4], ".dds");
+        if (fileExists(tmpPath) && LoadAsDDS(tmpPath, outImage))
+            return true;
         
-    return false;
+        strcpy(&tmpPath[pathLen-4], ".ktx");
+        if (fileExists(tmpPath) && LoadAsKTX(tmpPath, outImage))
+            return true;
+    }
+    
+    // use the pixels decoded (and compressed) in a previous run; it only stats the source
+    if (cvTextureCache && type != IFT_DDS && type != IFT_KTX)
+    {
+        CMappedFile* mapping = new CMappedFile();
+        const CTextureCache::SHeader* hdr = NULL;
+        const char* data = NULL;
+        if (CTextureCache::Map(path, GetName(), cvTextureCompression, *mapping, hdr, data))
+        {
+            outImage.Clear();
+            outImage.format = (ETextureFormat)hdr->format;
+            outImage.width = hdr->width;
+            outImage.height = hdr->height;
+            outImage.numMips = hdr->numMips;
+            outImage.data = data;
+            outImage.mapping = mapping;
+            
+            printf("%s: Texture mapped from the cache (%u mips)\n", GetName(), hdr->numMips);
+            return true;
+        }
+        delete mapping;
+    }
+    
+    switch (type)
+    {
+        case IFT_PNG: return LoadAsPNG(path, path, outImage);
+        case IFT_TGA: return LoadAsTGA(path, path, outImage);
+        case IFT_DDS: return LoadAsDDS(path, outImage);
+        case IFT_KTX: return LoadAsKTX(path, outImage);
+        default: return false;
+    }
 }
 
-void CTexture::Use(unsigned unit)const
+bool CTexture::Upload(const STextureImage& image)
+{
+    if (!image.data || image.format == TF_NONE)
+        return false;
+    
+    if (!CreateTexture(image.width, image.height, image.format, image.data, image.numMips))
+        return false;
+    
+    if (_sourcePaths.size())
+        CGPUMemory::Inst()->Register(this);
+    return true;
+}
+
+bool CTexture::LoadFromFile(const char* path)
+{
+    STextureImage image;
+    if (!DecodeFile(path, image))
+        return false;
+    
+    return Upload(image);
+}
+
+bool CTexture::UploadArray(const STextureImage* const* images, unsigned numLayers, const std::string* sourcePaths)
+{
+    const CEngine::SRendererCaps& caps = CEngine::Inst()->GetRendererCapabilities();
+    if (!numLayers || !caps.textureArray || (int)numLayers > caps.maxArrayTextureLayers)
+        return false;
+    
+    const STextureImage& first = *images[0];
+    for (unsigned i=0; i<numLayers; i++)
+    {
+        const STextureImage& img = *images[i];
+        if (!img.data || img.format == TF_NONE || img.format != first.format || img.width != first.width
+            || img.height != first.height || img.numMips != first.numMips)
+        {
+            printf("%s: Layer %u doesn't match the texture array format\n", GetName(), i);
+            return false;
+        }
+    }
+    
+    _width = first.width;
+    _height = first.height;
+    _format = first.format;
+    _numMips = first.numMips;
+    _numLayers = numLayers;
+    _residentLevel = 0;
+    
+    // compressed data can't be mipmapped by the GPU
+    bool generateMips = !_numMips && !IsCompressed(_format);
+    unsigned numLevels = Max(1u, _numMips);
+    
+    glGenTextures(1, &_gltex);
+    PrintGLError("generating texture");
+	BindForEdit(GL_TEXTURE_2D_ARRAY, _gltex);
+    PrintGLError("binding texture");
+    
+    SetSamplerParams(GL_TEXTURE_2D_ARRAY);
+    _sampler = SS_TRILINEAR_REPEAT;
+    
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    
+    const SGLTextureFormatInfo& fi = GLFormat(_format);
+    for (unsigned level=0; level<numLevels; level++)
+    {
+        unsigned mipWid = Max(1u, _width>>level);
+        unsigned mipHei = Max(1u, _height>>level);
+        unsigned mipSize = MipSize(_format, mipWid, mipHei);
+        unsigned offset = mipOffset(_format, _width, _height, level);
+        
+        // allocate the level for all layers, then fill layer by layer
+        if (IsCompressed(_format))
+        {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, fi.internalFormat, mipWid, mipHei, numLayers, 0, mipSize*numLayers, NULL);
+            for (unsigned layer=0; layer<numLayers; layer++)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mipWid, mipHei, 1, fi.internalFormat, mipSize, images[layer]->data + offset);
+            PrintGLError("uploading compressed texture array data");
+        }
+        else
+        {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, fi.internalFormat, mipWid, mipHei, numLayers, 0, fi.format, fi.type, NULL);
+            for (unsigned layer=0; layer<numLayers; layer++)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mipWid, mipHei, 1, fi.format, fi.type, images[layer]->data + offset);
+            PrintGLError("uploading texture array data");
+        }
+    }
+    
+    if (generateMips)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        PrintGLError("generating mipmaps");
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, numLevels-1);
+        PrintGLError("setting max mip level");
+    }
+    
+    AccountGPUMemory();
+    if (sourcePaths)
+    {
+        _sourcePaths.assign(sourcePaths, sourcePaths + numLayers);
+        CGPUMemory::Inst()->Register(this);
+    }
+    
+    return true;
+}
+
+bool CTexture::UploadStreamed(STextureImage& image)
+{
+    if (!image.data || image.format == TF_NONE)
+        return false;
+    
+    // GPU generated mips can't be streamed
+    if (image.numMips < 2)
+        return Upload(image);
+    
+    unsigned firstLevel = CTextureStreamer::Inst()->GetInitialLevel(image.width, image.height, image.numMips);
+    if (!CreateTexture(image.width, image.height, image.format, image.data, image.numMips, firstLevel))
+        return false;
+    
+    _streamSource = new STextureImage();
+    _streamSource->Swap(image);
+    CTextureStreamer::Inst()->Register(this);
+    CGPUMemory::Inst()->Register(this);
+    return true;
+}
+
+unsigned CTexture::GetResidentBytes()const
+{
+    if (!_numMips)
+        return MipSize(_format, _width, _height) * 4 / 3 * Max(1u, _numLayers); // GPU generated chain
+    
+    unsigned bytes = 0;
+    for (unsigned level=_residentLevel; level<_numMips; level++)
+        bytes += MipSize(_format, Max(1u, _width>>level), Max(1u, _height>>level));
+    return bytes * Max(1u, _numLayers);
+}
+
+void CTexture::RequestLevel(unsigned level, unsigned frame)
+{
+    if (_requestFrame != frame || level < _requestedLevel)
+        _requestedLevel = level;
+    _requestFrame = frame;
+}
+
+const char* CTexture::GetLevelData(unsigned level, unsigned& outSize)const
+{
+    outSize = 0;
+    if (!_streamSource || level >= _numMips) return NULL;
+    
+    outSize = MipSize(_format, Max(1u, _width>>level), Max(1u, _height>>level));
+    return _streamSource->data + mipOffset(_format, _width, _height, level);
+}
+
+bool CTexture::StreamIn()
+{
+    if (!_streamSource || !_residentLevel)
+        return false;
+    
+    unsigned size;
+    const char* levelData = GetLevelData(_residentLevel-1, size);
+    
+    BindForEdit(GL_TEXTURE_2D, _gltex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    UploadLevel(_residentLevel-1, levelData);
+    
+    _residentLevel--;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, _residentLevel);
+    PrintGLError("streaming in a mip level");
+    
+    AccountGPUMemory();
+    return true;
+}
+
+bool CTexture::StreamOut(unsigned level)
 {
+    if (!_streamSource || level <= _residentLevel || level >= _numMips)
+        return false;
+    
+    // GL can't free single levels; make a new texture object with the smaller ones only
+    ForgetGLTexture(_gltex);
+    glDeleteTextures(1, &_gltex);
+    _gltex = 0;
+    
+    return CreateTexture(_width, _height, _format, _streamSource->data, _numMips, level);
+}
+
+void CTexture::AccountGPUMemory()
+{
+    if (_evicted) return; // the stand-in is accounted by Evict
+    
+    unsigned bytes = (_gltex && !_doNotDeleteTexture) ? GetResidentBytes() : 0;
+    if (bytes == _gpuBytes) return;
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_TEXTURE, _gpuBytes);
+    CGPUMemory::Inst()->Allocated(GPUMEM_TEXTURE, bytes);
+    _gpuBytes = bytes;
+}
+
+size_t CTexture::GetEvictableBytes()const
+{
+    if (!_gltex || _doNotDeleteTexture || _evicted)
+        return 0;
+    
+    // streamed textures are only demoted to the levels uploaded at load time
+    if (_streamSource)
+    {
+        unsigned initialLevel = CTextureStreamer::Inst()->GetInitialLevel(_width, _height, _numMips);
+        size_t bytes = 0;
+        for (unsigned level=_residentLevel; level<initialLevel; level++)
+            bytes += MipSize(_format, Max(1u, _width>>level), Max(1u, _height>>level));
+        return bytes;
+    }
+    
+    return _sourcePaths.size() ? _gpuBytes : 0;
+}
+
+size_t CTexture::Evict()
+{
+    unsigned before = _gpuBytes;
+    
+    if (_streamSource)
+    {
+        StreamOut(CTextureStreamer::Inst()->GetInitialLevel(_width, _height, _numMips));
+        return before - Min(before, _gpuBytes);
+    }
+    
+    if (!GetEvictableBytes())
+        return 0;
+    
+    unsigned standInBytes = 0;
+    unsigned standIn = CreateEvictedStandIn(standInBytes);
+    
+    ForgetGLTexture(_gltex);
+    glDeleteTextures(1, &_gltex);
+    _gltex = standIn;
+    _evicted = true;
+    
+    CGPUMemory::Inst()->Freed(GPUMEM_TEXTURE, _gpuBytes);
+    CGPUMemory::Inst()->Allocated(GPUMEM_TEXTURE, standInBytes);
+    _gpuBytes = standInBytes;
+    
+    return before - Min(before, _gpuBytes);
+}
+
+unsigned CTexture::CreateEvictedStandIn(unsigned& outBytes)const
+{
+    outBytes = 0;
+    unsigned target = _numLayers ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    unsigned numLayers = Max(1u, _numLayers);
+    
+    // the first level not larger than EVICTED_STANDIN_SIZE (or the last one of a shorter precomputed chain)
+    unsigned lastLevel = 0;
+    while (_numMips ? lastLevel+1 < _numMips : Max(_width>>lastLevel, _height>>lastLevel) > 1)
+        lastLevel++;
+    unsigned level = 0;
+    while (level < lastLevel && Max(_width>>level, _height>>level) > EVICTED_STANDIN_SIZE)
+        level++;
+    
+    unsigned wid = Max(1u, _width>>level);
+    unsigned hei = Max(1u, _height>>level);
+    std::vector<char> pixels(wid*hei*4*numLayers);
+    
+    // the driver decompresses block-compressed levels
+    BindForEdit(target, _gltex);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(target, level, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    PrintGLError("reading back a mip level for the stand-in");
+    
+    unsigned standIn = 0;
+    glGenTextures(1, &standIn);
+    BindForEdit(target, standIn);
+    const_cast<CTexture*>(this)->SetSamplerParams(target);
+    
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (_numLayers)
+        glTexImage3D(target, 0, GL_RGBA8, wid, hei, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    else
+        glTexImage2D(target, 0, GL_RGBA8, wid, hei, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+    PrintGLError("creating evicted texture stand-in");
+    
+    outBytes = (unsigned)pixels.size();
+    return standIn;
+}
+
+STextureImage* CTexture::DecodeSources()const
+{
+    unsigned numImages = GetNumSources();
+    STextureImage* images = new STextureImage[numImages];
+    
+    for (unsigned i=0; i<numImages; i++)
+    {
+        if (!DecodeImage(_sourcePaths[i].c_str(), images[i]))
+        {
+            delete[] images;
+            return NULL;
+        }
+    }
+    return images;
+}
+
+void CTexture::FinishRestore(STextureImage* images)
+{
+    if (!_evicted)
+    {
+        delete[] images;
+        return;
+    }
+    
+    // keep the stand-in; _restoring stays set so it isn't decoded again every frame
+    if (!images)
+    {
+        printf("%s: Failed to decode evicted texture, keeping its low-resolution stand-in\n", GetName());
+        return;
+    }
+    
+    unsigned standIn = _gltex;
+    _gltex = 0;
+    _evicted = false;
+    _restoring = false;
+    
+    // Upload/UploadArray account the new texture against the stand-in bytes
+    std::vector<std::string> paths = _sourcePaths;
+    unsigned numImages = (unsigned)paths.size();
+    bool restored = false;
+    if (_numLayers)
+    {
+        std::vector<const STextureImage*> layers;
+        for (unsigned i=0; i<numImages; i++)
+            layers.push_back(&images[i]);
+        restored = UploadArray(&layers[0], numImages, &paths[0]);
+    }
+    else if (numImages == 1)
+        restored = Upload(images[0]);
+    
+    delete[] images;
+    
+    if (!restored && !_gltex)
+    {
+        printf("%s: Failed to restore evicted texture, keeping its low-resolution stand-in\n", GetName());
+        _gltex = standIn;
+        _evicted = _restoring = true;
+        return;
+    }
+    
+    ForgetGLTexture(standIn);
+    glDeleteTextures(1, &standIn);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// binding tracker
+
+static const unsigned MAX_TRACKED_UNITS = 32;
+static const unsigned UNKNOWN_BINDING = 0xFFFFFFFF;
+
+struct STextureUnitState
+{
+    unsigned tex2D;
+    unsigned texArray;
+    unsigned sampler;
+};
+
+static STextureUnitState s_units[MAX_TRACKED_UNITS];
+static unsigned s_activeUnit = UNKNOWN_BINDING;
+static bool s_bindingsValid = false; // false = GL state unknown, start from scratch
+static unsigned s_samplers[SS_NUM]; // GL sampler objects, created on first use
+static CTexture::SBindStats s_frameBindStats;
+static CTexture::SBindStats s_lastFrameBindStats;
+
+static void validateBindings()
+{
+    if (s_bindingsValid) return;
+    
+    for (unsigned i=0; i<MAX_TRACKED_UNITS; i++)
+        s_units[i].tex2D = s_units[i].texArray = s_units[i].sampler = UNKNOWN_BINDING;
+    s_activeUnit = UNKNOWN_BINDING;
+    s_bindingsValid = true;
+}
+
+static void setActiveUnit(unsigned unit)
+{
+    if (s_activeUnit == unit) return;
+    
     glActiveTexture(GL_TEXTURE0 + unit);
     PrintGLError("setting active texture unit");
-    glBindTexture(GL_TEXTURE_2D, _gltex);
-    PrintGLError("binding texture");
+    s_activeUnit = unit;
 }
 
+static unsigned getSamplerObject(ESamplerState ss)
+{
+    if (ss == SS_NONE || s_samplers[ss]) return s_samplers[ss];
+    
+    glGenSamplers(1, &s_samplers[ss]);
+    PrintGLError("generating sampler object");
+    unsigned sampler = s_samplers[ss];
+    
+    if (ss == SS_TRILINEAR_REPEAT)
+    {
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        
+        int aniso = Min(CEngine::Inst()->GetRendererConfig().textureAnisotropy, CEngine::Inst()->GetRendererCapabilities().maxTextureAnisotropy);
+        if (aniso>0)
+            glSamplerParameteri(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+    }
+    else if (ss == SS_POINT_CLAMP || ss == SS_LINEAR_CLAMP)
+    {
+        GLint filter = ss == SS_POINT_CLAMP ? GL_NEAREST : GL_LINEAR;
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    PrintGLError("setting sampler parameters");
+    
+    return sampler;
+}
+
+void CTexture::Use(unsigned unit)const
+{
+    MarkUsed();
+    
+    // the stand-in gets bound until the loader thread decodes the sources again
+    if (_evicted && !_restoring)
+    {
+        const_cast<CTexture*>(this)->_restoring = true;
+        CTextureStreamer::Inst()->QueueRestore(const_cast<CTexture*>(this));
+    }
+    
+    unsigned target = _numLayers ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    
+    if (unit >= MAX_TRACKED_UNITS)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        PrintGLError("setting active texture unit");
+        s_activeUnit = unit;
+        glBindTexture(target, _gltex);
+        PrintGLError("binding texture");
+        s_frameBindStats.binds++;
+        return;
+    }
+    
+    validateBindings();
+    STextureUnitState& us = s_units[unit];
+    
+    unsigned& bound = _numLayers ? us.texArray : us.tex2D;
+    if (bound == _gltex)
+        s_frameBindStats.redundantBinds++;
+    else
+    {
+        setActiveUnit(unit);
+        glBindTexture(target, _gltex);
+        PrintGLError("binding texture");
+        bound = _gltex;
+        s_frameBindStats.binds++;
+    }
+    
+    if (CEngine::Inst()->GetRendererCapabilities().samplerObjects)
+    {
+        unsigned sampler = getSamplerObject(_sampler);
+        if (us.sampler != sampler)
+        {
+            glBindSampler(unit, sampler);
+            PrintGLError("binding sampler");
+            us.sampler = sampler;
+            s_frameBindStats.samplerBinds++;
+        }
+    }
+}
+
+void CTexture::BindForEdit(unsigned target, unsigned gltex)
+{
+    validateBindings();
+    if (s_activeUnit == UNKNOWN_BINDING)
+        setActiveUnit(0);
+    
+    glBindTexture(target, gltex);
+    
+    if (s_activeUnit < MAX_TRACKED_UNITS)
+    {
+        if (target == GL_TEXTURE_2D_ARRAY)
+            s_units[s_activeUnit].texArray = gltex;
+        else if (target == GL_TEXTURE_2D)
+            s_units[s_activeUnit].tex2D = gltex;
+    }
+}
+
+void CTexture::ForgetGLTexture(unsigned gltex)
+{
+    if (!s_bindingsValid) return;
+    
+    // GL unbinds deleted textures
+    for (unsigned i=0; i<MAX_TRACKED_UNITS; i++)
+    {
+        if (s_units[i].tex2D == gltex) s_units[i].tex2D = 0;
+        if (s_units[i].texArray == gltex) s_units[i].texArray = 0;
+    }
+}
+
+void CTexture::EndFrame()
+{
+    // don't let our samplers override textures of other code
+    if (s_bindingsValid && CEngine::Inst()->GetRendererCapabilities().samplerObjects)
+    {
+        for (unsigned i=0; i<MAX_TRACKED_UNITS; i++)
+            if (s_units[i].sampler != 0 && s_units[i].sampler != UNKNOWN_BINDING)
+                glBindSampler(i, 0);
+    }
+    s_bindingsValid = false;
+    
+    s_lastFrameBindStats = s_frameBindStats;
+    s_frameBindStats = SBindStats();
+}
+
+const CTexture::SBindStats& CTexture::GetBindStats()
+{
+    return s_lastFrameBindStats;
+}
+
+
 
 
 
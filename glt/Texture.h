@@ -10,6 +10,9 @@
 #define __glt__Texture__
 
 #include <string>
+#include <vector>
+
+#include "GPUMemory.h"
 
 enum ETextureFormat
 {
@@ -23,6 +26,25 @@ enum ETextureFormat
     TF_DEPTH16, //TODO: caps?
     TF_DEPTH24, //TODO: caps?
     TF_DEPTH24S8, //24 depth, 8 stencil SRenderCaps.packedDepthStencil must be true
+    // block-compressed formats (4x4 pixel blocks)
+    TF_BC1, // DXT1 RGB, SRenderCaps.textureCompressionS3TC must be true
+    TF_BC1A, // DXT1 RGB + 1-bit alpha, SRenderCaps.textureCompressionS3TC must be true
+    TF_BC2, // DXT3, SRenderCaps.textureCompressionS3TC must be true
+    TF_BC3, // DXT5, SRenderCaps.textureCompressionS3TC must be true
+    TF_BC4, // RGTC1 (red), SRenderCaps.textureCompressionRGTC must be true
+    TF_BC5, // RGTC2 (red+green), SRenderCaps.textureCompressionRGTC must be true
+    TF_BC7, // BPTC RGBA, SRenderCaps.textureCompressionBPTC must be true
+    TF_RGB10A2, // 10-bit RGB + 2-bit alpha (render targets)
+};
+
+/// Shared sampler objects (GL_ARB_sampler_objects) overriding the filtering and wrapping of bound textures
+enum ESamplerState
+{
+    SS_NONE=0, // parameters of the texture object are used
+    SS_TRILINEAR_REPEAT, // mipmapped, repeating, anisotropic (loaded textures)
+    SS_POINT_CLAMP, // nearest, clamped to edge (render target color attachments)
+    SS_LINEAR_CLAMP, // bilinear, clamped to edge (render targets upscaled to the screen)
+    SS_NUM
 };
 
 struct SGLTextureFormatInfo
@@ -30,9 +52,36 @@ struct SGLTextureFormatInfo
     int internalFormat; // like RGBA8
     unsigned format; // like GL_RGBA
     unsigned type; // like GL_UNSIGNED_BYTE
+    unsigned blockBytes; // bytes per 4x4 block for compressed formats, 0 otherwise
 };
 
-class CTexture
+class CMappedFile;
+
+/// Pixels of a texture ready for upload (all mips stored one after another, largest first)
+/// Produced by CTexture::DecodeFile on any thread, consumed by CTexture::Upload on the GL thread.
+struct STextureImage
+{
+    STextureImage():format(TF_NONE),width(0),height(0),numMips(0),data(0),ownedData(0),mapping(0){};
+    ~STextureImage(){ Clear(); };
+    
+    /// Frees the pixel data
+    void Clear();
+    /// Exchanges the contents (used to hand the data over without copying)
+    void Swap(STextureImage& other);
+    
+    ETextureFormat format;
+    unsigned width, height;
+    unsigned numMips; // 0 = only the first level is present, the GPU generates the rest
+    const char* data;
+    char* ownedData; // malloc'd buffer which data points into (or NULL)
+    CMappedFile* mapping; // mapped cache entry which data points into (or NULL)
+    
+private:
+    STextureImage(const STextureImage&);
+    STextureImage& operator=(const STextureImage&);
+};
+
+class CTexture : public IGPUResource
 {
     struct SGLTexture
     {
@@ -54,30 +103,146 @@ public:
         return tex->LoadFromFile(path)?tex:NULL;
     }
     static const SGLTextureFormatInfo& GLFormat(ETextureFormat fmt);
+    static bool IsCompressed(ETextureFormat fmt){ return GLFormat(fmt).blockBytes != 0; };
+    /// Returns true if the renderer can sample textures of this format
+    static bool IsSupported(ETextureFormat fmt);
+    /// Size in bytes of one mip level of a compressed format
+    static unsigned CompressedSize(ETextureFormat fmt, unsigned wid, unsigned hei);
+    /// Size in bytes of one mip level of any format
+    static unsigned MipSize(ETextureFormat fmt, unsigned wid, unsigned hei);
+    
+    /// Texture binding statistics
+    struct SBindStats
+    {
+        SBindStats():binds(0),redundantBinds(0),samplerBinds(0){};
+        
+        unsigned binds; // glBindTexture calls made by Use()
+        unsigned redundantBinds; // Use() calls skipped because the texture was already bound
+        unsigned samplerBinds;
+    };
     
     CTexture()
-    :_name("undefined"),_gltex(0),_width(0),_height(0),_doNotDeleteTexture(false){};
+    :_name("undefined"),_gltex(0),_width(0),_height(0),_format(TF_NONE),_numMips(0),_residentLevel(0),
+    _requestedLevel(0),_requestFrame(0),_streamSource(NULL),_numLayers(0),_sampler(SS_NONE),_gpuBytes(0),_evicted(false),
+    _restoring(false),_doNotDeleteTexture(false){};
     
     CTexture(const char* name, unsigned gltexture, unsigned width, unsigned height, bool doNotDeleteTexture)
-    :_name(name),_gltex(gltexture),_width(width),_height(height),_doNotDeleteTexture(doNotDeleteTexture){};
+    :_name(name),_gltex(gltexture),_width(width),_height(height),_format(TF_NONE),_numMips(0),_residentLevel(0),
+    _requestedLevel(0),_requestFrame(0),_streamSource(NULL),_numLayers(0),_sampler(SS_NONE),_gpuBytes(0),_evicted(false),
+    _restoring(false),_doNotDeleteTexture(doNotDeleteTexture){};
     
     ~CTexture();
     void Release(){}; //TODO: refcount
     
     int GetGLTexture()const{ return _gltex; }; // used by CShaderProgram
     bool IsValid()const{ return _gltex != 0; };
+    /// Binds the texture and its sampler to the unit (skipped if already bound)
     void Use(unsigned unit = 0)const;
+    ESamplerState GetSamplerState()const{ return _sampler; };
+    void SetSamplerState(ESamplerState ss){ _sampler = ss; };
+    /// For wrapped GL textures whose storage gets re-specified by the owner (render targets)
+    void SetSize(unsigned width, unsigned height){ _width = width; _height = height; };
     const char* GetName()const{ return _name.c_str(); };
+    /// Format of the GL texture (TF_NONE if not known)
+    ETextureFormat GetFormat()const{ return _format; };
     bool LoadFromFile(const char* path);
+    /// CPU part of LoadFromFile (reading, decoding, compressing). Doesn't touch GL so it can run on worker threads.
+    bool DecodeFile(const char* path, STextureImage& outImage);
+    /// GL part of LoadFromFile; must be called on the GL thread
+    bool Upload(const STextureImage& image);
+    
+    // IGPUResource - textures loaded from files are replaced by a small mip level and decoded again
+    // in the background when used, streamed textures are demoted to their initial mip level
+    size_t GetEvictableBytes()const;
+    size_t Evict();
+    /// Decodes the source files of an evicted texture (CTextureStreamer loader thread, doesn't touch GL)
+    /// \return Array of GetNumSources() images to be passed to FinishRestore, NULL on failure
+    STextureImage* DecodeSources()const;
+    unsigned GetNumSources()const{ return (unsigned)_sourcePaths.size(); };
+    /// Replaces the low-resolution stand-in of an evicted texture with the decoded images (GL thread)
+    /// \param images Result of DecodeSources (NULL if it failed), deleted here
+    void FinishRestore(STextureImage* images);
+    
+    // - binding tracker
+    /// Binds a GL texture to the active unit for modification, keeping the tracked bindings in sync
+    static void BindForEdit(unsigned target, unsigned gltex);
+    /// Must be called when a GL texture is deleted, so its recycled name isn't considered bound
+    static void ForgetGLTexture(unsigned gltex);
+    /// Unbinds samplers, forgets all tracked bindings (other code like GLV binds textures too) and closes the frame statistics
+    static void EndFrame();
+    /// Binding statistics of the last finished frame
+    static const SBindStats& GetBindStats();
+    
+    // - texture arrays
+    /// Uploads images of the same format, size and mip count as layers of one GL_TEXTURE_2D_ARRAY
+    /// \param sourcePaths Optional files of the layers, needed to restore the texture after eviction
+    bool UploadArray(const STextureImage* const* images, unsigned numLayers, const std::string* sourcePaths = NULL);
+    bool IsArray()const{ return _numLayers != 0; };
+    /// Number of layers of an array texture (0 for GL_TEXTURE_2D)
+    unsigned GetNumLayers()const{ return _numLayers; };
+    
+    // - mip streaming (see CTextureStreamer)
+    /// Takes over the image data and uploads only its smallest mips; larger ones are streamed in on demand
+    bool UploadStreamed(STextureImage& image);
+    bool IsStreamed()const{ return _streamSource != NULL; };
+    unsigned GetWidth()const{ return _width; };
+    unsigned GetHeight()const{ return _height; };
+    unsigned GetNumMips()const{ return _numMips; };
+    /// Largest mip level currently in GPU memory (GL_TEXTURE_BASE_LEVEL)
+    unsigned GetResidentLevel()const{ return _residentLevel; };
+    /// GPU memory used by the resident mip levels
+    unsigned GetResidentBytes()const;
+    /// Asks for the mip level to be resident; the largest level requested during the frame wins
+    void RequestLevel(unsigned level, unsigned frame);
+    /// Level requested in the frame or GetResidentLevel() if not requested
+    unsigned GetRequestedLevel(unsigned frame)const{ return _requestFrame == frame ? _requestedLevel : _residentLevel; };
+    unsigned GetLastRequestFrame()const{ return _requestFrame; };
+    /// Pixel data of the level in the stream source (used for prefetching)
+    const char* GetLevelData(unsigned level, unsigned& outSize)const;
+    /// Uploads the next larger mip level (GL thread)
+    bool StreamIn();
+    /// Releases mip levels larger than the level by recreating the texture (GL thread)
+    bool StreamOut(unsigned level);
     
 private:
-    bool CreateTexture(unsigned wid, unsigned hei, ETextureFormat pixFormat, const char* textureData);
-    bool LoadAsPNG(const char* path);
-    bool LoadAsTGA(const char* path);
+    /// \param numMips Number of mip levels stored one after another in textureData (largest first);
+    ///                0 = upload only the first level and let the GPU generate the rest
+    /// \param firstLevel First level to upload (levels before it are left out, the texture is clamped by GL_TEXTURE_BASE_LEVEL)
+    bool CreateTexture(unsigned wid, unsigned hei, ETextureFormat pixFormat, const char* textureData, unsigned numMips=0, unsigned firstLevel=0);
+    /// Updates CGPUMemory with the size of the resident data
+    void AccountGPUMemory();
+    /// Reads a small mip level back into a new single-level RGBA8 texture bound while evicted
+    /// \param outBytes GPU memory of the new texture
+    unsigned CreateEvictedStandIn(unsigned& outBytes)const;
+    /// Decoding part of DecodeFile, without remembering the path as the texture source
+    bool DecodeImage(const char* path, STextureImage& outImage)const;
+    /// Sets filtering, wrapping and anisotropy of the bound texture
+    void SetSamplerParams(unsigned target);
+    /// Uploads a single level into the bound texture
+    void UploadLevel(unsigned level, const char* levelData);
+    /// Builds the mip chain of decoded pixels and compresses it when possible
+    /// \param sourcePath File the pixels come from; if set, the result is stored to CTextureCache
+    bool PrepareImage(unsigned wid, unsigned hei, unsigned components, const char* pixels, const char* sourcePath, STextureImage& outImage)const;
+    bool LoadAsPNG(const char* path, const char* sourcePath, STextureImage& outImage)const;
+    bool LoadAsTGA(const char* path, const char* sourcePath, STextureImage& outImage)const;
+    bool LoadAsDDS(const char* path, STextureImage& outImage)const;
+    bool LoadAsKTX(const char* path, STextureImage& outImage)const;
     
     std::string _name;
     unsigned _gltex;
     unsigned _width, _height;
+    ETextureFormat _format;
+    unsigned _numMips; // 0 if the mips are generated by the GPU
+    unsigned _residentLevel;
+    unsigned _requestedLevel;
+    unsigned _requestFrame;
+    STextureImage* _streamSource; // full mip chain of a streamed texture, NULL otherwise
+    unsigned _numLayers; // GL_TEXTURE_2D_ARRAY layers, 0 for GL_TEXTURE_2D
+    ESamplerState _sampler;
+    std::vector<std::string> _sourcePaths; // file of the texture or of each array layer
+    unsigned _gpuBytes; // accounted in CGPUMemory
+    bool _evicted; // _gltex is a stand-in with a small mip level only
+    bool _restoring; // queued for DecodeSources in CTextureStreamer
     bool _doNotDeleteTexture;
 };
 
@@ -0,0 +1,156 @@
+//
+//  TextureCache.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "TextureCache.h"
+#include "main.h"
+#include "FileSystem.h"
+#include "Shared.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+# include <direct.h>
+# define mkdir(path, mode) _mkdir(path)
+#endif
+
+// bump when the cache layout or encoder output changes
+#define TEXTURE_CACHE_VERSION 2
+#define TEXTURE_CACHE_DIR "texcache"
+#define TEXTURE_CACHE_MAX_SIZE 16384 // larger entries are considered corrupted
+
+/// FNV-1a 64-bit
+static unsigned long long hashBytes(const void* data, unsigned len, unsigned long long hash = 14695981039346656037ULL)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (unsigned i=0; i<len; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool CTextureCache::GetEntryPath(const char* sourcePath, const char* name, bool compressed, char* outPath, unsigned outPathLen)
+{
+    // the name decides the target format (normal maps), so it's a part of the key too
+    unsigned long long hash = hashBytes(sourcePath, (unsigned)strlen(sourcePath));
+    hash = hashBytes(name, (unsigned)strlen(name), hash);
+    hash = hashBytes(&compressed, sizeof(compressed), hash);
+    
+    char dir[2048];
+    snprintf(dir, sizeof(dir), "%s/%s", GetExecutableDir(), TEXTURE_CACHE_DIR);
+    mkdir(dir, 0755); // may already exist
+    
+    return snprintf(outPath, outPathLen, "%s/%016llx.gtc", dir, hash) < (int)outPathLen;
+}
+
+/// Size of the mip chain described by the header (as stored by Store) or 0 if the header is nonsense
+static unsigned long long chainSize(const CTextureCache::SHeader* hdr)
+{
+    // only what CTexture::PrepareImage stores
+    ETextureFormat fmt = (ETextureFormat)hdr->format;
+    if (fmt != TF_RGBA8 && fmt != TF_BC1 && fmt != TF_BC1A && fmt != TF_BC3 && fmt != TF_BC4 && fmt != TF_BC5)
+        return 0;
+    
+    if (!hdr->width || !hdr->height || hdr->width > TEXTURE_CACHE_MAX_SIZE || hdr->height > TEXTURE_CACHE_MAX_SIZE)
+        return 0;
+    
+    unsigned maxMips = 1;
+    for (unsigned size=Max(hdr->width, hdr->height); size>1; size/=2)
+        maxMips++;
+    if (!hdr->numMips || hdr->numMips > maxMips)
+        return 0;
+    
+    unsigned long long bytes = 0;
+    for (unsigned level=0; level<hdr->numMips; level++)
+        bytes += CTexture::MipSize(fmt, Max(1u, hdr->width>>level), Max(1u, hdr->height>>level));
+    return bytes;
+}
+
+bool CTextureCache::Map(const char* sourcePath, const char* name, bool compressed, CMappedFile& outFile, const SHeader*& outHeader, const char*& outData)
+{
+    unsigned long long sourceSize, sourceMTime;
+    if (!CFileSystem::Inst()->Stat(sourcePath, sourceSize, sourceMTime))
+        return false;
+    
+    char path[2048];
+    if (!GetEntryPath(sourcePath, name, compressed, path, sizeof(path)))
+        return false;
+    
+    if (!outFile.Open(path))
+        return false;
+    
+    const SHeader* hdr = (const SHeader*)outFile.GetData();
+    if (outFile.GetSize() < sizeof(SHeader) || memcmp(hdr->magic, "GTC1", 4) || hdr->version != TEXTURE_CACHE_VERSION
+        || outFile.GetSize() != sizeof(SHeader) + hdr->dataLen || chainSize(hdr) != hdr->dataLen)
+    {
+        printf("%s: Ignoring invalid texture cache entry %s\n", name, path);
+        outFile.Close();
+        return false;
+    }
+    
+    // source changed since the entry was made
+    if (hdr->sourceSize != sourceSize || hdr->sourceMTime != sourceMTime)
+    {
+        outFile.Close();
+        return false;
+    }
+    
+    // made on a different machine/driver?
+    if (!CTexture::IsSupported((ETextureFormat)hdr->format))
+    {
+        outFile.Close();
+        return false;
+    }
+    
+    outHeader = hdr;
+    outData = outFile.GetData() + sizeof(SHeader);
+    return true;
+}
+
+bool CTextureCache::Store(const char* sourcePath, const char* name, bool compressed, ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips, const void* data, unsigned dataLen)
+{
+    unsigned long long sourceSize, sourceMTime;
+    if (!CFileSystem::Inst()->Stat(sourcePath, sourceSize, sourceMTime))
+        return false;
+    
+    char path[2048];
+    if (!GetEntryPath(sourcePath, name, compressed, path, sizeof(path)))
+        return false;
+    
+    SHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "GTC1", 4);
+    hdr.version = TEXTURE_CACHE_VERSION;
+    hdr.sourceSize = sourceSize;
+    hdr.sourceMTime = sourceMTime;
+    hdr.format = fmt;
+    hdr.width = wid;
+    hdr.height = hei;
+    hdr.numMips = numMips;
+    hdr.dataLen = dataLen;
+    
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+    {
+        printf("%s: Failed to create texture cache entry %s\n", name, path);
+        return false;
+    }
+    
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(data, dataLen, 1, fp) == 1;
+    fclose(fp);
+    
+    if (!ok)
+    {
+        printf("%s: Failed to write texture cache entry %s\n", name, path);
+        remove(path);
+    }
+    return ok;
+}
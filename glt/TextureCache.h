@@ -0,0 +1,46 @@
+//
+//  TextureCache.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__TextureCache__
+#define __glt__TextureCache__
+
+#include "Texture.h"
+#include "MappedFile.h"
+
+/// On-disk cache of decoded (and possibly block-compressed) images with their whole mip chain.
+/// Entries live in texcache/ next to the executable and are invalidated when the source file changes (size or mtime).
+class CTextureCache
+{
+public:
+    struct SHeader
+    {
+        char magic[4]; // "GTC1"
+        unsigned version;
+        unsigned long long sourceSize;
+        unsigned long long sourceMTime;
+        unsigned format; // ETextureFormat
+        unsigned width;
+        unsigned height;
+        unsigned numMips;
+        unsigned dataLen; // all mips, largest first (upload order), right after the header
+    };
+    
+    /// Maps an up-to-date cache entry of the source image
+    /// \param compressed Whether the entry was made with block compression enabled (separate entries)
+    /// \param outFile Mapping which keeps outHeader and outData valid
+    /// \return False if there is no valid entry
+    static bool Map(const char* sourcePath, const char* name, bool compressed, CMappedFile& outFile, const SHeader*& outHeader, const char*& outData);
+    
+    /// Stores mip chain of the source image
+    static bool Store(const char* sourcePath, const char* name, bool compressed, ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips, const void* data, unsigned dataLen);
+    
+private:
+    static bool GetEntryPath(const char* sourcePath, const char* name, bool compressed, char* outPath, unsigned outPathLen);
+};
+
+#endif /* defined(__glt__TextureCache__) */
@@ -0,0 +1,555 @@
+//
+//  TextureCompressor.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "TextureCompressor.h"
+#include "ThreadPool.h"
+#include "Shared.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define GLT_SSE2 1
+# include <emmintrin.h>
+#endif
+
+// -- helpers
+
+static inline unsigned short packRGB565(unsigned r, unsigned g, unsigned b)
+{
+    return (unsigned short)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static inline void unpackRGB565(unsigned short c, unsigned char* rgb)
+{
+    unsigned r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (unsigned char)((r << 3) | (r >> 2));
+    rgb[1] = (unsigned char)((g << 2) | (g >> 4));
+    rgb[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+/// Copies a 4x4 block of RGBA8 pixels, replicating edge pixels for images smaller than a block
+static void fetchBlock(const unsigned char* rgba, unsigned wid, unsigned hei, unsigned bx, unsigned by, unsigned char outBlock[64])
+{
+    for (unsigned y=0; y<4; y++)
+    {
+        unsigned sy = Min(by*4 + y, hei-1);
+        for (unsigned x=0; x<4; x++)
+        {
+            unsigned sx = Min(bx*4 + x, wid-1);
+            memcpy(&outBlock[(y*4+x)*4], &rgba[(sy*wid+sx)*4], 4);
+        }
+    }
+}
+
+// -- encoders
+
+/// Encodes the RGB part of the block (4-color mode, 8 bytes)
+static void encodeColorBlock(const unsigned char block[64], unsigned char* out)
+{
+    unsigned char mn[4], mx[4];
+
+#ifdef GLT_SSE2
+    __m128i p0 = _mm_loadu_si128((const __m128i*)&block[0]);
+    __m128i p1 = _mm_loadu_si128((const __m128i*)&block[16]);
+    __m128i p2 = _mm_loadu_si128((const __m128i*)&block[32]);
+    __m128i p3 = _mm_loadu_si128((const __m128i*)&block[48]);
+    
+    __m128i vmin = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+    __m128i vmax = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+    vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(1,0,3,2)));
+    vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1,0,3,2)));
+    vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(2,3,0,1)));
+    vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2,3,0,1)));
+    
+    int imin = _mm_cvtsi128_si32(vmin), imax = _mm_cvtsi128_si32(vmax);
+    memcpy(mn, &imin, 4);
+    memcpy(mx, &imax, 4);
+#else
+    mn[0] = mn[1] = mn[2] = 255;
+    mx[0] = mx[1] = mx[2] = 0;
+    for (unsigned i=0; i<16; i++)
+        for (unsigned c=0; c<3; c++)
+        {
+            mn[c] = Min(mn[c], block[i*4+c]);
+            mx[c] = Max(mx[c], block[i*4+c]);
+        }
+#endif
+
+    // inset the bounding box by 1/16 of its size to reduce the error of the end points
+    for (unsigned c=0; c<3; c++)
+    {
+        unsigned inset = (mx[c] - mn[c]) >> 4;
+        mn[c] = (unsigned char)(mn[c] + inset);
+        mx[c] = (unsigned char)(mx[c] - inset);
+    }
+    
+    // max >= min in every channel, so color0 >= color1 and the block decodes in 4-color mode
+    unsigned short color0 = packRGB565(mx[0], mx[1], mx[2]);
+    unsigned short color1 = packRGB565(mn[0], mn[1], mn[2]);
+    
+    unsigned indices = 0;
+    if (color0 != color1)
+    {
+        unsigned char c0[3], c1[3];
+        unpackRGB565(color0, c0);
+        unpackRGB565(color1, c1);
+        
+        int axis[3] = { c0[0]-c1[0], c0[1]-c1[1], c0[2]-c1[2] };
+        int axisLen2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+        
+        // projection of each pixel onto the color1->color0 axis
+        int dots[16];
+#ifdef GLT_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i base = _mm_setr_epi16(c1[0], c1[1], c1[2], 0, c1[0], c1[1], c1[2], 0);
+        __m128i dir = _mm_setr_epi16(axis[0], axis[1], axis[2], 0, axis[0], axis[1], axis[2], 0);
+        for (unsigned i=0; i<4; i++)
+        {
+            __m128i p = _mm_loadu_si128((const __m128i*)&block[i*16]);
+            __m128i lo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(p, zero), base), dir); // [p0.rg p0.b p1.rg p1.b]
+            __m128i hi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(p, zero), base), dir); // [p2.rg p2.b p3.rg p3.b]
+            lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+            hi = _mm_add_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+            __m128i d = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3,3,2,0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(3,3,2,0)));
+            _mm_storeu_si128((__m128i*)&dots[i*4], d);
+        }
+#else
+        for (unsigned i=0; i<16; i++)
+            dots[i] = (block[i*4]-c1[0])*axis[0] + (block[i*4+1]-c1[1])*axis[1] + (block[i*4+2]-c1[2])*axis[2];
+#endif
+
+        // t=0 is color1, t=3 is color0; palette order is c0, c1, 2/3c0+1/3c1, 1/3c0+2/3c1
+        static const unsigned s_remap[4] = {1, 3, 2, 0};
+        for (unsigned i=0; i<16; i++)
+        {
+            int t = (dots[i]*3 + axisLen2/2) / axisLen2;
+            t = MinMax(t, 0, 3);
+            indices |= s_remap[t] << (i*2);
+        }
+    }
+    
+    out[0] = (unsigned char)(color0 & 0xff);
+    out[1] = (unsigned char)(color0 >> 8);
+    out[2] = (unsigned char)(color1 & 0xff);
+    out[3] = (unsigned char)(color1 >> 8);
+    out[4] = (unsigned char)(indices & 0xff);
+    out[5] = (unsigned char)((indices >> 8) & 0xff);
+    out[6] = (unsigned char)((indices >> 16) & 0xff);
+    out[7] = (unsigned char)(indices >> 24);
+}
+
+/// Encodes one channel of the block as a BC4/BC3-alpha block (8-value mode, 8 bytes)
+static void encodeChannelBlock(const unsigned char block[64], unsigned channel, unsigned char* out)
+{
+    unsigned mn = 255, mx = 0;
+    for (unsigned i=0; i<16; i++)
+    {
+        unsigned v = block[i*4+channel];
+        mn = Min(mn, v);
+        mx = Max(mx, v);
+    }
+    
+    unsigned long long indices = 0;
+    if (mx != mn)
+    {
+        // t=0 is min (index 1), t=7 is max (index 0), values in between go 7..2 from min to max
+        unsigned range = mx - mn;
+        for (unsigned i=0; i<16; i++)
+        {
+            unsigned t = ((block[i*4+channel] - mn)*7 + range/2) / range;
+            unsigned idx = (t == 7) ? 0 : (t == 0) ? 1 : 8 - t;
+            indices |= (unsigned long long)idx << (i*3);
+        }
+    }
+    
+    out[0] = (unsigned char)mx;
+    out[1] = (unsigned char)mn;
+    for (unsigned b=0; b<6; b++)
+        out[2+b] = (unsigned char)((indices >> (b*8)) & 0xff);
+}
+
+static void encodeBlock(ETextureFormat fmt, const unsigned char block[64], unsigned char* out)
+{
+    switch(fmt)
+    {
+        case TF_BC1:
+        case TF_BC1A: encodeColorBlock(block, out); break;
+        case TF_BC3: encodeChannelBlock(block, 3, out); encodeColorBlock(block, out+8); break;
+        case TF_BC4: encodeChannelBlock(block, 0, out); break;
+        case TF_BC5: encodeChannelBlock(block, 0, out); encodeChannelBlock(block, 1, out+8); break;
+        default: memset(out, 0, CTexture::GLFormat(fmt).blockBytes); break;
+    }
+}
+
+// -- decoders
+
+static void decodeColorBlock(const unsigned char* in, bool allowTransparent, unsigned char outRGBA[64])
+{
+    unsigned short color0 = in[0] | (in[1] << 8);
+    unsigned short color1 = in[2] | (in[3] << 8);
+    
+    unsigned char pal[4][4];
+    unpackRGB565(color0, pal[0]);
+    unpackRGB565(color1, pal[1]);
+    pal[0][3] = pal[1][3] = pal[2][3] = pal[3][3] = 255;
+    
+    if (color0 > color1 || !allowTransparent)
+    {
+        for (unsigned c=0; c<3; c++)
+        {
+            pal[2][c] = (unsigned char)((2*pal[0][c] + pal[1][c]) / 3);
+            pal[3][c] = (unsigned char)((pal[0][c] + 2*pal[1][c]) / 3);
+        }
+    }
+    else
+    {
+        for (unsigned c=0; c<3; c++)
+        {
+            pal[2][c] = (unsigned char)((pal[0][c] + pal[1][c]) / 2);
+            pal[3][c] = 0;
+        }
+        pal[3][3] = 0;
+    }
+    
+    unsigned indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned)in[7] << 24);
+    for (unsigned i=0; i<16; i++)
+        memcpy(&outRGBA[i*4], pal[(indices >> (i*2)) & 3], 4);
+}
+
+static void decodeChannelBlock(const unsigned char* in, unsigned channel, unsigned char outRGBA[64])
+{
+    unsigned a0 = in[0], a1 = in[1];
+    unsigned pal[8];
+    pal[0] = a0;
+    pal[1] = a1;
+    if (a0 > a1)
+    {
+        for (unsigned i=1; i<7; i++)
+            pal[1+i] = ((7-i)*a0 + i*a1) / 7;
+    }
+    else
+    {
+        for (unsigned i=1; i<5; i++)
+            pal[1+i] = ((5-i)*a0 + i*a1) / 5;
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+    
+    unsigned long long indices = 0;
+    for (unsigned b=0; b<6; b++)
+        indices |= (unsigned long long)in[2+b] << (b*8);
+    
+    for (unsigned i=0; i<16; i++)
+        outRGBA[i*4+channel] = (unsigned char)pal[(indices >> (i*3)) & 7];
+}
+
+void CTextureCompressor::DecodeBlock(ETextureFormat fmt, const unsigned char* block, unsigned char outRGBA[64])
+{
+    memset(outRGBA, 0, 64);
+    for (unsigned i=0; i<16; i++)
+        outRGBA[i*4+3] = 255;
+    
+    switch(fmt)
+    {
+        case TF_BC1: decodeColorBlock(block, false, outRGBA); break;
+        case TF_BC1A: decodeColorBlock(block, true, outRGBA); break;
+        case TF_BC3: decodeColorBlock(block+8, false, outRGBA); decodeChannelBlock(block, 3, outRGBA); break;
+        case TF_BC4: decodeChannelBlock(block, 0, outRGBA); break;
+        case TF_BC5: decodeChannelBlock(block, 0, outRGBA); decodeChannelBlock(block+8, 1, outRGBA); break;
+        default: break;
+    }
+}
+
+// -- public interface
+
+ETextureFormat CTextureCompressor::ChooseFormat(const char* name, unsigned components, const unsigned char* pixels, unsigned numPixels)
+{
+    if (components < 3) return TF_NONE;
+    
+    // masked textures and normal maps with specular in alpha need the alpha block
+    bool alpha = false;
+    if (components == 4)
+    {
+        for (unsigned i=0; i<numPixels && !alpha; i++)
+            alpha = pixels[i*4+3] != 255;
+    }
+    
+    // tangent-space normal maps keep only X and Y, Z is reconstructed in the shader
+    if (name && strstr(name, "_ddn") && !alpha)
+        return CTexture::IsSupported(TF_BC5) ? TF_BC5 : TF_NONE;
+    
+    if (!CTexture::IsSupported(TF_BC1) || !CTexture::IsSupported(TF_BC3))
+        return TF_NONE;
+    
+    return alpha ? TF_BC3 : TF_BC1;
+}
+
+unsigned char* CTextureCompressor::BuildMipChainRGBA(unsigned wid, unsigned hei, unsigned components, const unsigned char* pixels, unsigned& outNumMips)
+{
+    outNumMips = 0;
+    if (components != 3 && components != 4) return NULL;
+    
+    unsigned numMips = 1, chainPixels = wid*hei;
+    for (unsigned w=wid, h=hei; w>1 || h>1; numMips++)
+    {
+        w = Max(1u, w/2);
+        h = Max(1u, h/2);
+        chainPixels += w*h;
+    }
+    
+    unsigned char* chain = (unsigned char*)malloc(chainPixels*4);
+    if (!chain) return NULL;
+    
+    // level 0
+    if (components == 4)
+        memcpy(chain, pixels, wid*hei*4);
+    else
+    {
+        for (unsigned i=0; i<wid*hei; i++)
+        {
+            chain[i*4] = pixels[i*3];
+            chain[i*4+1] = pixels[i*3+1];
+            chain[i*4+2] = pixels[i*3+2];
+            chain[i*4+3] = 255;
+        }
+    }
+    
+    // 2x2 box filter for the rest
+    unsigned char* src = chain;
+    unsigned sw = wid, sh = hei;
+    for (unsigned level=1; level<numMips; level++)
+    {
+        unsigned dw = Max(1u, sw/2), dh = Max(1u, sh/2);
+        unsigned char* dst = src + sw*sh*4;
+        
+        for (unsigned y=0; y<dh; y++)
+        {
+            unsigned y0 = Min(y*2, sh-1), y1 = Min(y*2+1, sh-1);
+            for (unsigned x=0; x<dw; x++)
+            {
+                unsigned x0 = Min(x*2, sw-1), x1 = Min(x*2+1, sw-1);
+                for (unsigned c=0; c<4; c++)
+                {
+                    unsigned sum = src[(y0*sw+x0)*4+c] + src[(y0*sw+x1)*4+c] + src[(y1*sw+x0)*4+c] + src[(y1*sw+x1)*4+c];
+                    dst[(y*dw+x)*4+c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        
+        src = dst;
+        sw = dw;
+        sh = dh;
+    }
+    
+    outNumMips = numMips;
+    return chain;
+}
+
+unsigned CTextureCompressor::MipChainSize(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips)
+{
+    unsigned size = 0;
+    for (unsigned level=0; level<numMips; level++)
+    {
+        size += CTexture::CompressedSize(fmt, wid, hei);
+        wid = Max(1u, wid/2);
+        hei = Max(1u, hei/2);
+    }
+    return size;
+}
+
+/// One row of blocks of one mip level
+struct SBlockRowJob
+{
+    const unsigned char* rgba;
+    unsigned wid, hei;
+    unsigned by;
+    unsigned char* out;
+};
+
+struct SCompressJob
+{
+    ETextureFormat fmt;
+    std::vector<SBlockRowJob> rows;
+};
+
+static void compressRowJob(unsigned index, void* userData)
+{
+    SCompressJob* job = (SCompressJob*)userData;
+    const SBlockRowJob& row = job->rows[index];
+    unsigned blockBytes = CTexture::GLFormat(job->fmt).blockBytes;
+    
+    unsigned char block[64];
+    unsigned blocksX = Max(1u, (row.wid+3)/4);
+    for (unsigned bx=0; bx<blocksX; bx++)
+    {
+        fetchBlock(row.rgba, row.wid, row.hei, bx, row.by, block);
+        encodeBlock(job->fmt, block, row.out + bx*blockBytes);
+    }
+}
+
+bool CTextureCompressor::CompressMipChain(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips, const unsigned char* rgbaChain, unsigned char* outBlocks, SStats* outStats)
+{
+    if (fmt != TF_BC1 && fmt != TF_BC1A && fmt != TF_BC3 && fmt != TF_BC4 && fmt != TF_BC5)
+    {
+        printf("Texture compressor: unsupported target format %d\n", fmt);
+        return false;
+    }
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    
+    // split all levels into rows of blocks
+    SCompressJob job;
+    job.fmt = fmt;
+    
+    const unsigned char* src = rgbaChain;
+    unsigned char* dst = outBlocks;
+    unsigned mipWid = wid, mipHei = hei, pixels = 0;
+    for (unsigned level=0; level<numMips; level++)
+    {
+        unsigned blocksX = Max(1u, (mipWid+3)/4), blocksY = Max(1u, (mipHei+3)/4);
+        for (unsigned by=0; by<blocksY; by++)
+        {
+            SBlockRowJob row;
+            row.rgba = src;
+            row.wid = mipWid;
+            row.hei = mipHei;
+            row.by = by;
+            row.out = dst + by*blocksX*CTexture::GLFormat(fmt).blockBytes;
+            job.rows.push_back(row);
+        }
+        
+        pixels += mipWid*mipHei;
+        src += mipWid*mipHei*4;
+        dst += CTexture::CompressedSize(fmt, mipWid, mipHei);
+        mipWid = Max(1u, mipWid/2);
+        mipHei = Max(1u, mipHei/2);
+    }
+    
+    CThreadPool::Inst()->ParallelFor((unsigned)job.rows.size(), compressRowJob, &job);
+    
+    if (outStats)
+    {
+        outStats->pixels = pixels;
+        outStats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        outStats->psnr = ComputePSNR(fmt, wid, hei, rgbaChain, outBlocks);
+    }
+    
+    return true;
+}
+
+bool CTextureCompressor::SelfTest()
+{
+    // normal map with a specular gradient in alpha and an opaque one
+    const unsigned wid = 64, hei = 64;
+    std::vector<unsigned char> pixels(wid*hei*4);
+    for (unsigned y=0; y<hei; y++)
+        for (unsigned x=0; x<wid; x++)
+        {
+            unsigned char* p = &pixels[(y*wid + x)*4];
+            p[0] = (unsigned char)(128 + x);
+            p[1] = (unsigned char)(128 + y);
+            p[2] = 255;
+            p[3] = (unsigned char)((x+y)*2);
+        }
+    
+    bool ok = true;
+    for (unsigned opaque=0; opaque<2; opaque++)
+    {
+        if (opaque)
+            for (unsigned i=0; i<wid*hei; i++) pixels[i*4+3] = 255;
+        
+        ETextureFormat fmt = ChooseFormat("selftest_ddn.png", 4, &pixels[0], wid*hei);
+        if (fmt == TF_BC1 || fmt == TF_BC4 || (fmt == TF_BC5 && !opaque))
+        {
+            printf("Texture compressor self test: %s normal map got format %d, which drops alpha\n", opaque ? "opaque" : "alpha", fmt);
+            ok = false;
+            continue;
+        }
+        if (fmt == TF_NONE) continue; // stays uncompressed, nothing to round-trip
+        
+        unsigned numMips = 0;
+        unsigned char* chain = BuildMipChainRGBA(wid, hei, 4, &pixels[0], numMips);
+        std::vector<unsigned char> blocks(MipChainSize(fmt, wid, hei, numMips));
+        if (!chain || !CompressMipChain(fmt, wid, hei, numMips, chain, &blocks[0]))
+        {
+            printf("Texture compressor self test: encoding to format %d failed\n", fmt);
+            free(chain);
+            ok = false;
+            continue;
+        }
+        
+        // the first level decoded again; alpha must come back within the error of the 8-value BC3 palette
+        int maxAlphaErr = 0;
+        unsigned blockBytes = CTexture::GLFormat(fmt).blockBytes;
+        unsigned char decoded[64];
+        for (unsigned by=0; by<hei/4; by++)
+            for (unsigned bx=0; bx<wid/4; bx++)
+            {
+                DecodeBlock(fmt, &blocks[(by*(wid/4) + bx)*blockBytes], decoded);
+                for (unsigned i=0; i<16; i++)
+                {
+                    int orig = chain[((by*4 + i/4)*wid + bx*4 + i%4)*4 + 3];
+                    maxAlphaErr = Max(maxAlphaErr, abs(orig - (int)decoded[i*4+3]));
+                }
+            }
+        free(chain);
+        
+        if (maxAlphaErr > 16)
+        {
+            printf("Texture compressor self test: alpha of format %d is off by up to %d\n", fmt, maxAlphaErr);
+            ok = false;
+        }
+        else
+            printf("Texture compressor self test: %s normal map -> format %d, max alpha error %d\n", opaque ? "opaque" : "alpha", fmt, maxAlphaErr);
+    }
+    
+    return ok;
+}
+
+double CTextureCompressor::ComputePSNR(ETextureFormat fmt, unsigned wid, unsigned hei, const unsigned char* rgba, const unsigned char* blocks)
+{
+    // channels kept by the format
+    unsigned firstChannel = 0, numChannels = 3;
+    if (fmt == TF_BC3) numChannels = 4;
+    else if (fmt == TF_BC4) numChannels = 1;
+    else if (fmt == TF_BC5) numChannels = 2;
+    
+    unsigned blockBytes = CTexture::GLFormat(fmt).blockBytes;
+    unsigned blocksX = Max(1u, (wid+3)/4), blocksY = Max(1u, (hei+3)/4);
+    
+    double sqErr = 0;
+    unsigned samples = 0;
+    unsigned char decoded[64];
+    for (unsigned by=0; by<blocksY; by++)
+        for (unsigned bx=0; bx<blocksX; bx++)
+        {
+            DecodeBlock(fmt, blocks + (by*blocksX + bx)*blockBytes, decoded);
+            
+            for (unsigned y=0; y<4 && by*4+y<hei; y++)
+                for (unsigned x=0; x<4 && bx*4+x<wid; x++)
+                {
+                    const unsigned char* orig = &rgba[((by*4+y)*wid + bx*4+x)*4];
+                    for (unsigned c=firstChannel; c<firstChannel+numChannels; c++)
+                    {
+                        int d = (int)orig[c] - (int)decoded[(y*4+x)*4+c];
+                        sqErr += d*d;
+                        samples++;
+                    }
+                }
+        }
+    
+    if (!samples || sqErr == 0) return 99.0;
+    
+    double mse = sqErr / samples;
+    return 10.0 * log10(255.0*255.0 / mse);
+}
@@ -0,0 +1,55 @@
+//
+//  TextureCompressor.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__TextureCompressor__
+#define __glt__TextureCompressor__
+
+#include "Texture.h"
+
+/// Real-time BC1/BC3/BC4/BC5 block encoder (bounding box fit, SSE2 when available)
+/// All functions are thread-safe; images are encoded in parallel on CThreadPool.
+class CTextureCompressor
+{
+public:
+    struct SStats
+    {
+        SStats():pixels(0), seconds(0), psnr(0){};
+        
+        unsigned pixels; // encoded pixels (all mips)
+        double seconds; // encoding time
+        double psnr; // of the first mip in dB, compared over the channels the format keeps
+    };
+    
+    /// Picks the compressed format for a decoded image or returns TF_NONE if it should stay uncompressed
+    /// \param name Texture file name (used to detect normal maps)
+    static ETextureFormat ChooseFormat(const char* name, unsigned components, const unsigned char* pixels, unsigned numPixels);
+    
+    /// Converts 3 or 4-component pixels into RGBA8 and builds a full mip chain (box filter) after it
+    /// \return Malloc'ed buffer with all levels stored one after another (free with free()) or NULL
+    static unsigned char* BuildMipChainRGBA(unsigned wid, unsigned hei, unsigned components, const unsigned char* pixels, unsigned& outNumMips);
+    
+    /// Size of the output buffer needed by CompressMipChain
+    static unsigned MipChainSize(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips);
+    
+    /// Encodes the whole mip chain made by BuildMipChainRGBA
+    /// \param outBlocks Buffer of MipChainSize() bytes
+    /// \param outStats Optional encoding statistics
+    static bool CompressMipChain(ETextureFormat fmt, unsigned wid, unsigned hei, unsigned numMips, const unsigned char* rgbaChain, unsigned char* outBlocks, SStats* outStats=NULL);
+    
+    /// Decodes one compressed 4x4 block to RGBA8 (used for measuring quality)
+    static void DecodeBlock(ETextureFormat fmt, const unsigned char* block, unsigned char outRGBA[64]);
+    
+    /// PSNR in dB between original RGBA8 pixels and their compressed version
+    static double ComputePSNR(ETextureFormat fmt, unsigned wid, unsigned hei, const unsigned char* rgba, const unsigned char* blocks);
+    
+    /// Encodes and decodes test images in the formats ChooseFormat picks for them and checks that alpha
+    /// (specular of normal maps) survives; needs the renderer caps, run with glt -test-texture-compressor
+    static bool SelfTest();
+};
+
+#endif /* defined(__glt__TextureCompressor__) */
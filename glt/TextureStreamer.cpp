@@ -0,0 +1,303 @@
+//
+//  TextureStreamer.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "TextureStreamer.h"
+#include "Texture.h"
+#include "CVar.h"
+#include "Shared.h"
+
+#include <math.h>
+#include <algorithm>
+
+static CVar cvTexStreaming("r_texStreaming", true);
+static CVar cvTexStreamBudget("r_texStreamBudget", 256); // MB of texture memory for streamed textures
+static CVar cvTexStreamInitialSize("r_texStreamInitialSize", 64); // largest dimension of the level uploaded at load time
+static CVar cvTexStreamUploads("r_texStreamUploads", 4); // max. levels uploaded per frame
+static CVar cvTexStreamBias("r_texStreamBias", 0.0f, CVar::FLAG_GUI_TWEAKABLE, -2, 2); // positive = blurrier, less memory
+
+CTextureStreamer::CTextureStreamer()
+:_frame(1), _prefetching(NULL), _prefetchCancelled(false), _quit(false)
+{
+    _loader = std::thread(&CTextureStreamer::LoaderMain, this);
+}
+
+CTextureStreamer::~CTextureStreamer()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _cond.notify_all();
+    _loader.join();
+    
+    STD_FOREACH(RestoredQueue, _restored, r)
+        delete[] r->images;
+}
+
+bool CTextureStreamer::IsEnabled()
+{
+    return cvTexStreaming;
+}
+
+void CTextureStreamer::Register(CTexture* tex)
+{
+    _textures.push_back(tex);
+}
+
+void CTextureStreamer::Unregister(CTexture* tex)
+{
+    TextureArray::iterator it = std::find(_textures.begin(), _textures.end(), tex);
+    if (it != _textures.end()) _textures.erase(it);
+    
+    // forget queued requests
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (RequestQueue::iterator r = _pending.begin(); r != _pending.end(); )
+        r = (r->texture == tex) ? _pending.erase(r) : r+1;
+    for (RequestQueue::iterator r = _ready.begin(); r != _ready.end(); )
+        r = (r->texture == tex) ? _ready.erase(r) : r+1;
+    _restores.erase(std::remove(_restores.begin(), _restores.end(), tex), _restores.end());
+    for (RestoredQueue::iterator r = _restored.begin(); r != _restored.end(); )
+    {
+        if (r->texture != tex) { r++; continue; }
+        delete[] r->images;
+        r = _restored.erase(r);
+    }
+    
+    // the loader may be reading its mapping or decoding its sources right now
+    if (_prefetching == tex)
+    {
+        _prefetchCancelled = true;
+        while (_prefetching == tex)
+            _prefetchDone.wait(lock);
+    }
+}
+
+void CTextureStreamer::QueueRestore(CTexture* tex)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _restores.push_back(tex);
+    }
+    _cond.notify_one();
+}
+
+bool CTextureStreamer::IsQueued(const CTexture* tex)const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    STD_CONST_FOREACH(RequestQueue, _pending, r)
+        if (r->texture == tex) return true;
+    STD_CONST_FOREACH(RequestQueue, _ready, r)
+        if (r->texture == tex) return true;
+    return _prefetching == tex;
+}
+
+unsigned CTextureStreamer::GetInitialLevel(unsigned wid, unsigned hei, unsigned numMips)const
+{
+    unsigned maxSize = Max(1, cvTexStreamInitialSize.GetInt());
+    
+    unsigned level = 0;
+    while (level+1 < numMips && Max(wid>>level, hei>>level) > maxSize)
+        level++;
+    return level;
+}
+
+unsigned CTextureStreamer::LevelForDensity(float texelsPerPixel, unsigned numMips)
+{
+    if (!numMips) return 0;
+    
+    float level = texelsPerPixel > 1 ? log2f(texelsPerPixel) : 0;
+    level += cvTexStreamBias.GetFloat();
+    
+    return (unsigned)MinMax((int)level, 0, (int)numMips-1);
+}
+
+unsigned CTextureStreamer::GetResidentBytes()const
+{
+    unsigned bytes = 0;
+    STD_CONST_FOREACH(TextureArray, _textures, it)
+        bytes += (*it)->GetResidentBytes();
+    return bytes;
+}
+
+void CTextureStreamer::LoaderMain()
+{
+    for(;;)
+    {
+        SRequest req;
+        CTexture* restore = NULL;
+        unsigned size = 0;
+        const char* data = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_quit && _pending.empty() && _restores.empty())
+                _cond.wait(lock);
+            if (_quit) return;
+            
+            // evicted textures are being drawn with their stand-in, so they go first
+            if (!_restores.empty())
+            {
+                restore = _restores.front();
+                _restores.pop_front();
+                _prefetching = restore;
+            }
+            else
+            {
+                req = _pending.front();
+                _pending.pop_front();
+                data = req.texture->GetLevelData(req.level, size);
+                _prefetching = req.texture;
+            }
+            
+            // pinned until done, Unregister waits for it
+            _prefetchCancelled = false;
+        }
+        
+        // done without the lock so that the GL thread doesn't wait for the disk
+        if (restore)
+        {
+            SRestore r;
+            r.texture = restore;
+            r.images = restore->DecodeSources();
+            
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_prefetchCancelled)
+                _restored.push_back(r);
+            else
+                delete[] r.images;
+            _prefetching = NULL;
+        }
+        else
+        {
+            // touch every page of the level so the upload doesn't stall on a mapped file
+            volatile unsigned char sum = 0;
+            for (unsigned offset=0; data && offset<size; offset+=4096)
+                sum += data[offset];
+            (void)sum;
+            
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_prefetchCancelled)
+                _ready.push_back(req);
+            _prefetching = NULL;
+        }
+        _prefetchDone.notify_all();
+    }
+}
+
+/// Budget victim ordering: unused for longer first, then more levels above the need, then bigger
+struct SStreamOutCandidate
+{
+    CTexture* texture;
+    unsigned unusedFrames;
+    int excessLevels;
+    unsigned topLevelBytes;
+    
+    bool operator<(const SStreamOutCandidate& o)const
+    {
+        if (unusedFrames != o.unusedFrames) return unusedFrames > o.unusedFrames;
+        if (excessLevels != o.excessLevels) return excessLevels > o.excessLevels;
+        return topLevelBytes > o.topLevelBytes;
+    }
+};
+
+void CTextureStreamer::Update()
+{
+    // replace stand-ins of evicted textures (regardless of r_texStreaming, they count as uploads)
+    unsigned maxUploads = Max(1, cvTexStreamUploads.GetInt());
+    unsigned uploads = 0;
+    while (uploads<maxUploads)
+    {
+        SRestore r;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_restored.empty()) break;
+            r = _restored.front();
+            _restored.pop_front();
+        }
+        
+        r.texture->FinishRestore(r.images);
+        uploads++;
+    }
+    
+    if (!cvTexStreaming)
+    {
+        _frame++;
+        return;
+    }
+    
+    // upload prefetched levels which are still needed
+    while (uploads<maxUploads)
+    {
+        SRequest req;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_ready.empty()) break;
+            req = _ready.front();
+            _ready.pop_front();
+        }
+        
+        if (req.texture->GetResidentLevel() == req.level+1 && req.texture->StreamIn())
+            uploads++;
+    }
+    
+    // over budget? drop top levels of the least needed textures
+    unsigned budget = (unsigned)Max(1, cvTexStreamBudget.GetInt()) * 1024 * 1024;
+    unsigned resident = GetResidentBytes();
+    if (resident > budget)
+    {
+        std::vector<SStreamOutCandidate> candidates;
+        STD_FOREACH(TextureArray, _textures, it)
+        {
+            CTexture* tex = *it;
+            unsigned level = tex->GetResidentLevel();
+            if (level >= GetInitialLevel(tex->GetWidth(), tex->GetHeight(), tex->GetNumMips()))
+                continue; // already at its minimum
+            
+            SStreamOutCandidate c;
+            c.texture = tex;
+            c.unusedFrames = _frame - tex->GetLastRequestFrame();
+            c.excessLevels = (int)tex->GetRequestedLevel(_frame) - (int)level;
+            c.topLevelBytes = CTexture::MipSize(tex->GetFormat(), Max(1u, tex->GetWidth()>>level), Max(1u, tex->GetHeight()>>level));
+            candidates.push_back(c);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        
+        for (unsigned i=0; i<candidates.size() && resident > budget; i++)
+        {
+            CTexture* tex = candidates[i].texture;
+            if (tex->StreamOut(tex->GetResidentLevel()+1))
+                resident -= candidates[i].topLevelBytes;
+        }
+    }
+    
+    // queue the next larger level of textures needing more detail (if it fits the budget)
+    unsigned queued = 0;
+    STD_FOREACH(TextureArray, _textures, it)
+    {
+        CTexture* tex = *it;
+        unsigned level = tex->GetResidentLevel();
+        if (!level || tex->GetRequestedLevel(_frame) >= level || IsQueued(tex))
+            continue;
+        
+        unsigned size;
+        tex->GetLevelData(level-1, size);
+        if (resident + size > budget)
+            continue;
+        resident += size;
+        
+        SRequest req;
+        req.texture = tex;
+        req.level = level-1;
+        
+        std::unique_lock<std::mutex> lock(_mutex);
+        _pending.push_back(req);
+        queued++;
+    }
+    if (queued) _cond.notify_one();
+    
+    _frame++;
+}
@@ -0,0 +1,94 @@
+//
+//  TextureStreamer.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__TextureStreamer__
+#define __glt__TextureStreamer__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class CTexture;
+struct STextureImage;
+
+/// Streams mip levels of textures in and out of GPU memory based on the levels requested while drawing.
+/// Level data is prefetched (paged in from the cache mapping) on a background thread, uploads happen in Update()
+/// on the GL thread, and a memory budget (r_texStreamBudget) drops the least needed levels when exceeded.
+/// The loader thread also decodes textures evicted by CGPUMemory again (see CTexture::Evict).
+class CTextureStreamer
+{
+    struct SRequest
+    {
+        CTexture* texture;
+        unsigned level;
+    };
+    struct SRestore
+    {
+        CTexture* texture;
+        STextureImage* images; // CTexture::DecodeSources result
+    };
+    typedef std::vector<CTexture*> TextureArray;
+    typedef std::deque<SRequest> RequestQueue;
+    typedef std::deque<CTexture*> RestoreQueue;
+    typedef std::deque<SRestore> RestoredQueue;
+    
+public:
+    static CTextureStreamer* Inst()
+    {
+        static CTextureStreamer* inst = 0;
+        if (!inst) inst = new CTextureStreamer();
+        return inst;
+    }
+    
+    CTextureStreamer();
+    ~CTextureStreamer();
+    
+    static bool IsEnabled();
+    
+    void Register(CTexture* tex);
+    void Unregister(CTexture* tex);
+    /// Decodes the sources of an evicted texture on the loader thread; CTexture::FinishRestore is called from Update()
+    void QueueRestore(CTexture* tex);
+    
+    /// First mip level uploaded when a streamed texture is created
+    unsigned GetInitialLevel(unsigned wid, unsigned hei, unsigned numMips)const;
+    /// Frame number passed to CTexture::RequestLevel
+    unsigned GetFrame()const{ return _frame; };
+    /// Mip level needed to draw a texture with the given texel density
+    /// \param texelsPerPixel Texels of the top level covering one screen pixel
+    static unsigned LevelForDensity(float texelsPerPixel, unsigned numMips);
+    
+    /// Finishes restored textures, uploads prefetched levels, enforces the memory budget and starts a new frame (GL thread, once per frame)
+    void Update();
+    
+    unsigned GetResidentBytes()const;
+    
+private:
+    void LoaderMain();
+    bool IsQueued(const CTexture* tex)const;
+    
+    TextureArray _textures;
+    unsigned _frame;
+    
+    // background prefetching
+    std::thread _loader;
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    std::condition_variable _prefetchDone;
+    RequestQueue _pending; // to be prefetched
+    RequestQueue _ready; // prefetched, waiting for upload
+    RestoreQueue _restores; // evicted, to be decoded (before prefetching)
+    RestoredQueue _restored; // decoded, waiting for CTexture::FinishRestore
+    CTexture* _prefetching; // texture the loader reads outside of the lock (Unregister waits for it)
+    bool _prefetchCancelled; // _prefetching was unregistered meanwhile
+    bool _quit;
+};
+
+#endif /* defined(__glt__TextureStreamer__) */
@@ -0,0 +1,113 @@
+//
+//  ThreadPool.cpp
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#include "ThreadPool.h"
+#include "Shared.h"
+
+CThreadPool::CThreadPool()
+:_job(NULL), _userData(NULL), _count(0), _next(0), _pending(0), _batch(0), _activeWorkers(0), _quit(false)
+{
+    unsigned numThreads = std::thread::hardware_concurrency();
+    if (numThreads < 1) numThreads = 1;
+    
+    // the calling thread helps too
+    for (unsigned i=0; i<numThreads-1; i++)
+        _workers.push_back(std::thread(&CThreadPool::WorkerMain, this, i));
+}
+
+CThreadPool::~CThreadPool()
+{
+    Stop();
+}
+
+void CThreadPool::Stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wakeCond.notify_all();
+    
+    for (unsigned i=0; i<_workers.size(); i++)
+        _workers[i].join();
+    _workers.clear();
+}
+
+void CThreadPool::ProcessItems()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    
+    while (_next < _count)
+    {
+        unsigned index = _next++;
+        FJob job = _job;
+        void* userData = _userData;
+        
+        lock.unlock();
+        job(index, userData);
+        lock.lock();
+        
+        if (--_pending == 0)
+            _doneCond.notify_all();
+    }
+}
+
+void CThreadPool::WorkerMain(unsigned workerIndex)
+{
+    unsigned lastBatch = 0;
+    
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_quit && (_batch == lastBatch || _next >= _count || workerIndex >= _activeWorkers))
+                _wakeCond.wait(lock);
+            
+            if (_quit) return;
+            lastBatch = _batch;
+        }
+        
+        ProcessItems();
+    }
+}
+
+void CThreadPool::ParallelFor(unsigned count, FJob job, void* userData, unsigned maxThreads)
+{
+    if (!count) return;
+    
+    unsigned numWorkers = (unsigned)_workers.size();
+    if (maxThreads) numWorkers = Min(numWorkers, maxThreads-1);
+    
+    // not worth waking anybody up; also when called from inside a job (or while another thread's
+    // batch is running) the workers are already busy, so just process the items here
+    std::unique_lock<std::mutex> submitLock(_submitMutex, std::try_to_lock);
+    if (count == 1 || !numWorkers || !submitLock.owns_lock())
+    {
+        for (unsigned i=0; i<count; i++)
+            job(i, userData);
+        return;
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _job = job;
+        _userData = userData;
+        _count = count;
+        _next = 0;
+        _pending = count;
+        _activeWorkers = numWorkers;
+        _batch++;
+    }
+    _wakeCond.notify_all();
+    
+    ProcessItems();
+    
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_pending)
+        _doneCond.wait(lock);
+}
@@ -0,0 +1,66 @@
+//
+//  ThreadPool.h
+//  glt
+//
+//  Created by Mario Hros on 19. 10. 26.
+//  Copyright (c) 2014 K3A. All rights reserved.
+//
+
+#ifndef __glt__ThreadPool__
+#define __glt__ThreadPool__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// Simple pool of worker threads for data-parallel CPU work (texture encoding, decoding...)
+/// \note Jobs must not touch GL - the GL context is current only on the main thread
+class CThreadPool
+{
+public:
+    /// \param index Index of the item to process <0; count)
+    typedef void (*FJob)(unsigned index, void* userData);
+    
+    static CThreadPool* Inst()
+    {
+        static CThreadPool* inst = 0;
+        if (!inst) inst = new CThreadPool();
+        return inst;
+    }
+    
+    CThreadPool();
+    ~CThreadPool();
+    
+    /// Calls job(i, userData) for i in <0; count) spread over all workers and the calling thread.
+    /// Returns after all items have been processed. Nested calls (from inside a job) run serially.
+    /// \param maxThreads Limits the number of threads working on the items (0 = all)
+    void ParallelFor(unsigned count, FJob job, void* userData, unsigned maxThreads = 0);
+    /// Number of threads processing ParallelFor items (workers + calling thread)
+    unsigned GetNumThreads()const{ return (unsigned)_workers.size() + 1; };
+    /// Joins the workers (at shutdown); ParallelFor runs everything on the calling thread afterwards
+    void Stop();
+
+private:
+    void WorkerMain(unsigned workerIndex);
+    /// Processes items of the current batch until there are none left
+    void ProcessItems();
+    
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wakeCond;
+    std::condition_variable _doneCond;
+    std::mutex _submitMutex; // held while a batch is being processed by the workers
+    
+    // current batch (guarded by _mutex)
+    FJob _job;
+    void* _userData;
+    unsigned _count;
+    unsigned _next;
+    unsigned _pending;
+    unsigned _batch; // incremented for every ParallelFor
+    unsigned _activeWorkers; // workers allowed to take items of the current batch
+    bool _quit;
+};
+
+#endif /* defined(__glt__ThreadPool__) */
@@ -20,6 +20,8 @@
 #ifdef __APPLE__
 # define GL_RGBA16F GL_RGBA16F_ARB
 # define GL_RGBA32F GL_RGBA32F_ARB
+# define GL_TIME_ELAPSED GL_TIME_ELAPSED_EXT
+# define glGetQueryObjectui64v glGetQueryObjectui64vEXT
 #endif
 
 void PrintGLError(const char* where);
@@ -8,12 +8,16 @@
 
 #include <iostream>
 #include <set>
+#include <string>
 
 #include "glstuff.h"
 #include "main.h"
 #include "shared.h"
 #include "Engine.h"
 #include "Shaders.h"
+#include "FileSystem.h"
+#include "GBufferBenchmark.h"
+#include "TextureCompressor.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -80,6 +84,34 @@ int main(int argc, char * argv[])
         }
     }
     
+    // glt -makepak <out.pak> <dir> packs all files in dir into an archive
+    if (argc == 4 && !strcmp(argv[1], "-makepak"))
+        return CFileSystem::WritePak(argv[2], argv[3]) ? 0 : 1;
+    
+    // assets are served from data.pak/data.zip when present, loose files otherwise
+    CFileSystem::Inst()->MountDefaults();
+    for (int i=1; i+1<argc; i++)
+        if (!strcmp(argv[i], "-pak") && !CFileSystem::Inst()->Mount(argv[++i]))
+            printf("Failed to mount %s\n", argv[i]);
+    
+    // +name value... sets a cvar (or runs a command) before the renderer starts
+    bool benchmarkGBuffer = false;
+    bool testTextureCompressor = false;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i], "-benchmark-gbuffer"))
+            benchmarkGBuffer = true;
+        if (!strcmp(argv[i], "-test-texture-compressor"))
+            testTextureCompressor = true;
+        if (argv[i][0] != '+') continue;
+        
+        std::string line = argv[i]+1;
+        while (i+1<argc && argv[i+1][0] != '+' && !(argv[i+1][0] == '-' && isalpha(argv[i+1][1])))
+            line += std::string(" ") + argv[++i];
+        if (!CEngine::Inst()->ProcessConsoleLine(line.c_str()))
+            printf("Unknown variable or command: %s\n", line.c_str());
+    }
+    
     glutInit(&argc, argv);
     
     int wid = 800, hei = 600;
@@ -112,6 +144,14 @@ int main(int argc, char * argv[])
     CEngine::Inst()->InInit();
     CEngine::Inst()->InSizeChange(wid, hei);
     
+    // glt -benchmark-gbuffer prints the normal encoding comparison and quits
+    if (benchmarkGBuffer)
+        CEngine::Inst()->Shutdown(CGBufferBenchmark::Run(1920, 1080, 100) ? 0 : 1);
+    
+    // glt -test-texture-compressor checks the texture encoder round trip and quits
+    if (testTextureCompressor)
+        CEngine::Inst()->Shutdown(CTextureCompressor::SelfTest() ? 0 : 1);
+    
     /* // uncomment to disable sync with refresh
     CGLContextObj context = CGLGetCurrentContext();
     const GLint SYNC_TO_REFRESH = 0;
@@ -148,6 +148,65 @@ tgaInfo * tgaLoad(const char *filename) {
 	return(info);
 }
 
+// same as tgaLoad, but reads the image from a whole file already in memory
+tgaInfo * tgaLoadFromMemory(const unsigned char *data, unsigned int size) {
+	
+	tgaInfo *info;
+	int mode,total,i;
+	unsigned char aux;
+    
+	info = (tgaInfo *)malloc(sizeof(tgaInfo));
+	if (info == NULL) {
+		fprintf (stderr, "Error allocating info data struct\n");
+		return(NULL);
+	}
+	info->imageData = NULL;
+    
+    // the header is 18 bytes (see tgaLoadHeader)
+	if (size < 18) {
+		info->status = TGA_ERROR_READING_FILE;
+		return(info);
+	}
+	info->type = data[2];
+	info->width = (short int)(data[12] | (data[13] << 8));
+	info->height = (short int)(data[14] | (data[15] << 8));
+	info->pixelDepth = data[16];
+    
+	if (info->type == 1) {
+		info->status = TGA_ERROR_INDEXED_COLOR;
+		return(info);
+	}
+	if ((info->type != 2) && (info->type !=3)) {
+		info->status = TGA_ERROR_COMPRESSED_FILE;
+		return(info);
+	}
+    
+	mode = info->pixelDepth / 8;
+	total = info->height * info->width * mode;
+	if (total <= 0 || (unsigned int)total > size - 18) {
+		info->status = TGA_ERROR_READING_FILE;
+		return(info);
+	}
+    
+	info->imageData = (unsigned char *)malloc(sizeof(unsigned char) * total);
+	if (info->imageData == NULL) {
+		info->status = TGA_ERROR_MEMORY;
+		return(info);
+	}
+	memcpy(info->imageData, data + 18, total);
+    
+    // BGR(A) -> RGB(A)
+	if (mode >= 3)
+		for (i=0; i < total; i+= mode) {
+			aux = info->imageData[i];
+			info->imageData[i] = info->imageData[i+2];
+			info->imageData[i+2] = aux;
+		}
+    
+	info->status = TGA_OK;
+	return(info);
+}
+
 // converts RGB to greyscale
 void tgaRGBtoGreyscale(tgaInfo *info) {
     
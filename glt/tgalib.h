@@ -28,6 +28,9 @@ void tgaLoadHeader(FILE *file, tgaInfo *info);
 // an image
 tgaInfo * tgaLoad(const char *filename);
 
+// same as tgaLoad, but reads the image from a whole file already in memory
+tgaInfo * tgaLoadFromMemory(const unsigned char *data, unsigned int size);
+
 // converts RGB to greyscale
 void tgaRGBtoGreyscale(tgaInfo *info);
 
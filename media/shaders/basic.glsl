@@ -38,6 +38,40 @@ struct test
 
 uniform float uTestFloat;
 
+#ifdef SSAO_UPSAMPLE
+// Joint bilateral upsample of the reduced resolution AO in uTex1: the four nearest AO texels are weighted
+// bilinearly and by how close their depth (uAODepthTex = RT_SSAO_DEPTH) is to the depth of this pixel,
+// so that AO doesn't bleed over depth edges. uDepthTex is the full resolution z-buffer (HW_DEPTH).
+uniform sampler2D uAODepthTex;
+
+#define SSAO_UPSAMPLE_SHARPNESS 100.0 // weight halves at 1% relative depth difference
+
+void AddAOTap(vec2 uv, float bilinear, float depthV, inout float ao, inout float weightSum)
+{
+    float tapDepthV = texture2D(uAODepthTex, uv).a * uNearFar.y;
+    float weight = bilinear / (1.0 + abs(depthV - tapDepthV) / depthV * SSAO_UPSAMPLE_SHARPNESS);
+    ao += texture2D(uTex1, uv).r * weight;
+    weightSum += weight;
+}
+
+float UpsampleAO(vec2 uv)
+{
+    float depthV = SampleDepthV(uv);
+    
+    vec2 pos = uv / uInvTex1Size - 0.5;
+    vec2 f = fract(pos);
+    vec2 uv00 = (floor(pos) + 0.5) * uInvTex1Size;
+    
+    float ao = 0.0, weightSum = 0.0;
+    AddAOTap(uv00, (1.0-f.x)*(1.0-f.y), depthV, ao, weightSum);
+    AddAOTap(uv00 + vec2(uInvTex1Size.x, 0.0), f.x*(1.0-f.y), depthV, ao, weightSum);
+    AddAOTap(uv00 + vec2(0.0, uInvTex1Size.y), (1.0-f.x)*f.y, depthV, ao, weightSum);
+    AddAOTap(uv00 + uInvTex1Size, f.x*f.y, depthV, ao, weightSum);
+    
+    return ao / max(weightSum, 1e-5);
+}
+#endif
+
 void main()
 {
     vec4 diffuse = vec4(1,1,1,1);
@@ -67,7 +101,11 @@ void main()
 #endif // TEXTURE0
     
 #ifdef TEXTURE1
+# ifdef SSAO_UPSAMPLE
+    diffuse *= vec4(vec3(UpsampleAO(vTex0.st)), 1);
+# else
     diffuse *= texture2D(uTex1, vTex0.st);
+# endif
 #endif
     
     FSOutput(0) = diffuse;
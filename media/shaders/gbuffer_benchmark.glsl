@@ -0,0 +1,61 @@
+
+#include "common.incl"
+
+// synthetic G-buffer for CGBufferBenchmark: ENCODE writes reference normals into RT_NORMAL format,
+// LIGHTING decodes them, shades BENCH_LIGHTS lights and outputs the angular error in alpha
+
+#define BENCH_LIGHTS 16
+
+varying vec2 vCoord;
+
+#ifdef VS
+
+void main()
+{
+    VSOutput = aPosition;
+    vCoord = aPosition.xy * vec2(0.5) + vec2(0.5);
+}
+
+#else // FS
+
+// reference normal of the pixel, uniformly distributed over the sphere
+vec3 TestNormal(vec2 uv)
+{
+    float z = rand(uv) * 2.0 - 1.0;
+    float phi = rand(uv.yx + vec2(0.5)) * 6.2831853;
+    float r = sqrt(max(0.0, 1.0 - z*z));
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+#ifdef ENCODE
+
+void main()
+{
+    FSOutput(0) = PackGBufferNormal(TestNormal(vCoord), 0.5);
+}
+
+#else // LIGHTING
+
+void main()
+{
+    vec4 normalRT = texture2D(uNormalTex, vCoord);
+    vec3 normalV = GBufferNormal(normalRT);
+    vec3 posV = ReconstructViewspacePos(vCoord, 5.0); // plane in front of the camera
+    
+    vec3 light = vec3(0.0);
+    for (int i=0; i<BENCH_LIGHTS; i++)
+    {
+        float a = float(i) * 0.3926991; // lights on a circle around the plane center
+        vec4 l = PointLight(posV, normalV, vec3(3.0*cos(a), 3.0*sin(a), -4.0), vec4(1.0, 0.9, 0.8, 1.0/6.0));
+        light += l.rgb + vec3(l.a * GBufferSpecular(normalRT));
+    }
+    
+    // angle between the decoded and the reference normal (precise also for tiny angles, unlike acos)
+    float error = 2.0 * asin(min(1.0, length(normalV - TestNormal(vCoord)) * 0.5));
+    
+    FSOutput(0) = vec4(light, degrees(error));
+}
+
+#endif // ENCODE
+
+#endif
\ No newline at end of file
@@ -10,6 +10,15 @@ varying vec2 vTex0;
 
 varying vec4 vPosH;
 
+#ifdef CLUSTERED // forward shading with the cluster light lists instead of the light accumulation buffer
+varying vec3 vPosV;
+varying vec3 vNormalV;
+# ifdef NORMAL_SPECULAR_MAP
+varying vec3 vTangentV;
+varying vec3 vBitangentV;
+# endif
+#endif
+
 
 #ifdef VS
 
@@ -26,6 +35,14 @@ void main()
 #ifdef ATTRIB_COORDS0
     vTex0 = aCoords0;
 #endif
+#ifdef CLUSTERED
+    vPosV = (uModelView * aPosition).xyz;
+    vNormalV = normalize((uModelView * vec4(aNormal, 0)).xyz);
+# ifdef NORMAL_SPECULAR_MAP
+    vTangentV = normalize((uModelView * vec4(aTangent, 0)).xyz);
+    vBitangentV = normalize((uModelView * vec4(aBitangent, 0)).xyz);
+# endif
+#endif
 }
 
 #else // FS
@@ -33,14 +50,39 @@ void main()
 uniform sampler2D uDiffuseAcc;
 uniform vec3 uAmbientColor;
 
+#ifdef CLUSTERED
+#include "light_grid.incl"
+
+// the same light the deferred path accumulates into an RGBA8 target
+vec4 ClusteredLight()
+{
+# ifdef NORMAL_SPECULAR_MAP
+    vec4 normalTex = SampleNormalSpecular(vTex0.st);
+    vec3 normalV = normalize(NormalFromMap(normalTex, vTangentV, vBitangentV, vNormalV));
+    float specular = normalTex.a;
+# else
+    vec3 normalV = normalize(vNormalV);
+    float specular = 0.0;
+# endif
+    
+    vec4 cell = FetchLightCell(gl_FragCoord.xy, -vPosV.z);
+    vec4 light = AccumulateLights(cell, vPosV, normalV);
+    return saturate(vec4(light.rgb, light.a * specular));
+}
+#endif
+
 void main()
 {
+#ifdef CLUSTERED
+    vec4 lightDiffuse = ClusteredLight();
+#else
     vec2 screenUV = clip_to_screenUV(vPosH);
     vec4 lightDiffuse = texture2D(uDiffuseAcc, screenUV.st);
+#endif
     
     vec3 diffuse = vec3(1,1,1);
 #ifdef TEXTURE0
-    diffuse *= texture2D(uTex0, vTex0.st).rgb;
+    diffuse *= SampleTex0(vTex0.st).rgb;
 #endif
     diffuse *= max(lightDiffuse.rgb, uAmbientColor);
     
@@ -27,21 +27,22 @@ void main()
 {
 #ifdef NORMAL_SPECULAR_MAP // normal map texture
     
-    vec4 normalTex = texture2D(uTexNormalSpecular, vTex0.st);
-    vec3 normalT = normalTex.rgb * vec3(2) - vec3(1);
-# ifdef NORMAL_SPECULAR_MAP_INVERSEY
-    normalT.y = -normalT.y;
-# endif
-    vec3 normalV = vec3(dot(normalT,vec3(vTangentV.x, vBitangentV.x, vNormalV.x)),
-                        dot(normalT,vec3(vTangentV.y, vBitangentV.y, vNormalV.y)),
-                        dot(normalT,vec3(vTangentV.z, vBitangentV.z, vNormalV.z)));
-    
-    FSOutput(0) = vec4(PackNormal(normalV), normalTex.a);
+    vec4 normalTex = SampleNormalSpecular(vTex0.st);
+    vec3 normalV = NormalFromMap(normalTex, vTangentV, vBitangentV, vNormalV);
+    float specular = normalTex.a;
 
 #else // no normal map texture
 
-    FSOutput(0) = vec4(PackNormal(vNormalV), 0.0); // default specular is 0
+    vec3 normalV = vNormalV;
+    float specular = 0.0; // default specular is 0
+
+#endif
 
+#ifdef GBUFFER // MRT: linear z (as z.glsl) and normal+specular in one geometry pass
+    FSOutput(0) = vec4( (1.0/gl_FragCoord.w)/uNearFar.y );
+    FSOutput(1) = PackGBufferNormal(normalV, specular);
+#else
+    FSOutput(0) = PackGBufferNormal(normalV, specular);
 #endif
 }
 
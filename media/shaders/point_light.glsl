@@ -2,12 +2,28 @@
 #include "common.incl"
 
 varying vec4 vPosH;
+#ifdef INSTANCED // all lights in one draw (IScene::DrawLights), light parameters per instance
+varying vec3 vLightPosV;
+varying vec4 vLightColorInvRange;
+#endif
 
 #ifdef VS
 
+#ifdef INSTANCED
+attribute vec4 aInstance0; // world-space position, range
+attribute vec4 aInstance1; // color, inverse range
+#endif
+
 void main()
 {
+#ifdef INSTANCED
+    // unit sphere scaled and moved to the light; uModelViewProj has no model transform
+    vec4 posH = uModelViewProj * vec4(aPosition.xyz * aInstance0.w + aInstance0.xyz, 1.0);
+    vLightPosV = (uModelView * vec4(aInstance0.xyz, 1.0)).xyz;
+    vLightColorInvRange = aInstance1;
+#else
     vec4 posH = uModelViewProj * aPosition;
+#endif
     
     vPosH = posH;
     VSOutput = posH;
@@ -15,51 +31,46 @@ void main()
 
 #else // FS
 
+#ifdef STENCIL_MARK // stencil marking pass of IScene::DrawLight - only the depth and stencil tests matter
+
+void main()
+{
+    FSOutput(0) = vec4(0.0);
+}
+
+#else
+
+#ifdef INSTANCED
+# define LIGHT_POS_V vLightPosV
+# define LIGHT_COLOR_INV_RANGE vLightColorInvRange
+#else
 uniform vec3 uLightPosV; // view-space light position
 uniform vec4 uLightColorInvRange;
+# define LIGHT_POS_V uLightPosV
+# define LIGHT_COLOR_INV_RANGE uLightColorInvRange
+#endif
 
 void main()
 {
     vec2 screenUV = clip_to_screenUV(vPosH);
     
     vec4 normalRT = texture2D(uNormalTex, screenUV.st);
-    vec3 normalV = normalize(UnpackNormal(normalRT.rgb)); // normalize here is useful as we are reading from an RGB texture
-    float depthV = texture2D(uDepthTex, screenUV.st).a * uNearFar.y; // length from eye to the '3D pixel' in view-space
-    //if (depthV >= uNearFar.y)
-    //    discard;
+    vec3 normalV = GBufferNormal(normalRT);
     
     // view-space position reconstruction
-    vec3 posV = ReconstructViewspacePos(screenUV, depthV);
-    
-    vec3 toLightV = uLightPosV-posV; // vector to light
-    float lightDist = length(toLightV); // distance to light
-    
-    vec3 lightV = toLightV/lightDist; // unit view-space light vector
-    float NL = dot(normalV, lightV);
-    
-    // attenuation
-    float att = lightDist * uLightColorInvRange.a;
-    att = saturate(0.9-att*att);
-    
-    // diffuse
-#ifdef HALF_LAMBERT // https://developer.valvesoftware.com/wiki/Half_Lambert
-    float hl = (NL*att) * 0.5 + 0.5;
-    vec3 diffuse = saturate( uLightColorInvRange.rgb * vec3(hl * hl) );
-#else 
-    vec3 diffuse = saturate( uLightColorInvRange.rgb * vec3(NL*att, NL*att, NL*att) );
-#endif
+    vec3 posV = SampleViewspacePos(screenUV);
+    //if (-posV.z >= uNearFar.y)
+    //    discard;
     
-    // specular
-    vec3 viewV = normalize(posV);
-    float specularInp = dot(reflect(lightV, normalV), viewV);
-    float specular = att * BlinnSpecular(lightV, normalV, viewV, 20.0);
-    //float specular = att * PhongSpecular(lightV, normalV, viewV, 20.0);
+    vec4 light = PointLight(posV, normalV, LIGHT_POS_V, LIGHT_COLOR_INV_RANGE);
     
-    FSOutput(0) = vec4(diffuse, specular * normalRT.a);
+    FSOutput(0) = vec4(light.rgb, light.a * GBufferSpecular(normalRT));
     //FSOutput(0) = vec4(abs(posV - texture2D(uDepthTex, screenUV.st).rgb)*10.0, 0);      // view-space position diff
 #ifdef LIGHT_DEBUG
     FSOutput(0) = vec4(0.2,0,0,1);    // good for measuring light overdraw
 #endif
 }
 
+#endif // STENCIL_MARK
+
 #endif
\ No newline at end of file
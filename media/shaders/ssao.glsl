@@ -6,11 +6,13 @@ varying vec2 vKernelCoord;
 
 #ifdef VS
 
+uniform vec2 uRandomOffset; // shifts the random texture between frames for temporal accumulation
+
 void main()
 {
     VSOutput = aPosition;
     vCoord = aPosition.xy * vec2(0.5) + vec2(0.5);
-    vKernelCoord = vCoord * (uScreenSize / vec2(4.0));
+    vKernelCoord = vCoord * (uScreenSize / vec2(4.0)) + uRandomOffset;
 }
 
 #else // FS
@@ -30,11 +32,15 @@ void main()
 {
     vec3 rvec = texture2D(uRandomTex, vKernelCoord).xyz * 2.0 - 1.0;
     
+#ifdef DOWNSAMPLED // uDepthTex is RT_SSAO_DEPTH (see ssao_downsample.glsl), with normals in rgb
+    vec3 normalV = normalize(texture2D(uDepthTex, vCoord.st).rgb);
+#else
     vec4 normalRT = texture2D(uNormalTex, vCoord.st);
-    vec3 normalV = normalize(UnpackNormal(normalRT.rgb)); // normalize here is useful as we are reading from an RGB texture
-    float depthV = texture2D(uDepthTex, vCoord.st).a * uNearFar.y;
-    vec3 posV = ReconstructViewspacePos(vCoord, depthV);
-    if (posV.z <= -uNearFar.y) {
+    vec3 normalV = GBufferNormal(normalRT);
+#endif
+    vec3 posV = SampleViewspacePos(vCoord);
+    float depthV = -posV.z;
+    if (depthV >= uNearFar.y * 0.999) { // background (z-buffer reconstruction isn't exact at the far plane)
         FSOutput(0) = vec4(1, 1, 1, 1);
         return;
     }
@@ -60,7 +66,7 @@ void main()
         offset.xy = offset.xy * 0.5 + 0.5;
         
         // get sample depth:
-        float sampleDepth = texture2D(uDepthTex, offset.xy).a * uNearFar.y;
+        float sampleDepth = SampleDepthV(offset.xy);
         //FSOutput(0) = vec4(offset.xy,0, 1);
         //return;
         
@@ -125,7 +131,7 @@ void main()
     vec3 rvec = texture2D(uRandomTex, vKernelCoord).xyz * 2.0 - 1.0;
     
     vec4 normalRT = texture2D(uNormalTex, vCoord.st);
-    vec3 normalV = normalize(UnpackNormal(normalRT.rgb)); // normalize here is useful as we are reading from an RGB texture
+    vec3 normalV = GBufferNormal(normalRT);
     float depthV = texture2D(uDepthTex, vCoord.st).r * uNearFar.y;
     vec3 posV = ReconstructViewspacePos(vCoord, depthV);
     
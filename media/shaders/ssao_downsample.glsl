@@ -0,0 +1,53 @@
+
+#include "common.incl"
+
+varying vec2 vCoord;
+
+#ifdef VS
+
+void main()
+{
+    VSOutput = aPosition;
+    vCoord = aPosition.xy * vec2(0.5) + vec2(0.5);
+}
+
+#else // FS
+
+// SSAO input at reduced resolution (RT_SSAO_DEPTH): view-space normal in rgb, linear z / far plane in alpha.
+// Every pixel takes one of the full resolution pixels it covers - alternately (checkerboard) the nearest
+// and the farthest one, so that both sides of a depth edge stay represented for the bilateral upsample.
+
+#define MAX_DOWNSAMPLE 4
+
+uniform float uDownsample; // full resolution pixels per reduced one in each dimension
+
+void main()
+{
+    vec2 blockUV = floor(gl_FragCoord.xy) * uDownsample * uInvTex0Size;
+    bool farthest = mod(floor(gl_FragCoord.x) + floor(gl_FragCoord.y), 2.0) > 0.5;
+    
+    float depthV = farthest ? 0.0 : 1e20;
+    vec2 uv = blockUV;
+    for (int y = 0; y < MAX_DOWNSAMPLE; y++)
+    {
+        if (float(y) >= uDownsample) break;
+        
+        for (int x = 0; x < MAX_DOWNSAMPLE; x++)
+        {
+            if (float(x) >= uDownsample) break;
+            
+            vec2 tapUV = blockUV + (vec2(float(x), float(y)) + 0.5) * uInvTex0Size;
+            float tapDepth = SampleDepthV(tapUV);
+            if (farthest ? tapDepth > depthV : tapDepth < depthV)
+            {
+                depthV = tapDepth;
+                uv = tapUV;
+            }
+        }
+    }
+    
+    vec3 normalV = GBufferNormal(texture2D(uNormalTex, uv));
+    FSOutput(0) = vec4(normalV, depthV / uNearFar.y);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+
+#include "common.incl"
+
+varying vec2 vCoord;
+
+#ifdef VS
+
+void main()
+{
+    VSOutput = aPosition;
+    vCoord = aPosition.xy * vec2(0.5) + vec2(0.5);
+}
+
+#else // FS
+
+// Temporal accumulation of SSAO at its reduced resolution:
+// uTex0 = AO of this frame, uDepthTex = RT_SSAO_DEPTH of this frame,
+// uTex1 = history (RT_SSAO_HISTORY: AO, accumulated frames / uMaxFrames, unused, linear z / far plane).
+// Output 0 is the AO for the composite, output 1 the new history.
+
+#define DISOCCLUSION_THRESHOLD 0.05 // relative depth difference
+
+uniform mat4 uReprojection; // view space of this frame -> clip space of the previous frame
+uniform float uMaxFrames;
+
+void main()
+{
+    float ao = texture2D(uTex0, vCoord).r;
+    float depthV = SampleDepthV(vCoord);
+    vec3 posV = ReconstructViewspacePos(vCoord, depthV);
+    
+    vec4 prevClip = uReprojection * vec4(posV, 1.0);
+    vec2 prevUV = prevClip.xy / prevClip.w * 0.5 + 0.5;
+    float prevDepthV = prevClip.w; // view depth of this point in the previous frame
+    
+    // the history is valid if the point was on the screen and visible (not disoccluded) in the previous frame
+    vec4 history = texture2D(uTex1, prevUV);
+    float frames = history.g * uMaxFrames;
+    if (prevUV.x < 0.0 || prevUV.y < 0.0 || prevUV.x > 1.0 || prevUV.y > 1.0
+        || abs(history.a * uNearFar.y - prevDepthV) > prevDepthV * DISOCCLUSION_THRESHOLD)
+        frames = 0.0;
+    
+    // running average over the last uMaxFrames frames
+    frames = min(frames + 1.0, uMaxFrames);
+    ao = mix(history.r, ao, 1.0 / frames);
+    
+    FSOutput(0) = vec4(vec3(ao*ao), 1); // same contrast as ssao_blur.glsl
+    FSOutput(1) = vec4(ao, frames / uMaxFrames, 0, depthV / uNearFar.y);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+
+#include "common.incl"
+
+varying vec2 vCoord;
+
+#ifdef VS
+
+void main()
+{
+    VSOutput = aPosition;
+    vCoord = aPosition.xy * vec2(0.5) + vec2(0.5);
+}
+
+#else // FS
+
+#include "light_grid.incl"
+
+void main()
+{
+    vec4 normalRT = texture2D(uNormalTex, vCoord.st);
+    vec3 normalV = GBufferNormal(normalRT);
+    
+    // view-space position reconstruction
+    vec3 posV = SampleViewspacePos(vCoord);
+    
+    vec4 cell = FetchLightCell(gl_FragCoord.xy, -posV.z);
+    vec4 light = AccumulateLights(cell, posV, normalV);
+    
+    FSOutput(0) = vec4(light.rgb, light.a * GBufferSpecular(normalRT));
+#ifdef LIGHT_DEBUG
+    FSOutput(0) = vec4(cell.g / float(MAX_TILE_LIGHTS), 0, 0, 1); // lights per tile
+#endif
+}
+
+#endif